@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../utils/Storage.h"
+#include "../utils/Shape.h"
 
 namespace keith {
 
@@ -18,13 +19,43 @@ namespace keith {
         std::shared_ptr<SubType> impl_ptr;
     };
 
+    // A constant operand stored inline in the node that uses it, so scalar
+    // arithmetic needs no tensor of its own. It dereferences to itself and
+    // can be used wherever operators expect a pointer to a sub-expression.
+    class Scalar {
+    public:
+        explicit Scalar(data_t value) : _value(value) {}
+        [[nodiscard]] inline data_t eval(const IndexArray& idx) const { return _value; }
+        [[nodiscard]] inline data_t value() const { return _value; }
+        [[nodiscard]] Shape size() const { return Shape({ 1 }); }
+        [[nodiscard]] index_t size(index_t idx) const { return 1; }
+        [[nodiscard]] index_t n_dim() const { return 0; }
+        inline const Scalar* operator->() const { return this; }
+        inline const Scalar& operator*() const { return *this; }
+    private:
+        data_t _value;
+    };
+
+    // How a node holds an operand of type T.
+    template<typename T>
+    struct Operand {
+        using type = std::shared_ptr<T>;
+    };
+
+    template<>
+    struct Operand<Scalar> {
+        using type = Scalar;
+    };
+
     template<typename Op, typename LhsType, typename RhsType>
     class BinaryExp {
+        using LhsPtr = typename Operand<LhsType>::type;
+        using RhsPtr = typename Operand<RhsType>::type;
     public:
         [[nodiscard]] inline data_t eval(IndexArray idx) const {
             return Op::eval(idx, lhs_ptr, rhs_ptr);
         }
-        BinaryExp(const std::shared_ptr<LhsType>& _lhs, const std::shared_ptr<RhsType> _rhs)
+        BinaryExp(const LhsPtr& _lhs, const RhsPtr& _rhs)
             :lhs_ptr(_lhs), rhs_ptr(_rhs) {}
         [[nodiscard]] Shape size() const {
             return Op::size(lhs_ptr, rhs_ptr);
@@ -38,9 +69,11 @@ namespace keith {
             return std::max(lhs_ptr->n_dim(), rhs_ptr->n_dim());
         }
         ~BinaryExp() = default;
+        [[nodiscard]] inline const LhsPtr& lhs() const { return lhs_ptr; }
+        [[nodiscard]] inline const RhsPtr& rhs() const { return rhs_ptr; }
     private:
-        std::shared_ptr<LhsType> lhs_ptr;
-        std::shared_ptr<RhsType> rhs_ptr;
+        LhsPtr lhs_ptr;
+        RhsPtr rhs_ptr;
     };
 
     template<typename Op, typename LhsType>
@@ -49,8 +82,8 @@ namespace keith {
         [[nodiscard]] inline data_t eval(IndexArray idx) const {
             return Op::eval(idx, lhs_ptr);
         }
-        UnaryExp(const std::shared_ptr<LhsType>&& ptr) : lhs_ptr(ptr) {}
-        [[nodiscard]] Shape& size() const {
+        UnaryExp(const std::shared_ptr<LhsType>& ptr) : lhs_ptr(ptr) {}
+        [[nodiscard]] Shape size() const {
             return lhs_ptr->size();
         }
         [[nodiscard]] index_t size(index_t idx) const {
@@ -59,6 +92,7 @@ namespace keith {
         [[nodiscard]] index_t n_dim() const {
             return lhs_ptr->n_dim();
         }
+        [[nodiscard]] inline const std::shared_ptr<LhsType>& lhs() const { return lhs_ptr; }
     private:
         std::shared_ptr<LhsType> lhs_ptr;
     };
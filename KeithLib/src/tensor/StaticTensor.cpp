@@ -0,0 +1 @@
+#include "StaticTensor.h"
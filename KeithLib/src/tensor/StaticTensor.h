@@ -0,0 +1,186 @@
+#pragma once
+
+#include "../utils/StaticShape.h"
+#include "Exception.h"
+#include "Exp.h"
+#include "impl/TensorImpl.h"
+
+#include <initializer_list>
+#include <memory>
+
+namespace keith {
+
+    // Fixed-size tensor whose elements live inside the object. All loops run
+    // over compile-time bounds and are unrolled through static_for, and no
+    // Storage is allocated. It exposes eval()/size()/n_dim(), so exp() can
+    // place it as a leaf in ordinary expression trees.
+    template<typename T, index_t... Dims>
+    class StaticTensor
+    {
+    public:
+        using shape_type = StaticShape<Dims...>;
+        static constexpr index_t n_elem = shape_type::d_size();
+
+        constexpr StaticTensor() : _data{} {}
+        explicit constexpr StaticTensor(T value) : _data{} {
+            static_for<n_elem>([&](auto i) { _data[i] = value; });
+        }
+        StaticTensor(std::initializer_list<T> list) : _data{} {
+            CHECK_EQUAL(list.size(), n_elem,
+                "Expect %lld elements, but got %zu", n_elem, list.size());
+            index_t i = 0;
+            for (auto v : list) _data[i++] = v;
+        }
+        template<typename SubType>
+        explicit StaticTensor(const Exp<SubType>& exp) : _data{} {
+            const auto& src = exp.ptr();
+            CHECK_TRUE(Shape(src->size()) == shape_type::shape(),
+                "Expression shape does not match the static shape");
+            IndexArray idx(n_dim());
+            idx.memset(0);
+            for (index_t i = 0; i < n_elem; ++i) {
+                _data[i] = (T)src->eval(idx);
+                for (int d = (int)n_dim() - 1; d >= 0; --d) {
+                    if (idx[d] + 1 < shape_type::size(d)) {
+                        ++idx[d];
+                        break;
+                    }
+                    idx[d] = 0;
+                }
+            }
+        }
+
+    public:
+        [[nodiscard]] static constexpr index_t n_dim() { return shape_type::n_dim(); }
+        [[nodiscard]] static constexpr index_t d_size() { return n_elem; }
+        [[nodiscard]] Shape size() const { return shape_type::shape(); }
+        [[nodiscard]] index_t size(index_t idx) const { return shape_type::size(idx); }
+
+        [[nodiscard]] data_t eval(IndexArray idx) const {
+            index_t index = 0;
+            int shift = idx.size() - (int)n_dim();
+            for (int i = 0; i < (int)n_dim(); ++i) {
+                if (i + shift >= 0) index += idx[i + shift] * shape_type::stride(i);
+            }
+            return (data_t)_data[index];
+        }
+
+        template<typename... Idx>
+        [[nodiscard]] constexpr T& operator()(Idx... idx) { return _data[shape_type::offset(idx...)]; }
+        template<typename... Idx>
+        [[nodiscard]] constexpr T operator()(Idx... idx) const { return _data[shape_type::offset(idx...)]; }
+        [[nodiscard]] constexpr T& operator[](index_t idx) { return _data[idx]; }
+        [[nodiscard]] constexpr T operator[](index_t idx) const { return _data[idx]; }
+        [[nodiscard]] T* data() { return _data; }
+        [[nodiscard]] const T* data() const { return _data; }
+
+        [[nodiscard]] Exp<StaticTensor> exp() const {
+            return Exp<StaticTensor>(std::make_shared<StaticTensor>(*this));
+        }
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> to_tensor() const {
+            Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
+            ptr = Alloc::unique_construct<TensorImpl>(shape_type::shape());
+            data_t* data = ptr->data();
+            for (index_t i = 0; i < n_elem; ++i)
+                data[i] = (data_t)_data[i];
+            return ptr;
+        }
+
+        [[nodiscard]] constexpr T sum() const {
+            T res = 0;
+            static_for<n_elem>([&](auto i) { res += _data[i]; });
+            return res;
+        }
+
+#define KEITH_STATIC_COMPOUND(op)                                       \
+        constexpr StaticTensor& operator op##=(const StaticTensor& rhs) {  \
+            static_for<n_elem>([&](auto i) { _data[i] op##= rhs._data[i]; }); \
+            return *this;                                                   \
+        }                                                                   \
+        constexpr StaticTensor& operator op##=(T rhs) {                    \
+            static_for<n_elem>([&](auto i) { _data[i] op##= rhs; });       \
+            return *this;                                                   \
+        }
+        KEITH_STATIC_COMPOUND(+)
+        KEITH_STATIC_COMPOUND(-)
+        KEITH_STATIC_COMPOUND(*)
+        KEITH_STATIC_COMPOUND(/)
+#undef KEITH_STATIC_COMPOUND
+
+    private:
+        T _data[n_elem];
+    };
+
+#define KEITH_STATIC_BINARY(op)                                                                     \
+    template<typename T, index_t... Dims>                                                           \
+    [[nodiscard]] constexpr StaticTensor<T, Dims...> operator op(StaticTensor<T, Dims...> lhs,     \
+        const StaticTensor<T, Dims...>& rhs) {                                                      \
+        return lhs op##= rhs;                                                                       \
+    }                                                                                               \
+    template<typename T, index_t... Dims>                                                           \
+    [[nodiscard]] constexpr StaticTensor<T, Dims...> operator op(StaticTensor<T, Dims...> lhs, T rhs) { \
+        return lhs op##= rhs;                                                                       \
+    }                                                                                               \
+    template<typename T, index_t... Dims>                                                           \
+    [[nodiscard]] constexpr StaticTensor<T, Dims...> operator op(T lhs, const StaticTensor<T, Dims...>& rhs) { \
+        StaticTensor<T, Dims...> res(lhs);                                                          \
+        return res op##= rhs;                                                                       \
+    }
+    KEITH_STATIC_BINARY(+)
+    KEITH_STATIC_BINARY(-)
+    KEITH_STATIC_BINARY(*)
+    KEITH_STATIC_BINARY(/)
+#undef KEITH_STATIC_BINARY
+
+    template<typename T, index_t... Dims>
+    [[nodiscard]] constexpr StaticTensor<T, Dims...> operator-(const StaticTensor<T, Dims...>& lhs) {
+        return T(0) - lhs;
+    }
+
+    template<typename T, index_t M, index_t K, index_t N>
+    [[nodiscard]] constexpr StaticTensor<T, M, N> matmul(const StaticTensor<T, M, K>& lhs, const StaticTensor<T, K, N>& rhs) {
+        StaticTensor<T, M, N> res;
+        static_for<M>([&](auto i) {
+            static_for<K>([&](auto k) {
+                T a = lhs[i * K + k];
+                static_for<N>([&](auto j) { res[i * N + j] += a * rhs[k * N + j]; });
+            });
+        });
+        return res;
+    }
+
+    template<typename T, index_t K, index_t N>
+    [[nodiscard]] constexpr StaticTensor<T, N> matmul(const StaticTensor<T, K>& lhs, const StaticTensor<T, K, N>& rhs) {
+        StaticTensor<T, N> res;
+        static_for<K>([&](auto k) {
+            static_for<N>([&](auto j) { res[j] += lhs[k] * rhs[k * N + j]; });
+        });
+        return res;
+    }
+
+    template<typename T, index_t M, index_t K>
+    [[nodiscard]] constexpr StaticTensor<T, M> matmul(const StaticTensor<T, M, K>& lhs, const StaticTensor<T, K>& rhs) {
+        StaticTensor<T, M> res;
+        static_for<M>([&](auto i) {
+            static_for<K>([&](auto k) { res[i] += lhs[i * K + k] * rhs[k]; });
+        });
+        return res;
+    }
+
+    template<typename T, index_t N>
+    [[nodiscard]] constexpr T dot(const StaticTensor<T, N>& lhs, const StaticTensor<T, N>& rhs) {
+        T res = 0;
+        static_for<N>([&](auto i) { res += lhs[i] * rhs[i]; });
+        return res;
+    }
+
+    template<typename T, index_t M, index_t N>
+    [[nodiscard]] constexpr StaticTensor<T, N, M> transpose(const StaticTensor<T, M, N>& src) {
+        StaticTensor<T, N, M> res;
+        static_for<M>([&](auto i) {
+            static_for<N>([&](auto j) { res[j * M + i] = src[i * N + j]; });
+        });
+        return res;
+    }
+
+}
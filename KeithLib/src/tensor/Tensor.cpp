@@ -11,4 +11,11 @@ namespace keith {
 	Tensor::Tensor(Storage&& storage, Shape&& shape, Array<index_t>&& stride) : Exp<TensorImpl>(Alloc::unique_construct<TensorImpl>(std::move(storage), std::move(shape), std::move(stride))) {}
 	Tensor::Tensor(Alloc::NonTrivalUniquePtr<TensorImpl>&& ptr) : Exp<TensorImpl>(std::move(ptr)) {}
 
+	Tensor& Tensor::requires_grad_(bool requires_grad) {
+		impl_ptr->requires_grad_(requires_grad);
+		return *this;
+	}
+	const std::shared_ptr<TensorImpl>& Tensor::grad() const { return impl_ptr->grad(); }
+	void Tensor::zero_grad() { impl_ptr->zero_grad(); }
+
 }
@@ -17,13 +17,18 @@ namespace keith {
 		Tensor& operator=(const Tensor& other)
 		{
 			if (this != &other) {
-				impl_ptr = Alloc::unique_construct<TensorImpl>(*other.impl_ptr);
+				impl_ptr = other.impl_ptr->clone();
+				impl_ptr->requires_grad_(other.impl_ptr->requires_grad());
 			}
 			return *this;
 		}
 		Tensor& operator=(Tensor&& other) = default;
 		~Tensor() = default;
 		explicit Tensor(Alloc::NonTrivalUniquePtr<TensorImpl>&& ptr);
+
+		Tensor& requires_grad_(bool requires_grad = true);
+		[[nodiscard]] const std::shared_ptr<TensorImpl>& grad() const;
+		void zero_grad();
 	};
 
 }
@@ -0,0 +1,54 @@
+#include "Autograd.h"
+
+#include <cstring>
+
+namespace keith {
+
+    namespace autograd {
+
+        Tape::Tape(bool checkpoint, index_t block_size) : _arena(block_size), _checkpoint(checkpoint) {}
+
+        data_t* Tape::allocate(index_t n) {
+            data_t* ptr = _arena.allocate_array<data_t>(n);
+            std::memset(ptr, 0, n * sizeof(data_t));
+            return ptr;
+        }
+
+        void Tape::reset() {
+            _arena.reset();
+        }
+
+        index_t broadcast_offset(const IndexArray& idx, const Shape& shape) {
+            index_t offset = 0;
+            int shift = idx.size() - (int)shape.n_dim();
+            for (int i = 0; i < (int)shape.n_dim(); ++i) {
+                index_t v = i + shift >= 0 ? idx[i + shift] : 0;
+                offset = offset * shape[i] + (shape[i] == 1 ? 0 : v);
+            }
+            return offset;
+        }
+
+        bool next_index(IndexArray& idx, const Shape& shape) {
+            for (int i = (int)shape.n_dim() - 1; i >= 0; --i) {
+                if (idx[i] + 1 < shape[i]) {
+                    ++idx[i];
+                    return true;
+                }
+                idx[i] = 0;
+            }
+            return false;
+        }
+
+        void reduce_to(const data_t* grad, const Shape& from, data_t* out, const Shape& to) {
+            std::memset(out, 0, to.d_size() * sizeof(data_t));
+            IndexArray idx(from.n_dim());
+            idx.memset(0);
+            index_t i = 0;
+            do {
+                out[broadcast_offset(idx, to)] += grad[i++];
+            } while (next_index(idx, from));
+        }
+
+    }
+
+}
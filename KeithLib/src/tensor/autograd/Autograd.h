@@ -0,0 +1,428 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Shape.h"
+#include "../Exp.h"
+#include "../impl/TensorImpl.h"
+#include "../operations/Operations.h"
+
+#include <cmath>
+#include <type_traits>
+
+namespace keith {
+
+    namespace autograd {
+
+        // Gradient buffers and saved activations of one backward pass live in an
+        // arena owned by the tape, so a training step does no per-node heap work.
+        // Operands of element-wise ops are re-evaluated where their derivative
+        // reads them, as each element is read once. Matmul operands are read
+        // once per row or column of the other side, so they are saved to the
+        // arena, unless checkpoint is enabled, which re-evaluates them too.
+        class Tape {
+        public:
+            explicit Tape(bool checkpoint = false, index_t block_size = 1 << 20);
+            Tape(const Tape& other) = delete;
+            Tape& operator=(const Tape& other) = delete;
+
+            [[nodiscard]] data_t* allocate(index_t n);
+            void reset();
+            [[nodiscard]] bool checkpoint() const { return _checkpoint; }
+            void set_checkpoint(bool checkpoint) { _checkpoint = checkpoint; }
+            [[nodiscard]] index_t used_bytes() const { return _arena.used(); }
+            [[nodiscard]] index_t peak_bytes() const { return _arena.peak(); }
+        private:
+            Alloc::Arena _arena;
+            bool _checkpoint;
+        };
+
+        index_t broadcast_offset(const IndexArray& idx, const Shape& shape);
+        bool next_index(IndexArray& idx, const Shape& shape);
+        void reduce_to(const data_t* grad, const Shape& from, data_t* out, const Shape& to);
+
+        template<typename ExpType>
+        struct Node;
+
+        template<typename Op>
+        struct Derivative;
+
+        template<typename ExpType>
+        class Values {
+        public:
+            Values(const std::shared_ptr<ExpType>& ptr, Tape& tape, bool reused)
+                : _ptr(ptr), _shape(ptr->size()), _buf(nullptr) {
+                if (!reused || tape.checkpoint() || std::is_same<ExpType, TensorImpl>::value) return;
+                _buf = tape.allocate(_shape.d_size());
+                IndexArray idx(_shape.n_dim());
+                idx.memset(0);
+                index_t i = 0;
+                do {
+                    _buf[i++] = _ptr->eval(idx);
+                } while (next_index(idx, _shape));
+            }
+            [[nodiscard]] data_t operator()(const IndexArray& idx) const {
+                if (_buf) return _buf[broadcast_offset(idx, _shape)];
+                return _ptr->eval(idx);
+            }
+        private:
+            const std::shared_ptr<ExpType>& _ptr;
+            Shape _shape;
+            data_t* _buf;
+        };
+
+        template<typename ExpType>
+        void propagate(const std::shared_ptr<ExpType>& ptr, const data_t* grad, const Shape& shape, Tape& tape) {
+            if (!Node<ExpType>::requires_grad(ptr)) return;
+            Shape own = ptr->size();
+            if (own == shape) {
+                Node<ExpType>::backward(ptr, grad, tape);
+                return;
+            }
+            data_t* reduced = tape.allocate(own.d_size());
+            reduce_to(grad, shape, reduced, own);
+            Node<ExpType>::backward(ptr, reduced, tape);
+        }
+
+        template<>
+        struct Node<TensorImpl> {
+            static bool requires_grad(const std::shared_ptr<TensorImpl>& ptr) {
+                return ptr->requires_grad();
+            }
+            static void backward(const std::shared_ptr<TensorImpl>& ptr, const data_t* grad, Tape& tape) {
+                if (ptr->requires_grad()) ptr->accumulate_grad(grad);
+            }
+        };
+
+        // Inline scalars are constants: they never take a gradient and their
+        // value is read directly.
+        template<>
+        struct Node<Scalar> {
+            static bool requires_grad(const Scalar& value) { return false; }
+        };
+
+        template<>
+        class Values<Scalar> {
+        public:
+            Values(const Scalar& value, Tape& tape, bool reused) : _value(value.value()) {}
+            [[nodiscard]] data_t operator()(const IndexArray& idx) const { return _value; }
+        private:
+            data_t _value;
+        };
+
+        inline void propagate(const Scalar& value, const data_t* grad, const Shape& shape, Tape& tape) {}
+
+        template<typename Op, typename LhsType, typename RhsType>
+        struct Node<BinaryExp<Op, LhsType, RhsType>> {
+            using ExpType = BinaryExp<Op, LhsType, RhsType>;
+            static bool requires_grad(const std::shared_ptr<ExpType>& ptr) {
+                return Node<LhsType>::requires_grad(ptr->lhs()) || Node<RhsType>::requires_grad(ptr->rhs());
+            }
+            static void backward(const std::shared_ptr<ExpType>& ptr, const data_t* grad, Tape& tape) {
+                Derivative<Op>::template backward<LhsType, RhsType>(ptr->lhs(), ptr->rhs(), ptr->size(), grad, tape);
+            }
+        };
+
+        template<typename Op, typename LhsType>
+        struct Node<UnaryExp<Op, LhsType>> {
+            using ExpType = UnaryExp<Op, LhsType>;
+            static bool requires_grad(const std::shared_ptr<ExpType>& ptr) {
+                return Node<LhsType>::requires_grad(ptr->lhs());
+            }
+            static void backward(const std::shared_ptr<ExpType>& ptr, const data_t* grad, Tape& tape) {
+                Derivative<Op>::backward(ptr->lhs(), ptr->size(), grad, tape);
+            }
+        };
+
+        template<typename ExpType, typename Func>
+        void propagate_elementwise(const std::shared_ptr<ExpType>& ptr, const data_t* grad, const Shape& shape, Tape& tape, Func func) {
+            if (!Node<ExpType>::requires_grad(ptr)) return;
+            data_t* res = tape.allocate(shape.d_size());
+            IndexArray idx(shape.n_dim());
+            idx.memset(0);
+            index_t i = 0;
+            do {
+                res[i] = func(grad[i], idx);
+                ++i;
+            } while (next_index(idx, shape));
+            propagate(ptr, res, shape, tape);
+        }
+
+        template<typename Func>
+        void propagate_elementwise(const Scalar& value, const data_t* grad, const Shape& shape, Tape& tape, Func func) {}
+
+        template<>
+        struct Derivative<op::Add> {
+            template<typename LhsType, typename RhsType>
+            static void backward(const typename Operand<LhsType>::type& lhs, const typename Operand<RhsType>::type& rhs,
+                const Shape& shape, const data_t* grad, Tape& tape) {
+                propagate(lhs, grad, shape, tape);
+                propagate(rhs, grad, shape, tape);
+            }
+        };
+
+        template<>
+        struct Derivative<op::Sub> {
+            template<typename LhsType, typename RhsType>
+            static void backward(const typename Operand<LhsType>::type& lhs, const typename Operand<RhsType>::type& rhs,
+                const Shape& shape, const data_t* grad, Tape& tape) {
+                propagate(lhs, grad, shape, tape);
+                propagate_elementwise(rhs, grad, shape, tape,
+                    [](data_t g, const IndexArray&) { return -g; });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Mul> {
+            template<typename LhsType, typename RhsType>
+            static void backward(const typename Operand<LhsType>::type& lhs, const typename Operand<RhsType>::type& rhs,
+                const Shape& shape, const data_t* grad, Tape& tape) {
+                if (Node<LhsType>::requires_grad(lhs)) {
+                    Values<RhsType> r(rhs, tape, false);
+                    propagate_elementwise(lhs, grad, shape, tape,
+                        [&](data_t g, const IndexArray& idx) { return g * r(idx); });
+                }
+                if (Node<RhsType>::requires_grad(rhs)) {
+                    Values<LhsType> l(lhs, tape, false);
+                    propagate_elementwise(rhs, grad, shape, tape,
+                        [&](data_t g, const IndexArray& idx) { return g * l(idx); });
+                }
+            }
+        };
+
+        template<>
+        struct Derivative<op::Div> {
+            template<typename LhsType, typename RhsType>
+            static void backward(const typename Operand<LhsType>::type& lhs, const typename Operand<RhsType>::type& rhs,
+                const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<RhsType> r(rhs, tape, false);
+                if (Node<LhsType>::requires_grad(lhs)) {
+                    propagate_elementwise(lhs, grad, shape, tape,
+                        [&](data_t g, const IndexArray& idx) { return g / r(idx); });
+                }
+                if (Node<RhsType>::requires_grad(rhs)) {
+                    Values<LhsType> l(lhs, tape, false);
+                    propagate_elementwise(rhs, grad, shape, tape,
+                        [&](data_t g, const IndexArray& idx) {
+                            data_t rv = r(idx);
+                            return -g * l(idx) / (rv * rv);
+                        });
+                }
+            }
+        };
+
+        struct MatrixMulDerivative {
+            template<typename LhsType, typename RhsType>
+            static void backward(const typename Operand<LhsType>::type& lhs, const typename Operand<RhsType>::type& rhs,
+                const Shape& shape, const data_t* grad, Tape& tape) {
+                index_t n = shape.n_dim();
+                index_t M = shape[n - 2], N = shape[n - 1];
+                index_t K = lhs->size()[lhs->n_dim() - 1];
+                bool lhs_grad = Node<LhsType>::requires_grad(lhs);
+                bool rhs_grad = Node<RhsType>::requires_grad(rhs);
+                Shape lshape(shape), rshape(shape);
+                lshape[n - 1] = K;
+                rshape[n - 2] = K;
+                data_t* lres = lhs_grad ? tape.allocate(lshape.d_size()) : nullptr;
+                data_t* rres = rhs_grad ? tape.allocate(rshape.d_size()) : nullptr;
+                Values<LhsType> l(lhs, tape, rhs_grad && N > 1);
+                Values<RhsType> r(rhs, tape, lhs_grad && M > 1);
+                IndexArray idx(n), lidx(n), ridx(n);
+                idx.memset(0);
+                index_t i = 0;
+                do {
+                    for (index_t d = 0; d < n; ++d) lidx[d] = ridx[d] = idx[d];
+                    index_t row = i / N, col = i % N, batch = row / M;
+                    for (index_t k = 0; k < K; ++k) {
+                        lidx[n - 1] = k;
+                        ridx[n - 2] = k;
+                        if (lres) lres[row * K + k] += grad[i] * r(ridx);
+                        if (rres) rres[(batch * K + k) * N + col] += grad[i] * l(lidx);
+                    }
+                    ++i;
+                } while (next_index(idx, shape));
+                if (lres) propagate(lhs, lres, lshape, tape);
+                if (rres) propagate(rhs, rres, rshape, tape);
+            }
+        };
+
+        template<>
+        struct Derivative<op::MatrixMul_2dim> : MatrixMulDerivative {};
+        template<>
+        struct Derivative<op::MatrixMul_3dim> : MatrixMulDerivative {};
+        template<>
+        struct Derivative<op::MatrixMul> : MatrixMulDerivative {};
+
+        template<>
+        struct Derivative<op::Neg> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [](data_t g, const IndexArray&) { return -g; });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Sin> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) { return g * vmath::cos(x(idx)); });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Cos> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) { return -g * vmath::sin(x(idx)); });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Tan> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) {
+                        data_t c = vmath::cos(x(idx));
+                        return g / (c * c);
+                    });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Exponential> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) { return g * vmath::exp(x(idx)); });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Log> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) { return g / x(idx); });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Tanh> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) {
+                        data_t t = vmath::tanh(x(idx));
+                        return g * (1 - t * t);
+                    });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Sigmoid> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) {
+                        data_t s = vmath::sigmoid(x(idx));
+                        return g * s * (1 - s);
+                    });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Erf> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) {
+                        data_t v = x(idx);
+                        return g * 1.1283791670955126 * vmath::exp(-v * v);
+                    });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Sqrt> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) { return g * 0.5 * vmath::rsqrt(x(idx)); });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Rsqrt> {
+            template<typename LhsType>
+            static void backward(const std::shared_ptr<LhsType>& lhs, const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> x(lhs, tape, false);
+                propagate_elementwise(lhs, grad, shape, tape,
+                    [&](data_t g, const IndexArray& idx) {
+                        data_t r = vmath::rsqrt(x(idx));
+                        return -g * 0.5 * r * r * r;
+                    });
+            }
+        };
+
+        template<>
+        struct Derivative<op::Pow> {
+            template<typename LhsType, typename RhsType>
+            static void backward(const typename Operand<LhsType>::type& lhs, const typename Operand<RhsType>::type& rhs,
+                const Shape& shape, const data_t* grad, Tape& tape) {
+                Values<LhsType> l(lhs, tape, false);
+                Values<RhsType> r(rhs, tape, false);
+                if (Node<LhsType>::requires_grad(lhs)) {
+                    propagate_elementwise(lhs, grad, shape, tape,
+                        [&](data_t g, const IndexArray& idx) {
+                            data_t e = r(idx);
+                            return g * e * vmath::pow(l(idx), e - 1);
+                        });
+                }
+                if (Node<RhsType>::requires_grad(rhs)) {
+                    propagate_elementwise(rhs, grad, shape, tape,
+                        [&](data_t g, const IndexArray& idx) {
+                            data_t b = l(idx);
+                            return g * vmath::pow(b, r(idx)) * vmath::log(b);
+                        });
+                }
+            }
+        };
+
+        template<typename SubType>
+        void backward(const Exp<SubType>& exp, Tape& tape) {
+            Shape shape = exp.ptr()->size();
+            data_t* grad = tape.allocate(shape.d_size());
+            std::fill_n(grad, shape.d_size(), 1);
+            Node<SubType>::backward(exp.ptr(), grad, tape);
+        }
+
+        template<typename SubType>
+        void backward(const Exp<SubType>& exp, const TensorImpl& grad_output, Tape& tape) {
+            Shape shape = exp.ptr()->size();
+            CHECK_TRUE(shape == grad_output.size(),
+                "backward() expects a gradient with the same shape as the output");
+            data_t* grad = tape.allocate(shape.d_size());
+            IndexArray idx(shape.n_dim());
+            idx.memset(0);
+            index_t i = 0;
+            do {
+                grad[i++] = grad_output.eval(idx);
+            } while (next_index(idx, shape));
+            Node<SubType>::backward(exp.ptr(), grad, tape);
+        }
+
+    }
+
+}
@@ -0,0 +1,130 @@
+#include "Batcher.h"
+#include "../operations/Gemm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace keith {
+
+    MatmulBatcher::MatmulBatcher(const TensorImpl& weight, index_t max_batch, index_t max_delay_us)
+        : _weight(weight.contiguous()), _k(0), _n(0), _max_batch(max_batch),
+        _max_delay(std::chrono::microseconds(max_delay_us)), _queued_rows(0), _stop(false),
+        _requests(0), _batches(0), _rows(0), _latency_sum_us(0), _latency_max_us(0), _started(false) {
+        CHECK_EQUAL(weight.n_dim(), 2, "MatmulBatcher expects a 2D weight, but got %lldD", weight.n_dim());
+        CHECK_TRUE(max_batch > 0, "MatmulBatcher expects a positive batch size, but got %lld", max_batch);
+        _k = weight.size(0);
+        _n = weight.size(1);
+        _collector = std::thread([this]() { loop(); });
+    }
+
+    MatmulBatcher::~MatmulBatcher() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _collector.join();
+    }
+
+    Future MatmulBatcher::submit(const TensorImpl& input) {
+        CHECK_TRUE(input.n_dim() == 1 || input.n_dim() == 2,
+            "MatmulBatcher expects a 1D or 2D input, but got %lldD", input.n_dim());
+        index_t k = input.size(input.n_dim() - 1);
+        CHECK_EQUAL(k, _k,
+            "input and weight shapes cannot be multiplied (K is %lld for the input and %lld for the weight)", k, _k);
+        index_t rows = input.n_dim() == 2 ? input.size(0) : 1;
+        auto future = std::make_shared<FutureImpl>(input.n_dim() == 2 ? Shape({ rows, _n }) : Shape({ _n }));
+        Request request{ input.clone(), rows, future, Clock::now() };
+        {
+            std::lock_guard<std::mutex> stats(_stats_mutex);
+            if (!_started) {
+                _first = request.submitted;
+                _started = true;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(std::move(request));
+            _queued_rows += rows;
+        }
+        _cv.notify_one();
+        return Future(std::move(future));
+    }
+
+    MatmulBatcher::Stats MatmulBatcher::stats() const {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        Stats res{};
+        res.requests = _requests;
+        res.batches = _batches;
+        if (_batches > 0) res.mean_batch_rows = (double)_rows / _batches;
+        if (_requests > 0) {
+            res.mean_latency_us = _latency_sum_us / _requests;
+            double seconds = std::chrono::duration<double>(_last - _first).count();
+            if (seconds > 0) res.throughput = _requests / seconds;
+        }
+        res.max_latency_us = _latency_max_us;
+        return res;
+    }
+
+    void MatmulBatcher::reset_stats() {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        _requests = _batches = _rows = 0;
+        _latency_sum_us = _latency_max_us = 0;
+        _started = false;
+    }
+
+    void MatmulBatcher::loop() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _cv.wait(lock, [this]() { return _stop || !_queue.empty(); });
+            if (_queue.empty()) return;
+            Clock::time_point deadline = _queue.front().submitted + _max_delay;
+            _cv.wait_until(lock, deadline, [this]() { return _stop || _queued_rows >= _max_batch; });
+
+            std::vector<Request> batch;
+            index_t rows = 0;
+            while (!_queue.empty() && (batch.empty() || rows + _queue.front().rows <= _max_batch)) {
+                rows += _queue.front().rows;
+                batch.push_back(std::move(_queue.front()));
+                _queue.pop_front();
+            }
+            _queued_rows -= rows;
+            lock.unlock();
+            run(batch, rows);
+            lock.lock();
+        }
+    }
+
+    void MatmulBatcher::run(std::vector<Request>& batch, index_t rows) {
+        std::vector<data_t> a(rows * _k), c(rows * _n);
+        index_t offset = 0;
+        for (Request& r : batch) {
+            auto src = r.input->contiguous();
+            std::memcpy(a.data() + offset * _k, static_cast<const TensorImpl&>(*src).data(), r.rows * _k * sizeof(data_t));
+            offset += r.rows;
+        }
+        gemm::run(a.data(), static_cast<const TensorImpl&>(*_weight).data(), c.data(), rows, _n, _k);
+
+        offset = 0;
+        for (Request& r : batch) {
+            auto out = Alloc::shared_construct<TensorImpl>(r.future->size());
+            std::memcpy(out->data(), c.data() + offset * _n, r.rows * _n * sizeof(data_t));
+            offset += r.rows;
+            r.future->complete(std::move(out));
+        }
+
+        Clock::time_point done = Clock::now();
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        for (const Request& r : batch) {
+            double us = std::chrono::duration<double, std::micro>(done - r.submitted).count();
+            _latency_sum_us += us;
+            _latency_max_us = std::max(_latency_max_us, us);
+        }
+        _requests += (index_t)batch.size();
+        _rows += rows;
+        ++_batches;
+        _last = done;
+    }
+
+}
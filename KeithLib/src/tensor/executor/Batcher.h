@@ -0,0 +1,80 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Shape.h"
+#include "../impl/TensorImpl.h"
+#include "Executor.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace keith {
+
+    // Collects small `input @ weight` requests against one shared (K, N) weight
+    // and runs them as a single GEMM. A collector thread closes a batch once it
+    // holds `max_batch` rows or its oldest request has waited `max_delay_us`,
+    // stacks the inputs, multiplies once and hands each caller its rows through
+    // the returned future. The weight is shared with the caller, not copied.
+    class MatmulBatcher
+    {
+    public:
+        struct Stats {
+            index_t requests;
+            index_t batches;
+            double mean_batch_rows;
+            // Submission to completion, per request.
+            double mean_latency_us;
+            double max_latency_us;
+            // Completed requests per second since the first submission.
+            double throughput;
+        };
+
+        explicit MatmulBatcher(const TensorImpl& weight, index_t max_batch = 64, index_t max_delay_us = 500);
+        MatmulBatcher(const MatmulBatcher& other) = delete;
+        MatmulBatcher& operator=(const MatmulBatcher& other) = delete;
+        // Finishes every queued request before returning.
+        ~MatmulBatcher();
+
+        // `input` is (K) or (rows, K); the result is (N) or (rows, N). The
+        // input is snapshotted, so the caller may reuse it right away.
+        [[nodiscard]] Future submit(const TensorImpl& input);
+        [[nodiscard]] Stats stats() const;
+        void reset_stats();
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Request {
+            Alloc::NonTrivalUniquePtr<TensorImpl> input;
+            index_t rows;
+            std::shared_ptr<FutureImpl> future;
+            Clock::time_point submitted;
+        };
+
+        void loop();
+        void run(std::vector<Request>& batch, index_t rows);
+
+        Alloc::NonTrivalUniquePtr<TensorImpl> _weight;
+        index_t _k, _n;
+        index_t _max_batch;
+        Clock::duration _max_delay;
+
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::deque<Request> _queue;
+        index_t _queued_rows;
+        bool _stop;
+
+        mutable std::mutex _stats_mutex;
+        index_t _requests, _batches, _rows;
+        double _latency_sum_us, _latency_max_us;
+        // Set by the first submission since the stats were last reset.
+        bool _started;
+        Clock::time_point _first, _last;
+
+        std::thread _collector;
+    };
+
+}
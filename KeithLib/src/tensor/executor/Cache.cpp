@@ -0,0 +1,62 @@
+#include "Cache.h"
+
+#include <algorithm>
+
+namespace keith {
+
+    const std::shared_ptr<TensorImpl>& CachedImpl::value() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& inner : _inner) (void)inner->value();
+        // Versions are read before recomputing, so a write that lands while
+        // the result is being refreshed is picked up by the next refresh.
+        std::vector<index_t> seen(_leaves.size());
+        index_t begin = _shape[0], end = 0;
+        bool changed = false, full = false;
+        for (size_t i = 0; i < _leaves.size(); ++i) {
+            Leaf& leaf = _leaves[i];
+            seen[i] = leaf.tensor->version();
+            if (seen[i] == leaf.version) continue;
+            changed = true;
+            index_t lo, hi;
+            if (!_partial || !leaf.rows || !leaf.tensor->written_since(leaf.version, lo, hi)) {
+                full = true;
+                continue;
+            }
+            if (lo == hi) continue;
+            begin = std::min(begin, lo);
+            end = std::max(end, hi);
+        }
+        if (full) {
+            _full(*_result);
+            ++_stats.full;
+        }
+        else if (begin < end) {
+            _partial(*_result, begin, end);
+            ++_stats.partial;
+            _stats.rows += end - begin;
+        }
+        else ++_stats.hits;
+        if (changed)
+            for (size_t i = 0; i < _leaves.size(); ++i) _leaves[i].version = seen[i];
+        return _result;
+    }
+
+    bool CachedImpl::stale() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const Leaf& leaf : _leaves)
+            if (leaf.tensor->version() != leaf.version) return true;
+        return false;
+    }
+
+    CachedImpl::Stats CachedImpl::stats() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+
+    Cached::Cached(std::shared_ptr<CachedImpl>&& ptr) : Exp<CachedImpl>(std::move(ptr)) {}
+
+    const std::shared_ptr<TensorImpl>& Cached::value() const { return impl_ptr->value(); }
+    bool Cached::stale() const { return impl_ptr->stale(); }
+    CachedImpl::Stats Cached::stats() const { return impl_ptr->stats(); }
+
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include "../../utils/Shape.h"
+#include "../Exp.h"
+#include "../impl/TensorImpl.h"
+#include "../operations/Operations.h"
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace keith {
+
+    class CachedImpl;
+
+    // What an expression reads: tensors, and cached expressions, which have
+    // to be refreshed before they are.
+    struct Operands {
+        std::vector<std::shared_ptr<TensorImpl>> tensors;
+        std::vector<std::shared_ptr<CachedImpl>> caches;
+    };
+
+    template<typename ExpType>
+    struct Leaves {
+        static void collect(const std::shared_ptr<ExpType>& ptr, Operands& leaves) {}
+    };
+
+    template<>
+    struct Leaves<TensorImpl> {
+        static void collect(const std::shared_ptr<TensorImpl>& ptr, Operands& leaves) {
+            leaves.tensors.push_back(ptr);
+        }
+    };
+
+    template<>
+    struct Leaves<Scalar> {
+        static void collect(const Scalar& value, Operands& leaves) {}
+    };
+
+    template<typename Op, typename LhsType, typename RhsType>
+    struct Leaves<BinaryExp<Op, LhsType, RhsType>> {
+        static void collect(const std::shared_ptr<BinaryExp<Op, LhsType, RhsType>>& ptr, Operands& leaves) {
+            Leaves<LhsType>::collect(ptr->lhs(), leaves);
+            Leaves<RhsType>::collect(ptr->rhs(), leaves);
+        }
+    };
+
+    template<typename Op, typename LhsType>
+    struct Leaves<UnaryExp<Op, LhsType>> {
+        static void collect(const std::shared_ptr<UnaryExp<Op, LhsType>>& ptr, Operands& leaves) {
+            Leaves<LhsType>::collect(ptr->lhs(), leaves);
+        }
+    };
+
+    // An element-wise expression restricted to rows [begin, end) of its
+    // result: operands whose first dimension is the result's are sliced,
+    // broadcast ones are kept whole. `local` is false for expressions where
+    // a row of the result depends on other rows, such as products.
+    template<typename ExpType>
+    struct Rows {
+        static constexpr bool local = false;
+    };
+
+    template<>
+    struct Rows<TensorImpl> {
+        static constexpr bool local = true;
+        static bool spans(const TensorImpl& tensor, const Shape& shape) {
+            return tensor.n_dim() == shape.n_dim() && tensor.size(0) == shape[0];
+        }
+        static std::shared_ptr<TensorImpl> slice(const std::shared_ptr<TensorImpl>& ptr, index_t begin, index_t end, const Shape& shape) {
+            if (!spans(*ptr, shape)) return ptr;
+            return std::shared_ptr<TensorImpl>(ptr->slice(begin, end, 0));
+        }
+    };
+
+    template<>
+    struct Rows<Scalar> {
+        static constexpr bool local = true;
+        static Scalar slice(const Scalar& value, index_t begin, index_t end, const Shape& shape) { return value; }
+    };
+
+    template<typename Op, typename LhsType>
+    struct Rows<UnaryExp<Op, LhsType>> {
+        static constexpr bool local = op::has_name<Op>::value && Rows<LhsType>::local;
+        static std::shared_ptr<UnaryExp<Op, LhsType>> slice(const std::shared_ptr<UnaryExp<Op, LhsType>>& ptr,
+            index_t begin, index_t end, const Shape& shape) {
+            return std::make_shared<UnaryExp<Op, LhsType>>(Rows<LhsType>::slice(ptr->lhs(), begin, end, shape));
+        }
+    };
+
+    template<typename Op, typename LhsType, typename RhsType>
+    struct Rows<BinaryExp<Op, LhsType, RhsType>> {
+        static constexpr bool local = op::has_name<Op>::value && Rows<LhsType>::local && Rows<RhsType>::local;
+        static std::shared_ptr<BinaryExp<Op, LhsType, RhsType>> slice(const std::shared_ptr<BinaryExp<Op, LhsType, RhsType>>& ptr,
+            index_t begin, index_t end, const Shape& shape) {
+            return std::make_shared<BinaryExp<Op, LhsType, RhsType>>(
+                Rows<LhsType>::slice(ptr->lhs(), begin, end, shape), Rows<RhsType>::slice(ptr->rhs(), begin, end, shape));
+        }
+    };
+
+    // A materialized expression that is brought up to date on demand. It
+    // remembers the version of every tensor the expression reads and only
+    // recomputes once one of them has been written. When the expression is
+    // element-wise and each write since went through TensorImpl::data(begin,
+    // end) on a contiguous operand whose rows line up with the result's,
+    // only the rows those writes cover are recomputed. A cached expression
+    // used as an operand is refreshed first, and its tensors count as read.
+    class CachedImpl
+    {
+    public:
+        struct Stats {
+            // Refreshes that found nothing to do.
+            index_t hits;
+            index_t full;
+            index_t partial;
+            // Rows recomputed by partial refreshes.
+            index_t rows;
+        };
+
+        template<typename SubType>
+        explicit CachedImpl(const std::shared_ptr<SubType>& exp);
+        CachedImpl(const CachedImpl& other) = delete;
+        CachedImpl& operator=(const CachedImpl& other) = delete;
+
+        [[nodiscard]] index_t n_dim() const { return _shape.n_dim(); }
+        [[nodiscard]] index_t size(index_t idx) const { return _shape[idx]; }
+        [[nodiscard]] const Shape& size() const { return _shape; }
+        // Reads the value as of the last refresh; value() refreshes it.
+        [[nodiscard]] data_t eval(IndexArray idx) const { return _result->eval(std::move(idx)); }
+
+        // The result, recomputed first where its operands changed.
+        const std::shared_ptr<TensorImpl>& value();
+        [[nodiscard]] bool stale() const;
+        [[nodiscard]] Stats stats() const;
+    private:
+        struct Leaf {
+            std::shared_ptr<TensorImpl> tensor;
+            index_t version;
+            // Row i of this operand feeds only row i of the result.
+            bool rows;
+        };
+
+        Shape _shape;
+        std::vector<Leaf> _leaves;
+        std::vector<std::shared_ptr<CachedImpl>> _inner;
+        std::function<void(TensorImpl&)> _full;
+        // Empty unless the expression is element-wise.
+        std::function<void(TensorImpl&, index_t, index_t)> _partial;
+        std::shared_ptr<TensorImpl> _result;
+        mutable std::mutex _mutex;
+        Stats _stats;
+    };
+
+    template<>
+    struct Leaves<CachedImpl> {
+        static void collect(const std::shared_ptr<CachedImpl>& ptr, Operands& leaves) {
+            leaves.caches.push_back(ptr);
+        }
+    };
+
+    template<typename SubType>
+    CachedImpl::CachedImpl(const std::shared_ptr<SubType>& exp) : _shape(exp->size()), _stats{ 0, 1, 0, 0 } {
+        Operands operands;
+        Leaves<SubType>::collect(exp, operands);
+        for (auto& tensor : operands.tensors)
+            _leaves.push_back({ tensor, tensor->version(), Rows<TensorImpl>::spans(*tensor, _shape) && tensor->is_contiguous() });
+        // Inner results are only ever read whole, so their tensors never
+        // allow a partial refresh.
+        for (auto& inner : operands.caches) {
+            for (const Leaf& leaf : inner->_leaves)
+                _leaves.push_back({ leaf.tensor, leaf.tensor->version(), false });
+            _inner.push_back(inner);
+        }
+        _full = [exp](TensorImpl& dst) { dst = exp; };
+        if constexpr (Rows<SubType>::local) {
+            _partial = [exp](TensorImpl& dst, index_t begin, index_t end) {
+                auto rows = dst.slice(begin, end, 0);
+                *rows = Rows<SubType>::slice(exp, begin, end, dst.size());
+            };
+        }
+        _result = Alloc::shared_construct<TensorImpl>(exp);
+    }
+
+    class Cached : public Exp<CachedImpl>
+    {
+        using Exp<CachedImpl>::impl_ptr;
+    public:
+        explicit Cached(std::shared_ptr<CachedImpl>&& ptr);
+        Cached(const Cached& other) = default;
+        Cached(Cached&& other) = default;
+        ~Cached() = default;
+
+        const std::shared_ptr<TensorImpl>& value() const;
+        [[nodiscard]] bool stale() const;
+        [[nodiscard]] CachedImpl::Stats stats() const;
+    };
+
+    template<typename SubType>
+    [[nodiscard]] inline Cached cache(const Exp<SubType>& exp) {
+        return Cached(std::make_shared<CachedImpl>(exp.ptr()));
+    }
+
+}
@@ -0,0 +1,452 @@
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace keith {
+
+    namespace {
+
+        using Clock = std::chrono::steady_clock;
+
+        constexpr char tag[8] = { 'K', 'E', 'I', 'T', 'H', 'C', 'K', 'P' };
+        constexpr std::uint32_t format_version = 1;
+        // Offsets, sizes and addresses of O_DIRECT writes are multiples of this.
+        constexpr index_t alignment = 4096;
+        // Elements are framed in chunks of 1 MiB, each stored raw or compressed.
+        constexpr index_t chunk = 1 << 17;
+
+        static_assert(sizeof(data_t) == 8, "checkpoints store data_t as float64");
+
+        index_t round_up(index_t bytes, index_t to) {
+            return (bytes + to - 1) / to * to;
+        }
+
+        // Element i is stored as its bits XOR those of element i - 1. A
+        // control byte holds the number of zero bytes at the top and at the
+        // bottom of that word, and the bytes in between follow it.
+        index_t encode(const data_t* src, index_t n, unsigned char* dst) {
+            unsigned char* p = dst;
+            std::uint64_t prev = 0;
+            for (index_t i = 0; i < n; ++i) {
+                std::uint64_t bits;
+                std::memcpy(&bits, src + i, sizeof(bits));
+                std::uint64_t x = bits ^ prev;
+                prev = bits;
+                int lead = 0, trail = 0;
+                if (x == 0) lead = 8;
+                else {
+                    while (((x >> (56 - 8 * lead)) & 0xff) == 0) ++lead;
+                    while (((x >> (8 * trail)) & 0xff) == 0) ++trail;
+                }
+                *p++ = (unsigned char)(lead << 4 | trail);
+                for (int j = trail; j < 8 - lead; ++j) *p++ = (unsigned char)(x >> (8 * j));
+            }
+            return p - dst;
+        }
+
+        bool decode(const unsigned char* src, index_t bytes, data_t* dst, index_t n) {
+            const unsigned char* p = src;
+            const unsigned char* end = src + bytes;
+            std::uint64_t prev = 0;
+            for (index_t i = 0; i < n; ++i) {
+                if (p == end) return false;
+                int lead = *p >> 4, trail = *p & 0xf;
+                ++p;
+                if (lead + trail > 8 || end - p < 8 - lead - trail) return false;
+                std::uint64_t x = 0;
+                for (int j = trail; j < 8 - lead; ++j) x |= (std::uint64_t)*p++ << (8 * j);
+                prev ^= x;
+                std::memcpy(dst + i, &prev, sizeof(prev));
+            }
+            return p == end;
+        }
+
+        // A file written front to back in large blocks, bypassing the page
+        // cache where the file system supports it. Windows gets buffered
+        // writes.
+        class File {
+        public:
+            File(const std::string& path, bool direct) : _path(path), _direct(false) {
+#ifdef _WIN32
+                _file = std::fopen(path.c_str(), "wb");
+                if (_file == nullptr) THROW_ERROR("cannot open '%.200s' for writing", path.c_str());
+#else
+                int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+                if (direct) {
+                    _fd = open(path.c_str(), flags | O_DIRECT, 0644);
+                    _direct = _fd >= 0;
+                }
+#endif
+                if (_fd < 0) _fd = open(path.c_str(), flags, 0644);
+                if (_fd < 0) THROW_ERROR("cannot open '%.200s' for writing: %s", path.c_str(), std::strerror(errno));
+#endif
+            }
+            File(const File& other) = delete;
+            File& operator=(const File& other) = delete;
+            ~File() {
+#ifdef _WIN32
+                if (_file != nullptr) std::fclose(_file);
+#else
+                if (_fd >= 0) ::close(_fd);
+#endif
+            }
+
+            [[nodiscard]] bool direct() const { return _direct; }
+
+            void write(const char* data, index_t bytes) {
+#ifdef _WIN32
+                if ((index_t)std::fwrite(data, 1, (size_t)bytes, _file) != bytes)
+                    THROW_ERROR("cannot write '%.200s'", _path.c_str());
+#else
+                while (bytes > 0) {
+                    ssize_t n = ::write(_fd, data, (size_t)bytes);
+                    if (n < 0 && errno == EINTR) continue;
+#ifdef O_DIRECT
+                    // Some file systems accept O_DIRECT at open and refuse it here.
+                    if (n < 0 && errno == EINVAL && _direct) {
+                        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT);
+                        _direct = false;
+                        continue;
+                    }
+#endif
+                    if (n < 0) THROW_ERROR("cannot write '%.200s': %s", _path.c_str(), std::strerror(errno));
+                    data += n;
+                    bytes -= n;
+                }
+#endif
+            }
+
+            // Cuts off the padding of the last block and makes the file durable.
+            void close(index_t length) {
+#ifdef _WIN32
+                bool ok = std::fflush(_file) == 0;
+                ok = std::fclose(_file) == 0 && ok;
+                _file = nullptr;
+                if (!ok) THROW_ERROR("cannot write '%.200s'", _path.c_str());
+#else
+                bool ok = ftruncate(_fd, (off_t)length) == 0 && fsync(_fd) == 0;
+                int error = errno;
+                ok = ::close(_fd) == 0 && ok;
+                _fd = -1;
+                if (!ok) THROW_ERROR("cannot write '%.200s': %s", _path.c_str(), std::strerror(error));
+#endif
+            }
+        private:
+            std::string _path;
+            std::atomic<bool> _direct;
+#ifdef _WIN32
+            std::FILE* _file = nullptr;
+#else
+            int _fd = -1;
+#endif
+        };
+
+        struct Block {
+            explicit Block(index_t bytes) : raw(new char[bytes + alignment]),
+                data(raw.get() + (alignment - (index_t)((std::uintptr_t)raw.get() % alignment)) % alignment), used(0) {}
+            std::unique_ptr<char[]> raw;
+            char* data;
+            index_t used;
+        };
+
+        // Bytes put into one block while a thread of its own writes the other.
+        class Stream {
+        public:
+            Stream(File& file, index_t block_bytes) : _file(file), _size(block_bytes),
+                _blocks{ Block(block_bytes), Block(block_bytes) }, _current(0), _pending(-1), _stop(false), _bytes(0),
+                _io([this]() { loop(); }) {}
+            Stream(const Stream& other) = delete;
+            Stream& operator=(const Stream& other) = delete;
+            ~Stream() {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _stop = true;
+                }
+                _cv.notify_all();
+                _io.join();
+            }
+
+            void put(const void* src, index_t bytes) {
+                const char* p = static_cast<const char*>(src);
+                while (bytes > 0) {
+                    Block& block = _blocks[_current];
+                    index_t n = std::min(bytes, _size - block.used);
+                    std::memcpy(block.data + block.used, p, (size_t)n);
+                    block.used += n;
+                    p += n;
+                    bytes -= n;
+                    _bytes += n;
+                    if (block.used == _size) flush();
+                }
+            }
+
+            template<typename T>
+            void put(const T& value) { put(&value, sizeof(T)); }
+
+            // Writes out what is left and returns the length of the stream.
+            index_t finish() {
+                Block& block = _blocks[_current];
+                if (block.used > 0) {
+                    if (_file.direct()) {
+                        index_t padded = round_up(block.used, alignment);
+                        std::memset(block.data + block.used, 0, (size_t)(padded - block.used));
+                        block.used = padded;
+                    }
+                    flush();
+                }
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return _pending < 0; });
+                if (_error) std::rethrow_exception(_error);
+                return _bytes;
+            }
+        private:
+            // Hands the current block over once the other one is written.
+            void flush() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return _pending < 0; });
+                if (_error) std::rethrow_exception(_error);
+                _pending = _current;
+                _current ^= 1;
+                _blocks[_current].used = 0;
+                _cv.notify_all();
+            }
+
+            void loop() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (true) {
+                    _cv.wait(lock, [this]() { return _stop || _pending >= 0; });
+                    if (_pending < 0) return;
+                    Block& block = _blocks[_pending];
+                    lock.unlock();
+                    std::exception_ptr error;
+                    try {
+                        _file.write(block.data, block.used);
+                    }
+                    catch (...) {
+                        error = std::current_exception();
+                    }
+                    lock.lock();
+                    if (error) _error = error;
+                    _pending = -1;
+                    _cv.notify_all();
+                }
+            }
+
+            File& _file;
+            index_t _size;
+            Block _blocks[2];
+            int _current;
+            // The block being written, or -1.
+            int _pending;
+            bool _stop;
+            index_t _bytes;
+            std::exception_ptr _error;
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            std::thread _io;
+        };
+
+        void replace(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+            if (!MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+                THROW_ERROR("cannot move '%.100s' to '%.100s' (error %lu)", from.c_str(), to.c_str(), GetLastError());
+#else
+            if (std::rename(from.c_str(), to.c_str()) != 0)
+                THROW_ERROR("cannot move '%.100s' to '%.100s': %s", from.c_str(), to.c_str(), std::strerror(errno));
+#endif
+        }
+
+        class Reader {
+        public:
+            explicit Reader(const std::string& path) : _path(path), _file(std::fopen(path.c_str(), "rb")) {
+                if (_file == nullptr) THROW_ERROR("cannot open '%.200s' for reading", path.c_str());
+            }
+            Reader(const Reader& other) = delete;
+            Reader& operator=(const Reader& other) = delete;
+            ~Reader() { std::fclose(_file); }
+
+            void get(void* dst, index_t bytes) {
+                if ((index_t)std::fread(dst, 1, (size_t)bytes, _file) != bytes)
+                    THROW_ERROR("checkpoint '%.200s' is truncated", _path.c_str());
+            }
+
+            template<typename T>
+            T get() {
+                T value;
+                get(&value, sizeof(T));
+                return value;
+            }
+
+            [[nodiscard]] const std::string& path() const { return _path; }
+        private:
+            std::string _path;
+            std::FILE* _file;
+        };
+
+    }
+
+    Checkpoint Checkpoint::save(const std::string& path, const std::vector<Entry>& tensors) {
+        return save(path, tensors, Options());
+    }
+
+    Checkpoint Checkpoint::save(const std::string& path, const std::vector<Entry>& tensors, Options options) {
+        CHECK_TRUE(options.block_bytes > 0, "Checkpoint expects a positive block size, but got %lld", options.block_bytes);
+        Clock::time_point start = Clock::now();
+        auto state = std::make_shared<State>();
+        state->path = path;
+        state->options = options;
+        state->options.block_bytes = round_up(options.block_bytes, alignment);
+        index_t raw_bytes = 0;
+        for (const Entry& entry : tensors) {
+            CHECK_NOT_NULL(entry.second, "cannot save tensor '%.100s', which is null", entry.first.c_str());
+            state->names.push_back(entry.first);
+            auto snapshot = entry.second->clone();
+            // A mutable access detaches the snapshot with a parallel copy.
+            if (options.copy) (void)snapshot->data();
+            raw_bytes += snapshot->d_size() * (index_t)sizeof(data_t);
+            state->snapshots.push_back(std::move(snapshot));
+        }
+        state->stats = Stats{ (index_t)tensors.size(), raw_bytes, 0,
+            std::chrono::duration<double, std::micro>(Clock::now() - start).count(), 0, false };
+        State* raw = state.get();
+        state->worker = std::thread([raw]() { write(*raw); });
+        return Checkpoint(std::move(state));
+    }
+
+    void Checkpoint::write(State& state) {
+        Clock::time_point start = Clock::now();
+        std::string tmp = state.path + ".tmp";
+        index_t length = 0;
+        bool direct = false;
+        std::exception_ptr error;
+        try {
+            {
+                File file(tmp, state.options.direct);
+                Stream stream(file, state.options.block_bytes);
+                std::vector<unsigned char> scratch;
+                if (state.options.compress) scratch.resize((size_t)chunk * (sizeof(data_t) + 1));
+                stream.put(tag, sizeof(tag));
+                stream.put(format_version);
+                stream.put((std::uint32_t)state.snapshots.size());
+                for (size_t i = 0; i < state.snapshots.size(); ++i) {
+                    // Non-contiguous snapshots are gathered here, off the caller's thread.
+                    auto tensor = state.snapshots[i]->contiguous();
+                    const std::string& name = state.names[i];
+                    stream.put((std::uint32_t)name.size());
+                    stream.put((std::uint32_t)tensor->n_dim());
+                    stream.put(name.data(), (index_t)name.size());
+                    for (index_t d = 0; d < tensor->n_dim(); ++d) stream.put((std::int64_t)tensor->size(d));
+                    const data_t* data = static_cast<const TensorImpl&>(*tensor).data();
+                    for (index_t begin = 0; begin < tensor->d_size(); begin += chunk) {
+                        index_t n = std::min(chunk, tensor->d_size() - begin);
+                        auto raw = (std::uint32_t)(n * sizeof(data_t));
+                        index_t stored = raw;
+                        if (state.options.compress) stored = encode(data + begin, n, scratch.data());
+                        if (stored < raw) {
+                            stream.put(raw);
+                            stream.put((std::uint32_t)stored);
+                            stream.put(scratch.data(), stored);
+                        }
+                        else {
+                            stream.put(raw);
+                            stream.put(raw);
+                            stream.put(data + begin, raw);
+                        }
+                    }
+                    // Once written, the live tensor no longer has to copy on write.
+                    tensor.reset();
+                    state.snapshots[i].reset();
+                }
+                length = stream.finish();
+                direct = file.direct();
+                file.close(length);
+            }
+            replace(tmp, state.path);
+        }
+        catch (...) {
+            error = std::current_exception();
+            std::remove(tmp.c_str());
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.snapshots.clear();
+        state.error = error;
+        state.stats.file_bytes = length;
+        state.stats.direct = direct;
+        state.stats.write_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        state.done = true;
+        state.cv.notify_all();
+    }
+
+    std::vector<std::pair<std::string, Alloc::NonTrivalUniquePtr<TensorImpl>>> Checkpoint::load(const std::string& path) {
+        Reader reader(path);
+        char magic[sizeof(tag)];
+        reader.get(magic, sizeof(magic));
+        CHECK_TRUE(std::memcmp(magic, tag, sizeof(tag)) == 0, "'%.200s' is not a checkpoint", path.c_str());
+        auto version = reader.get<std::uint32_t>();
+        CHECK_EQUAL(version, format_version, "checkpoint '%.200s' has format %u, but %u is supported", path.c_str(), version, format_version);
+        auto count = reader.get<std::uint32_t>();
+        std::vector<std::pair<std::string, Alloc::NonTrivalUniquePtr<TensorImpl>>> res;
+        std::vector<unsigned char> scratch;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            auto name_size = reader.get<std::uint32_t>();
+            auto n_dim = reader.get<std::uint32_t>();
+            std::string name(name_size, '\0');
+            reader.get(&name[0], name_size);
+            Shape shape((index_t)n_dim);
+            for (index_t d = 0; d < (index_t)n_dim; ++d) {
+                shape[d] = reader.get<std::int64_t>();
+                CHECK_TRUE(shape[d] >= 0, "checkpoint '%.200s' is corrupt", path.c_str());
+            }
+            Storage storage(shape.d_size());
+            data_t* data = storage.data();
+            for (index_t begin = 0; begin < shape.d_size(); begin += chunk) {
+                index_t n = std::min(chunk, shape.d_size() - begin);
+                auto raw = reader.get<std::uint32_t>();
+                auto stored = reader.get<std::uint32_t>();
+                CHECK_TRUE(raw == n * (index_t)sizeof(data_t) && stored <= raw,
+                    "checkpoint '%.200s' is corrupt", path.c_str());
+                if (stored == raw) {
+                    reader.get(data + begin, raw);
+                    continue;
+                }
+                scratch.resize(stored);
+                reader.get(scratch.data(), stored);
+                CHECK_TRUE(decode(scratch.data(), stored, data + begin, n), "checkpoint '%.200s' is corrupt", path.c_str());
+            }
+            res.emplace_back(std::move(name), Alloc::unique_construct<TensorImpl>(storage, shape));
+        }
+        return res;
+    }
+
+    bool Checkpoint::ready() const {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        return _state->done;
+    }
+
+    void Checkpoint::wait() const {
+        std::unique_lock<std::mutex> lock(_state->mutex);
+        _state->cv.wait(lock, [this]() { return _state->done; });
+        if (_state->error) std::rethrow_exception(_state->error);
+    }
+
+    Checkpoint::Stats Checkpoint::stats() const {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        return _state->stats;
+    }
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "../impl/TensorImpl.h"
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace keith {
+
+    // A set of named tensors being written to a file in the background.
+    //
+    // save() snapshots the tensors and returns; a worker thread encodes them
+    // into one of two aligned staging blocks while an I/O thread writes the
+    // other to `path`.tmp in large sequential writes, with O_DIRECT where the
+    // file system allows it. The file is synced and renamed to `path` only
+    // once complete, so a crash never leaves a torn checkpoint behind.
+    //
+    // By default the snapshot is copy-on-write: the caller is held up for
+    // nothing but bookkeeping, and the first write to a tensor while it is
+    // still being saved copies that tensor instead. Options::copy takes a
+    // parallel copy up front instead, which keeps writers free of that cost.
+    // Either way, writes must go through data() after save() returns; a
+    // pointer taken earlier bypasses the snapshot.
+    class Checkpoint
+    {
+    public:
+        struct Options {
+            bool copy = false;
+            // Encodes each element as its XOR with the previous one, dropping
+            // zero bytes at either end. Chunks that would not shrink are stored
+            // raw, so incompressible data grows by a few bytes per MiB.
+            bool compress = false;
+            bool direct = true;
+            // The size of each staging block, rounded up to 4 KiB.
+            index_t block_bytes = 8 << 20;
+        };
+
+        struct Stats {
+            index_t tensors;
+            index_t raw_bytes;
+            index_t file_bytes;
+            // How long save() held up the caller.
+            double snapshot_us;
+            double write_ms;
+            bool direct;
+        };
+
+        using Entry = std::pair<std::string, const TensorImpl*>;
+
+        [[nodiscard]] static Checkpoint save(const std::string& path, const std::vector<Entry>& tensors);
+        [[nodiscard]] static Checkpoint save(const std::string& path, const std::vector<Entry>& tensors, Options options);
+        // Reads a file written by save(), in the order the tensors were given.
+        [[nodiscard]] static std::vector<std::pair<std::string, Alloc::NonTrivalUniquePtr<TensorImpl>>> load(const std::string& path);
+
+        // The last handle to go waits for the write to finish.
+        Checkpoint(const Checkpoint& other) = default;
+        Checkpoint(Checkpoint&& other) = default;
+        ~Checkpoint() = default;
+
+        [[nodiscard]] bool ready() const;
+        // Blocks until the file is in place, and rethrows what made it fail.
+        void wait() const;
+        // Only meaningful once ready.
+        [[nodiscard]] Stats stats() const;
+    private:
+        struct State {
+            ~State() { if (worker.joinable()) worker.join(); }
+
+            std::string path;
+            std::vector<std::string> names;
+            std::vector<Alloc::NonTrivalUniquePtr<TensorImpl>> snapshots;
+            Options options;
+            Stats stats;
+
+            mutable std::mutex mutex;
+            mutable std::condition_variable cv;
+            bool done = false;
+            std::exception_ptr error;
+            std::thread worker;
+        };
+
+        explicit Checkpoint(std::shared_ptr<State> state) : _state(std::move(state)) {}
+        static void write(State& state);
+
+        std::shared_ptr<State> _state;
+    };
+
+}
@@ -0,0 +1,108 @@
+#include "Executor.h"
+
+namespace keith {
+
+    FutureImpl::FutureImpl(const Shape& shape) : _shape(shape), _pending(0), _ready(false) {}
+
+    bool FutureImpl::ready() const {
+        return _ready.load(std::memory_order_acquire);
+    }
+
+    const std::shared_ptr<TensorImpl>& FutureImpl::wait() const {
+        while (!ready()) {
+            if (ThreadPool::self().run_one()) continue;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait_for(lock, std::chrono::milliseconds(1), [this]() { return ready(); });
+        }
+        if (_error) std::rethrow_exception(_error);
+        return _result;
+    }
+
+    std::exception_ptr FutureImpl::error() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _error;
+    }
+
+    void FutureImpl::then(Continuation func) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!ready()) {
+                _continuations.push_back(std::move(func));
+                return;
+            }
+        }
+        func(_result);
+    }
+
+    void FutureImpl::start(std::vector<std::shared_ptr<FutureImpl>>&& deps) {
+        _pending = (index_t)deps.size() + 1;
+        for (auto& dep : deps) {
+            auto self = shared_from_this();
+            FutureImpl* source = dep.get();
+            dep->then([self, source](const std::shared_ptr<TensorImpl>&) { self->dependency_done(source->error()); });
+        }
+        dependency_done(nullptr);
+    }
+
+    void FutureImpl::dependency_done(const std::exception_ptr& error) {
+        if (error) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error) _error = error;
+        }
+        if (--_pending == 0) {
+            auto self = shared_from_this();
+            if (_error) {
+                _task = nullptr;
+                fail(_error);
+            }
+            else ThreadPool::self().submit([self]() { self->run(); });
+        }
+    }
+
+    void FutureImpl::run() {
+        std::shared_ptr<TensorImpl> result;
+        try {
+            result = _task();
+        }
+        catch (...) {
+            _task = nullptr;
+            fail(std::current_exception());
+            return;
+        }
+        _task = nullptr;
+        complete(std::move(result));
+    }
+
+    void FutureImpl::complete(std::shared_ptr<TensorImpl>&& result) {
+        std::vector<Continuation> continuations;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _result = std::move(result);
+            _ready.store(true, std::memory_order_release);
+            continuations.swap(_continuations);
+        }
+        _cv.notify_all();
+        for (auto& func : continuations)
+            func(_result);
+    }
+
+    void FutureImpl::fail(std::exception_ptr error) {
+        std::vector<Continuation> continuations;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _error = std::move(error);
+            _ready.store(true, std::memory_order_release);
+            continuations.swap(_continuations);
+        }
+        _cv.notify_all();
+        for (auto& func : continuations)
+            func(nullptr);
+    }
+
+    Future::Future(std::shared_ptr<FutureImpl>&& ptr) : Exp<FutureImpl>(std::move(ptr)) {}
+
+    bool Future::ready() const { return impl_ptr->ready(); }
+    const std::shared_ptr<TensorImpl>& Future::wait() const { return impl_ptr->wait(); }
+    void Future::then(FutureImpl::Continuation func) const { impl_ptr->then(std::move(func)); }
+
+}
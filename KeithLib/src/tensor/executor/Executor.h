@@ -0,0 +1,129 @@
+#pragma once
+
+#include "../../utils/Shape.h"
+#include "../../utils/ThreadPool.h"
+#include "../Exp.h"
+#include "../impl/TensorImpl.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace keith {
+
+    // A node of the deferred-execution DAG. Its shape is known when the node is
+    // built; the value exists once every FutureImpl leaf of its expression has
+    // finished and a pool worker has materialized it. A node whose expression
+    // throws, or that reads a node that failed, fails with the same error.
+    class FutureImpl : public std::enable_shared_from_this<FutureImpl>
+    {
+    public:
+        using Continuation = std::function<void(const std::shared_ptr<TensorImpl>&)>;
+
+        explicit FutureImpl(const Shape& shape);
+        FutureImpl(const FutureImpl& other) = delete;
+        FutureImpl& operator=(const FutureImpl& other) = delete;
+
+        [[nodiscard]] index_t n_dim() const { return _shape.n_dim(); }
+        [[nodiscard]] index_t size(index_t idx) const { return _shape[idx]; }
+        [[nodiscard]] const Shape& size() const { return _shape; }
+        // Waits for the value first, so reading an unfinished node blocks.
+        [[nodiscard]] data_t eval(IndexArray idx) const { return wait()->eval(std::move(idx)); }
+
+        // True once the node has a value or has failed.
+        [[nodiscard]] bool ready() const;
+        // Rethrows the error of a failed node.
+        const std::shared_ptr<TensorImpl>& wait() const;
+        [[nodiscard]] std::exception_ptr error() const;
+        // Continuations of a failed node get a null result.
+        void then(Continuation func);
+
+        template<typename SubType>
+        static std::shared_ptr<FutureImpl> schedule(const std::shared_ptr<SubType>& exp);
+    private:
+        friend class MatmulBatcher;
+
+        void start(std::vector<std::shared_ptr<FutureImpl>>&& deps);
+        void dependency_done(const std::exception_ptr& error);
+        void run();
+        void complete(std::shared_ptr<TensorImpl>&& result);
+        void fail(std::exception_ptr error);
+
+        Shape _shape;
+        std::function<std::shared_ptr<TensorImpl>()> _task;
+        std::atomic<index_t> _pending;
+        mutable std::mutex _mutex;
+        mutable std::condition_variable _cv;
+        std::atomic<bool> _ready;
+        std::shared_ptr<TensorImpl> _result;
+        std::exception_ptr _error;
+        std::vector<Continuation> _continuations;
+    };
+
+    template<typename ExpType>
+    struct Dependencies {
+        static void collect(const std::shared_ptr<ExpType>& ptr, std::vector<std::shared_ptr<FutureImpl>>& deps) {}
+    };
+
+    template<>
+    struct Dependencies<FutureImpl> {
+        static void collect(const std::shared_ptr<FutureImpl>& ptr, std::vector<std::shared_ptr<FutureImpl>>& deps) {
+            deps.push_back(ptr);
+        }
+    };
+
+    template<>
+    struct Dependencies<Scalar> {
+        static void collect(const Scalar& value, std::vector<std::shared_ptr<FutureImpl>>& deps) {}
+    };
+
+    template<typename Op, typename LhsType, typename RhsType>
+    struct Dependencies<BinaryExp<Op, LhsType, RhsType>> {
+        static void collect(const std::shared_ptr<BinaryExp<Op, LhsType, RhsType>>& ptr, std::vector<std::shared_ptr<FutureImpl>>& deps) {
+            Dependencies<LhsType>::collect(ptr->lhs(), deps);
+            Dependencies<RhsType>::collect(ptr->rhs(), deps);
+        }
+    };
+
+    template<typename Op, typename LhsType>
+    struct Dependencies<UnaryExp<Op, LhsType>> {
+        static void collect(const std::shared_ptr<UnaryExp<Op, LhsType>>& ptr, std::vector<std::shared_ptr<FutureImpl>>& deps) {
+            Dependencies<LhsType>::collect(ptr->lhs(), deps);
+        }
+    };
+
+    template<typename SubType>
+    std::shared_ptr<FutureImpl> FutureImpl::schedule(const std::shared_ptr<SubType>& exp) {
+        auto node = std::make_shared<FutureImpl>(exp->size());
+        node->_task = [exp]() {
+            return Alloc::shared_construct<TensorImpl>(exp);
+        };
+        std::vector<std::shared_ptr<FutureImpl>> deps;
+        Dependencies<SubType>::collect(exp, deps);
+        node->start(std::move(deps));
+        return node;
+    }
+
+    class Future : public Exp<FutureImpl>
+    {
+        using Exp<FutureImpl>::impl_ptr;
+    public:
+        explicit Future(std::shared_ptr<FutureImpl>&& ptr);
+        Future(const Future& other) = default;
+        Future(Future&& other) = default;
+        ~Future() = default;
+
+        [[nodiscard]] bool ready() const;
+        const std::shared_ptr<TensorImpl>& wait() const;
+        void then(FutureImpl::Continuation func) const;
+    };
+
+    template<typename SubType>
+    [[nodiscard]] inline Future async(const Exp<SubType>& exp) {
+        return Future(FutureImpl::schedule(exp.ptr()));
+    }
+
+}
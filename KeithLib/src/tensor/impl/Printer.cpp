@@ -0,0 +1,143 @@
+#include "Printer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <mutex>
+
+namespace keith {
+
+    namespace {
+
+        std::mutex options_mutex;
+        PrintOptions current_options;
+
+        // Fixed notation with 4 digits of precision needs up to 309 integral
+        // digits for the largest doubles.
+        constexpr index_t max_chars = 352;
+
+        struct Context {
+            const data_t* data;
+            const index_t* shape;
+            const index_t* stride;
+            index_t n_dim;
+            index_t edge;
+            bool summarize;
+            int precision;
+            index_t width;
+            index_t line_width;
+            std::string* buf;
+        };
+
+        index_t format(const Context& ctx, data_t value, char* out) {
+            auto res = std::to_chars(out, out + max_chars, value, std::chars_format::fixed, ctx.precision);
+            return (index_t)(res.ptr - out);
+        }
+
+        bool skipped(const Context& ctx, index_t dim) {
+            return ctx.summarize && ctx.shape[dim] > 2 * ctx.edge;
+        }
+
+        // Visits the shown indices of one dimension; the gap of a summarized
+        // dimension is reported once as index `shape`.
+        template<typename Func>
+        void for_shown(const Context& ctx, index_t dim, Func func) {
+            index_t n = ctx.shape[dim];
+            if (!skipped(ctx, dim)) {
+                for (index_t i = 0; i < n; ++i) func(i);
+                return;
+            }
+            for (index_t i = 0; i < ctx.edge; ++i) func(i);
+            func(n);
+            for (index_t i = n - ctx.edge; i < n; ++i) func(i);
+        }
+
+        void measure(const Context& ctx, index_t dim, const data_t* data, index_t& width) {
+            char tmp[max_chars];
+            for_shown(ctx, dim, [&](index_t i) {
+                if (i == ctx.shape[dim]) return;
+                const data_t* ptr = data + i * ctx.stride[dim];
+                if (dim + 1 == ctx.n_dim) width = std::max(width, format(ctx, *ptr, tmp));
+                else measure(ctx, dim + 1, ptr, width);
+            });
+        }
+
+        void write_dim(const Context& ctx, index_t dim, const data_t* data) {
+            std::string& buf = *ctx.buf;
+            buf += '[';
+            bool first = true;
+            if (dim + 1 == ctx.n_dim) {
+                char tmp[max_chars];
+                index_t line = (index_t)(buf.size() - std::min(buf.size(), buf.rfind('\n') + 1));
+                for_shown(ctx, dim, [&](index_t i) {
+                    index_t len = 3;
+                    const char* text = "...";
+                    if (i != ctx.shape[dim]) {
+                        len = format(ctx, data[i * ctx.stride[dim]], tmp);
+                        text = tmp;
+                    }
+                    index_t pad = ctx.width > len && text == tmp ? ctx.width - len : 0;
+                    if (!first) {
+                        buf += ',';
+                        if (line + 2 + pad + len + 1 > ctx.line_width) {
+                            buf += '\n';
+                            buf.append(dim + 1, ' ');
+                            line = dim + 1;
+                        }
+                        else {
+                            buf += ' ';
+                            line += 2;
+                        }
+                    }
+                    buf.append(pad, ' ');
+                    buf.append(text, len);
+                    line += pad + len;
+                    first = false;
+                });
+            }
+            else {
+                for_shown(ctx, dim, [&](index_t i) {
+                    if (!first) {
+                        buf += '\n';
+                        buf.append(dim + 1, ' ');
+                    }
+                    first = false;
+                    if (i == ctx.shape[dim]) buf += "...";
+                    else write_dim(ctx, dim + 1, data + i * ctx.stride[dim]);
+                });
+            }
+            buf += ']';
+        }
+
+    }
+
+    void set_printoptions(const PrintOptions& options) {
+        std::lock_guard<std::mutex> lock(options_mutex);
+        current_options = options;
+    }
+
+    PrintOptions printoptions() {
+        std::lock_guard<std::mutex> lock(options_mutex);
+        return current_options;
+    }
+
+    namespace printer {
+
+        void write(std::string& buf, const data_t* data, const index_t* shape, const index_t* stride,
+            index_t n_dim, const PrintOptions& options) {
+            index_t total = 1;
+            for (index_t i = 0; i < n_dim; ++i) total *= shape[i];
+            if (n_dim == 0 || total == 0) {
+                buf += "[]\n";
+                return;
+            }
+            Context ctx{ data, shape, stride, n_dim, std::max<index_t>(options.edge_items, 1),
+                total > options.threshold, (int)options.precision, 0, options.line_width, &buf };
+            measure(ctx, 0, data, ctx.width);
+            ctx.width += 1;
+            write_dim(ctx, 0, data);
+            buf += '\n';
+        }
+
+    }
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+#include <string>
+
+namespace keith {
+
+    // Formatting controls for printed tensors, modelled on numpy's
+    // printoptions. Tensors with more than `threshold` elements are
+    // summarized: every dimension longer than 2 * edge_items shows only its
+    // first and last edge_items entries around a "...".
+    struct PrintOptions {
+        index_t precision = 4;
+        index_t threshold = 1000;
+        index_t edge_items = 3;
+        index_t line_width = 80;
+    };
+
+    void set_printoptions(const PrintOptions& options);
+    [[nodiscard]] PrintOptions printoptions();
+
+    namespace printer {
+
+        // Appends the text form of a strided view to buf. Numbers are
+        // formatted with std::to_chars, and the column width is taken over
+        // the elements that are actually shown.
+        void write(std::string& buf, const data_t* data, const index_t* shape, const index_t* stride,
+            index_t n_dim, const PrintOptions& options);
+
+    }
+
+}
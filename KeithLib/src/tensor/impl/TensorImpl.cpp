@@ -1,15 +1,39 @@
 #include "TensorImpl.h"
+#include "../operations/SmallMatrix.h"
+#include "../operations/Copy.h"
+#include "../operations/Normalization.h"
+#include "../operations/Indexing.h"
+#include "../operations/Sorting.h"
+#include "../operations/Scan.h"
+#include "../operations/Einsum.h"
+#include "../operations/Linalg.h"
+#include "../operations/Layout.h"
+#include "../../utils/ThreadPool.h"
+#include "Printer.h"
 
+#include <algorithm>
 #include <memory>
 #include <cmath>
 #include <iomanip>
 #include <random>
 #include <ctime>
+#include <vector>
 
 namespace keith {
 
     TensorImpl::TensorImpl(const Storage& storage, const Shape& shape, const Array<index_t>& stride) :
         _storage(storage), _shape(shape), _stride(stride) {}
+    TensorImpl::TensorImpl(const std::shared_ptr<TensorImpl>& impl) :
+        _storage(impl->is_contiguous(impl->memory_format()) ? impl->_storage.lazy_copy() : Storage(impl->d_size())),
+        _shape(impl->_shape), _stride(impl->_stride), _format(impl->_format), _channels(impl->_channels) {
+        if (impl->is_contiguous(impl->memory_format())) return;
+        for (int i = 0; i < n_dim(); ++i) {
+            if (i == n_dim() - 1) _stride[i] = 1;
+            else _stride[i] = _shape.sub_size(i + 1);
+            if (_shape[i] == 1) _stride[i] = 0;
+        }
+        copy_(*impl);
+    }
     TensorImpl::TensorImpl(const Storage& storage, const Shape& shape) :
         _storage(storage), _shape(shape), _stride(shape.n_dim()) {
         for (int i = 0; i < shape.n_dim(); ++i) {
@@ -20,18 +44,22 @@ namespace keith {
     }
     TensorImpl::TensorImpl(const Shape& shape) :
         _storage(shape.d_size()), _shape(shape), _stride(shape.n_dim()) {
-        for (int i = 0; i < shape.d_size(); ++i)
-            _storage[i] = 0;
+        std::fill_n(_storage.data(), shape.d_size(), 0);
         for (int i = 0; i < shape.n_dim(); ++i) {
             if (i == shape.n_dim() - 1) _stride[i] = 1;
             else _stride[i] = shape.sub_size(i + 1);
             if (shape[i] == 1) _stride[i] = 0;
         }
     }
+    TensorImpl::TensorImpl(const Shape& shape, const TensorImpl* like) : TensorImpl(shape) {
+        if (like == nullptr || !(like->_shape == shape) || !like->is_dense()) return;
+        for (index_t i = 0; i < n_dim(); ++i) _stride[i] = like->_stride[i];
+        _format = like->_format;
+        _channels = like->_channels;
+    }
     TensorImpl::TensorImpl(const data_t* data, const Shape& shape) :
         _storage(shape.d_size()), _shape(shape), _stride(shape.n_dim()) {
-        for (int i = 0; i < shape.d_size(); ++i)
-            _storage[i] = data[i];
+        std::copy_n(data, shape.d_size(), _storage.data());
         for (int i = 0; i < shape.n_dim(); ++i) {
             if (i == shape.n_dim() - 1) _stride[i] = 1;
             else _stride[i] = shape.sub_size(i + 1);
@@ -53,13 +81,77 @@ namespace keith {
         return true;
     }
 
-    data_t& TensorImpl::operator[](std::initializer_list<index_t> dims) {
-        CHECK_EQUAL(n_dim(), dims.size(),
-            "Invalid %zuD indices for %dD tensor", dims.size(), n_dim());
+    data_t* TensorImpl::data(index_t begin, index_t end) {
+        CHECK_TRUE(0 <= begin && begin <= end && end <= _shape[0],
+            "Rows [%lld, %lld) out of range for dimension 0 with size %lld", begin, end, _shape[0]);
+        if (!is_contiguous()) return data();
+        index_t row = _shape.sub_size(1);
+        return _storage.data(begin * row, end * row);
+    }
+
+    bool TensorImpl::written_since(index_t version, index_t& begin, index_t& end) const {
+        index_t lo, hi, row = _shape.sub_size(1);
+        if (!is_contiguous() || row == 0 || !_storage.written_since(version, lo, hi)) return false;
+        begin = std::clamp<index_t>(lo / row, 0, _shape[0]);
+        end = std::clamp<index_t>((hi + row - 1) / row, 0, _shape[0]);
+        if (begin >= end) begin = end = 0;
+        return true;
+    }
+
+    bool TensorImpl::is_contiguous(MemoryFormat format) const {
+        if (format == MemoryFormat::RowMajor) return is_contiguous();
+        if (format == MemoryFormat::Blocked) return _format == MemoryFormat::Blocked && is_contiguous();
+        if (n_dim() != 4) return false;
+        index_t c = _shape[1], w = _shape[3];
+        index_t expect[] = { _shape[2] * w * c, 1, w * c, c };
+        for (index_t i = 0; i < 4; ++i)
+            if (_shape[i] != 1 && _stride[i] != expect[i]) return false;
+        return true;
+    }
+
+    bool TensorImpl::is_dense() const {
+        std::vector<index_t> shape(n_dim());
+        for (index_t i = 0; i < n_dim(); ++i) shape[i] = _shape[i];
+        return strided::dense(_stride.data(), shape.data(), n_dim());
+    }
+
+    MemoryFormat TensorImpl::memory_format() const {
+        if (_format == MemoryFormat::Blocked) return _format;
+        if (n_dim() == 4 && !is_contiguous() && is_contiguous(MemoryFormat::ChannelsLast))
+            return MemoryFormat::ChannelsLast;
+        return MemoryFormat::RowMajor;
+    }
+
+    TensorImpl& TensorImpl::requires_grad_(bool requires_grad) {
+        _requires_grad = requires_grad;
+        if (!requires_grad) _grad.reset();
+        return *this;
+    }
+
+    void TensorImpl::accumulate_grad(const data_t* grad) {
+        if (!_grad) {
+            _grad = Alloc::shared_construct<TensorImpl>(_shape);
+        }
+        index_t n = d_size();
+        data_t* dst = _grad->data();
+        for (index_t i = 0; i < n; ++i)
+            dst[i] += grad[i];
+    }
+
+    void TensorImpl::zero_grad() {
+        if (!_grad) return;
+        index_t n = d_size();
+        data_t* dst = _grad->data();
+        std::fill_n(dst, n, 0);
+    }
+
+    Storage::Element TensorImpl::operator[](std::initializer_list<index_t> dims) {
+        CHECK_EQUAL(n_dim(), (index_t)dims.size(),
+            "Invalid %zuD indices for %lldD tensor", dims.size(), n_dim());
         index_t index = 0, dim = 0;
         for (auto v : dims) {
             CHECK_IN_RANGE(v, 0, size(dim),
-                "Index out of range (expected to be in range of [0, %d), but got %d)",
+                "Index out of range (expected to be in range of [0, %lld), but got %lld)",
                 size(dim), v);
             index += v * _stride[dim];
             ++dim;
@@ -67,18 +159,16 @@ namespace keith {
         return _storage[index];
     }
     data_t TensorImpl::operator[](std::initializer_list<index_t> dims) const {
-        CHECK_EQUAL(n_dim(), dims.size(),
-            "Invalid %zuD indices for %dD tensor", dims.size(), n_dim());
+        CHECK_EQUAL(n_dim(), (index_t)dims.size(),
+            "Invalid %zuD indices for %lldD tensor", dims.size(), n_dim());
         index_t index = 0, dim = 0;
         for (auto v : dims) {
-            std::cout << v << " ";
             CHECK_IN_RANGE(v, 0, size(dim),
-                "Index out of range (expected to be in range of [0, %d), but got %d)",
+                "Index out of range (expected to be in range of [0, %lld), but got %lld)",
                 size(dim), v);
             index += v * _stride[dim];
             ++dim;
         }
-        std::cout << std::endl;
         return _storage[index];
     }
 
@@ -92,12 +182,12 @@ namespace keith {
         return _storage[idx];
     }
 
-    data_t& TensorImpl::item(index_t idx)
+    Storage::Element TensorImpl::item(index_t idx)
     {
         return _storage[idx];
     }
     data_t TensorImpl::eval(Array<index_t> idx) const {
-        int index = 0;
+        index_t index = 0;
         if (idx.size() >= _shape.n_dim()) {
             for (int i = idx.size() - n_dim(); i < idx.size(); ++i)
                 index += idx[i] * _stride[i - (idx.size() - n_dim())];
@@ -113,14 +203,14 @@ namespace keith {
     Alloc::NonTrivalUniquePtr<TensorImpl>
         TensorImpl::slice(index_t idx, index_t dim) const {
         CHECK_IN_RANGE(dim, 0, n_dim(),
-            "Dimension out of range (expected to be in range of [0, %d), but got %d)",
+            "Dimension out of range (expected to be in range of [0, %lld), but got %lld)",
             n_dim(), dim);
         CHECK_IN_RANGE(idx, 0, size(dim),
-            "Index %d is out of bound for dimension %d with size %d",
+            "Index %lld is out of bound for dimension %lld with size %lld",
             idx, dim, size(dim));
         Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
         ptr = Alloc::unique_construct<TensorImpl>(
-            Storage(_storage, offset() + _stride[dim] * idx),
+            Storage(_storage, _stride[dim] * idx),
             _shape, _stride);
         ptr->_shape[dim] = 1;
         ptr->_stride[dim] = 0;
@@ -130,19 +220,19 @@ namespace keith {
     Alloc::NonTrivalUniquePtr<TensorImpl>
         TensorImpl::slice(index_t start_idx, index_t end_idx, index_t dim) const {
         CHECK_IN_RANGE(dim, 0, n_dim(),
-            "Dimension out of range (expected to be in range of [0, %d), but got %d)",
+            "Dimension out of range (expected to be in range of [0, %lld), but got %lld)",
             n_dim(), dim);
         CHECK_IN_RANGE(start_idx, 0, size(dim),
-            "Index %d is out of bound for dimension %d with size %d",
+            "Index %lld is out of bound for dimension %lld with size %lld",
             start_idx, dim, size(dim));
         CHECK_IN_RANGE(end_idx, 0, size(dim) + 1,
-            "Range end %d is out of bound for dimension %d with size %d",
+            "Range end %lld is out of bound for dimension %lld with size %lld",
             end_idx, dim, size(dim));
         CHECK_TRUE(start_idx < end_idx,
             "slice() expects the start index must be smaller than the end index");
         Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
         ptr = Alloc::unique_construct<TensorImpl>(
-            Storage(_storage, offset() + start_idx * _stride[dim]),
+            Storage(_storage, start_idx * _stride[dim]),
             _shape, _stride);
         ptr->_shape[dim] = end_idx - start_idx;
         return ptr;
@@ -151,10 +241,10 @@ namespace keith {
     Alloc::NonTrivalUniquePtr<TensorImpl>
         TensorImpl::transpose(index_t dim1, index_t dim2) const {
         CHECK_IN_RANGE(dim1, 0, n_dim(),
-            "Dimension out of range (expected to be in range of [0, %d), but got %d)",
+            "Dimension out of range (expected to be in range of [0, %lld), but got %lld)",
             n_dim(), dim1);
         CHECK_IN_RANGE(dim2, 0, n_dim(),
-            "Dimension out of range (expected to be in range of [0, %d), but got %d)",
+            "Dimension out of range (expected to be in range of [0, %lld), but got %lld)",
             n_dim(), dim2);
         Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
         ptr = Alloc::unique_construct<TensorImpl>(_storage, _shape, _stride);
@@ -163,13 +253,26 @@ namespace keith {
         return ptr;
     }
 
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::flip(index_t dim) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %lld)",
+            n_dim(), dim);
+        Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
+        ptr = Alloc::unique_construct<TensorImpl>(
+            Storage(_storage, (size(dim) - 1) * _stride[dim]),
+            _shape, _stride);
+        ptr->_stride[dim] = -_stride[dim];
+        return ptr;
+    }
+
     Alloc::NonTrivalUniquePtr<TensorImpl>
         TensorImpl::view(const Shape& shape) const {
-        CHECK_TRUE(!is_contiguous(),
+        CHECK_TRUE(is_contiguous(),
             "view() is only supported to contiguous tensor");
-        CHECK_EQUAL(shape.d_size(), shape.d_size(),
-            "Shape of size %d is invalid for input tensor with size %d",
-            shape.d_size(), shape.d_size());
+        CHECK_EQUAL(shape.d_size(), d_size(),
+            "Shape of size %lld is invalid for input tensor with size %lld",
+            shape.d_size(), d_size());
         Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
         ptr = Alloc::unique_construct<TensorImpl>(_storage, shape);
         for (int i = 0; i < shape.n_dim(); ++i) {
@@ -182,8 +285,8 @@ namespace keith {
 
     Alloc::NonTrivalUniquePtr<TensorImpl>
         TensorImpl::permute(std::initializer_list<index_t> dims) const {
-        CHECK_EQUAL(dims.size(), n_dim(),
-            "Dimension not match (expected dims of %d, but got %zu)",
+        CHECK_EQUAL((index_t)dims.size(), n_dim(),
+            "Dimension not match (expected dims of %lld, but got %zu)",
             n_dim(), dims.size());
         Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
         ptr = Alloc::unique_construct<TensorImpl>(_storage, _shape);
@@ -199,18 +302,20 @@ namespace keith {
     Alloc::NonTrivalUniquePtr<TensorImpl>
         TensorImpl::sum(int idx) const {
         CHECK_IN_RANGE(idx, 0, n_dim(),
-            "Dimension out of range (expected to be in range of [0, %d), but got %d)",
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
             n_dim(), idx);
         Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
         ptr = Alloc::unique_construct<TensorImpl>(Shape(_shape, idx));
         std::vector<index_t> idxs(_shape.n_dim(), 0);
         std::vector<index_t> new_idxs(_shape.n_dim() - 1, 0);
+        bool masked = padded();
+        data_t* out = ptr->data();
         index_t cnt = 0;
         while (cnt < d_size()) {
             data_t res = 0;
-            for (int i = 0; i < _shape[idx]; ++i) {
+            for (index_t i = 0; i < _shape[idx]; ++i) {
                 idxs[idx] = i;
-                res += eval(idxs);
+                if (!masked || !padding(idxs)) res += eval(idxs);
             }
             new_idxs.clear();
             for (int i = 0; i < n_dim(); ++i) {
@@ -218,10 +323,10 @@ namespace keith {
                 new_idxs.push_back(idxs[i]);
             }
             index_t index = 0;
-            for (index_t i = 0; i < new_idxs.size(); ++i) {
+            for (index_t i = 0; i < (index_t)new_idxs.size(); ++i) {
                 index += new_idxs[i] * ptr->_stride[i];
             }
-            ptr->item(index) = res;
+            out[index] = res;
             for (int i = 0; i < n_dim(); ++i) {
                 if (i == idx) continue;
                 if (idxs[i] + 1 >= _shape[i]) idxs[i] = 0;
@@ -237,55 +342,683 @@ namespace keith {
 
 
 
-    std::ostream& operator<<(std::ostream& out, const TensorImpl& tensor) {
-        int max_width = 0;
-        for (int i = 0; i < tensor.d_size(); ++i) {
-            int value = (int)std::abs(tensor.item(i));
-            int dig = value = (int)(std::log10(value)) + 1;
-            if (tensor.item(i) < 0) ++dig;
-            max_width = std::max(max_width, dig);
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::contiguous() const {
+        if (is_contiguous())
+            return Alloc::unique_construct<TensorImpl>(_storage, _shape, _stride);
+        auto ptr = empty(_shape);
+        ptr->copy_(*this);
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::empty(const Shape& shape) {
+        Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
+        ptr = Alloc::unique_construct<TensorImpl>(Storage(shape.d_size()), Shape(shape), Array<index_t>(shape.n_dim()));
+        for (int i = 0; i < shape.n_dim(); ++i) {
+            if (i == shape.n_dim() - 1) ptr->_stride[i] = 1;
+            else ptr->_stride[i] = shape.sub_size(i + 1);
+            if (shape[i] == 1) ptr->_stride[i] = 0;
         }
-        int cnt = 0, idx = 0, end_flag = tensor.n_dim();
-        std::vector<int> dim_cnt(tensor.n_dim());
-        while (cnt < tensor.d_size()) {
-            for (int i = 0; i < tensor.n_dim() - end_flag; ++i)
-                out << " ";
-            for (int i = 0; i < end_flag; ++i)
-                out << "[";
-            out << std::setw(max_width + 4 + 1) << std::right << std::setprecision(4) << std::fixed;
-            out << tensor.item(idx);
-            end_flag = 0;
-            for (int i = (int)tensor.n_dim() - 1; i >= 0; --i) {
-                if (dim_cnt[i] + 1 < tensor.size()[i]) {
-                    idx += tensor.stride()[i];
-                    ++dim_cnt[i];
-                    break;
-                }
-                else {
-                    idx -= ((int)tensor.size()[i] - 1) * tensor.stride()[i];
-                    dim_cnt[i] = 0;
-                    ++end_flag;
-                }
-            }
-            if (end_flag == 0) out << ", ";
-            else {
-                for (int i = 0; i < end_flag; ++i) {
-                    out << "]";
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::empty(const Shape& shape, MemoryFormat format, index_t block) {
+        if (format == MemoryFormat::RowMajor) return empty(shape);
+        index_t n = shape[0], c = shape[1], h = shape[2], w = shape[3];
+        if (format == MemoryFormat::Blocked) {
+            auto ptr = empty(Shape({ n, (c + block - 1) / block, h, w, block }));
+            ptr->_format = MemoryFormat::Blocked;
+            ptr->_channels = c;
+            return ptr;
+        }
+        Array<index_t> stride(4);
+        index_t value[] = { h * w * c, 1, w * c, c };
+        for (index_t i = 0; i < 4; ++i) stride[i] = shape[i] == 1 ? 0 : value[i];
+        return Alloc::unique_construct<TensorImpl>(Storage(shape.d_size()), Shape(shape), std::move(stride));
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::clone() const {
+        auto ptr = Alloc::unique_construct<TensorImpl>(_storage.lazy_copy(), _shape, _stride);
+        ptr->_format = _format;
+        ptr->_channels = _channels;
+        return ptr;
+    }
+
+    std::shared_ptr<SharedMemory> TensorImpl::share(const std::string& name) const {
+        auto segment = SharedMemory::create(name, _shape);
+        TensorImpl shared(segment->storage(), _shape);
+        shared.copy_(*this);
+        segment->publish();
+        return segment;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::attach(const std::string& name, SharedMemory::Access access) {
+        auto segment = SharedMemory::attach(name, access);
+        return Alloc::unique_construct<TensorImpl>(segment->storage(), segment->shape());
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::to(MemoryFormat format, index_t block) const {
+        CHECK_TRUE(block > 0, "to() expects a positive block size, but got %lld", block);
+        if (_format == MemoryFormat::Blocked) {
+            if (format == MemoryFormat::Blocked && block == _shape[4]) return clone();
+            auto plain = empty(Shape({ _shape[0], _channels, _shape[2], _shape[3] }));
+            layout::from_blocked(data(), plain->data(), plain->_stride.data(),
+                _shape[0], _channels, _shape[2], _shape[3], _shape[4]);
+            if (format == MemoryFormat::RowMajor) return plain;
+            return plain->to(format, block);
+        }
+        if (format == MemoryFormat::RowMajor) return contiguous();
+        CHECK_EQUAL(n_dim(), 4, "to() expects a 4D (N, C, H, W) tensor, but got %lldD", n_dim());
+        if (is_contiguous(format)) return Alloc::unique_construct<TensorImpl>(_storage, _shape, _stride);
+        auto ptr = empty(_shape, format, block);
+        if (format == MemoryFormat::Blocked)
+            layout::to_blocked(data(), _stride.data(), ptr->data(), _shape[0], _shape[1], _shape[2], _shape[3], block);
+        else
+            ptr->copy_(*this);
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::channels_input(const char* op) const {
+        if (_format == MemoryFormat::Blocked) return Alloc::unique_construct<TensorImpl>(*this);
+        CHECK_EQUAL(n_dim(), 4, "%s() expects a 4D (N, C, H, W) tensor, but got %lldD", op, n_dim());
+        if (is_contiguous(MemoryFormat::ChannelsLast)) return Alloc::unique_construct<TensorImpl>(*this);
+        return contiguous();
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::channel_sum() const {
+        auto x = channels_input("channel_sum");
+        MemoryFormat format = x->memory_format();
+        index_t c = format == MemoryFormat::Blocked ? _channels : _shape[1];
+        index_t block = format == MemoryFormat::Blocked ? _shape[4] : layout::block;
+        auto ptr = empty(Shape({ c }));
+        layout::channel_sum(static_cast<const TensorImpl&>(*x).data(), ptr->data(), format,
+            _shape[0], c, _shape[2] * _shape[3], block);
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::channel_affine(const TensorImpl& scale, const TensorImpl& shift) const {
+        auto x = channels_input("channel_affine");
+        MemoryFormat format = x->memory_format();
+        index_t c = format == MemoryFormat::Blocked ? _channels : _shape[1];
+        index_t block = format == MemoryFormat::Blocked ? _shape[4] : layout::block;
+        CHECK_TRUE(scale.d_size() == c && shift.d_size() == c,
+            "channel_affine() expects %lld scale and shift values, but got %lld and %lld",
+            c, scale.d_size(), shift.d_size());
+        auto s = scale.contiguous(), o = shift.contiguous();
+        auto ptr = empty(Shape({ _shape[0], c, _shape[2], _shape[3] }), format, block);
+        layout::channel_affine(static_cast<const TensorImpl&>(*x).data(), ptr->data(),
+            static_cast<const TensorImpl&>(*s).data(), static_cast<const TensorImpl&>(*o).data(),
+            format, _shape[0], c, _shape[2] * _shape[3], block);
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::conv1x1(const TensorImpl& weight) const {
+        auto x = channels_input("conv1x1");
+        MemoryFormat format = x->memory_format();
+        index_t c = format == MemoryFormat::Blocked ? _channels : _shape[1];
+        index_t block = format == MemoryFormat::Blocked ? _shape[4] : layout::block;
+        CHECK_EQUAL(weight.n_dim(), 2, "conv1x1() expects a 2D (K, C) weight, but got %lldD", weight.n_dim());
+        CHECK_EQUAL(weight.size(1), c, "conv1x1() expects a weight with %lld input channels, but got %lld",
+            c, weight.size(1));
+        index_t k = weight.size(0);
+        auto w = weight.contiguous();
+        auto ptr = empty(Shape({ _shape[0], k, _shape[2], _shape[3] }), format, block);
+        layout::conv1x1(static_cast<const TensorImpl&>(*x).data(), static_cast<const TensorImpl&>(*w).data(), ptr->data(),
+            format, _shape[0], c, k, _shape[2] * _shape[3], block);
+        return ptr;
+    }
+
+    TensorImpl& TensorImpl::copy_(const TensorImpl& src) {
+        CHECK_TRUE(_shape == src._shape,
+            "copy_() expects the source to have the same shape as the destination");
+        std::vector<index_t> shape(n_dim());
+        for (index_t i = 0; i < n_dim(); ++i) shape[i] = _shape[i];
+        strided::copy(data(), _stride.data(), src.data(), src._stride.data(), shape.data(), n_dim());
+        return *this;
+    }
+
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<TensorImpl>& src) {
+        if (!(dst.size() == src->size())) return false;
+        dst.copy_(*src);
+        return true;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::normalize(int kind, int dim, const TensorImpl* weight, const TensorImpl* bias, data_t eps) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        index_t n = _shape[dim];
+        Alloc::NonTrivalUniquePtr<TensorImpl> w, b;
+        if (weight != nullptr) {
+            CHECK_TRUE(weight->n_dim() == 1 && weight->size(0) == n,
+                "Expect a weight of shape (%lld)", n);
+            w = weight->contiguous();
+        }
+        if (bias != nullptr) {
+            CHECK_TRUE(bias->n_dim() == 1 && bias->size(0) == n,
+                "Expect a bias of shape (%lld)", n);
+            b = bias->contiguous();
+        }
+        auto src = contiguous();
+        auto ptr = empty(_shape);
+        const data_t* in = static_cast<const TensorImpl&>(*src).data();
+        const data_t* wd = w ? static_cast<const TensorImpl&>(*w).data() : nullptr;
+        const data_t* bd = b ? static_cast<const TensorImpl&>(*b).data() : nullptr;
+        norm::run(static_cast<norm::Kind>(kind), in, ptr->data(),
+            _shape.sub_size(0, dim), n, _shape.sub_size(dim + 1), wd, bd, eps);
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::softmax(int dim) const {
+        return normalize((int)norm::Kind::Softmax, dim, nullptr, nullptr, 0);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::log_softmax(int dim) const {
+        return normalize((int)norm::Kind::LogSoftmax, dim, nullptr, nullptr, 0);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::layer_norm(int dim, data_t eps) const {
+        return normalize((int)norm::Kind::LayerNorm, dim, nullptr, nullptr, eps);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::layer_norm(int dim, const TensorImpl& weight, const TensorImpl& bias, data_t eps) const {
+        return normalize((int)norm::Kind::LayerNorm, dim, &weight, &bias, eps);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::rms_norm(int dim, data_t eps) const {
+        return normalize((int)norm::Kind::RmsNorm, dim, nullptr, nullptr, eps);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::rms_norm(int dim, const TensorImpl& weight, data_t eps) const {
+        return normalize((int)norm::Kind::RmsNorm, dim, &weight, nullptr, eps);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::cat(const std::vector<const TensorImpl*>& tensors, int dim) {
+        CHECK_TRUE(!tensors.empty(), "cat() expects a non-empty list of tensors");
+        const TensorImpl& first = *tensors[0];
+        CHECK_IN_RANGE(dim, 0, first.n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            first.n_dim(), dim);
+        Shape shape(first._shape);
+        shape[dim] = 0;
+        std::vector<Alloc::NonTrivalUniquePtr<TensorImpl>> srcs;
+        std::vector<const data_t*> data;
+        std::vector<index_t> widths;
+        index_t inner = first._shape.sub_size(dim + 1);
+        for (const TensorImpl* t : tensors) {
+            CHECK_EQUAL(t->n_dim(), first.n_dim(),
+                "cat() expects tensors with the same number of dimensions, but got %lld and %lld",
+                first.n_dim(), t->n_dim());
+            for (index_t i = 0; i < first.n_dim(); ++i)
+                CHECK_TRUE(i == dim || t->_shape[i] == first._shape[i],
+                    "Sizes of tensors must match except in dimension %d, but got %lld and %lld in dimension %lld",
+                    dim, first._shape[i], t->_shape[i], i);
+            shape[dim] += t->_shape[dim];
+            srcs.push_back(t->contiguous());
+            data.push_back(static_cast<const TensorImpl&>(*srcs.back()).data());
+            widths.push_back(t->_shape[dim] * inner);
+        }
+        auto ptr = empty(shape);
+        indexing::cat(data, widths, ptr->data(), shape.sub_size(0, dim));
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::stack(const std::vector<const TensorImpl*>& tensors, int dim) {
+        CHECK_TRUE(!tensors.empty(), "stack() expects a non-empty list of tensors");
+        const TensorImpl& first = *tensors[0];
+        CHECK_IN_RANGE(dim, 0, first.n_dim() + 1,
+            "Dimension out of range (expected to be in range of [0, %lld], but got %d)",
+            first.n_dim(), dim);
+        Array<index_t> dims(first.n_dim() + 1);
+        for (index_t i = 0, j = 0; i < dims.size(); ++i)
+            dims[i] = i == dim ? (index_t)tensors.size() : first._shape[j++];
+        Shape shape(std::move(dims));
+        std::vector<Alloc::NonTrivalUniquePtr<TensorImpl>> srcs;
+        std::vector<const data_t*> data;
+        std::vector<index_t> widths;
+        index_t inner = first._shape.sub_size(dim);
+        for (const TensorImpl* t : tensors) {
+            CHECK_TRUE(t->_shape == first._shape, "stack() expects each tensor to be equal size");
+            srcs.push_back(t->contiguous());
+            data.push_back(static_cast<const TensorImpl&>(*srcs.back()).data());
+            widths.push_back(inner);
+        }
+        auto ptr = empty(shape);
+        indexing::cat(data, widths, ptr->data(), shape.sub_size(0, dim));
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::einsum(const std::string& equation, const std::vector<const TensorImpl*>& tensors) {
+        std::vector<std::vector<index_t>> shapes;
+        std::vector<contraction::Operand> operands;
+        for (const TensorImpl* t : tensors) {
+            shapes.emplace_back(t->n_dim());
+            for (index_t i = 0; i < t->n_dim(); ++i) shapes.back()[i] = t->_shape[i];
+        }
+        for (index_t i = 0; i < (index_t)tensors.size(); ++i)
+            operands.push_back({ tensors[i]->data(), shapes[i].data(), tensors[i]->_stride.data(), tensors[i]->n_dim() });
+        std::vector<index_t> dims = contraction::output_shape(equation, operands);
+        Array<index_t> out(std::max<index_t>((index_t)dims.size(), 1));
+        out[0] = 1;
+        for (index_t i = 0; i < (index_t)dims.size(); ++i) out[i] = dims[i];
+        auto ptr = empty(Shape(std::move(out)));
+        contraction::contract(equation, operands, ptr->data());
+        return ptr;
+    }
+
+    std::vector<Alloc::NonTrivalUniquePtr<TensorImpl>>
+        TensorImpl::split(index_t split_size, int dim) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        CHECK_TRUE(split_size > 0, "split() expects a positive split size, but got %lld", split_size);
+        std::vector<Alloc::NonTrivalUniquePtr<TensorImpl>> parts;
+        for (index_t start = 0; start < _shape[dim]; start += split_size)
+            parts.push_back(slice(start, std::min(start + split_size, _shape[dim]), dim));
+        return parts;
+    }
+
+    std::vector<Alloc::NonTrivalUniquePtr<TensorImpl>>
+        TensorImpl::chunk(index_t chunks, int dim) const {
+        CHECK_TRUE(chunks > 0, "chunk() expects a positive number of chunks, but got %lld", chunks);
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        return split(std::max<index_t>((_shape[dim] + chunks - 1) / chunks, 1), dim);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::index_select(int dim, const TensorImpl& index) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        CHECK_EQUAL(index.n_dim(), 1,
+            "index_select() expects a 1D index, but got %lldD", index.n_dim());
+        index_t n_index = index.d_size();
+        auto ids = index.contiguous();
+        const data_t* id = static_cast<const TensorImpl&>(*ids).data();
+        std::vector<index_t> idx(n_index);
+        for (index_t i = 0; i < n_index; ++i) {
+            CHECK_TRUE(id[i] == std::floor(id[i]), "index_select() expects integer indices, but got %g", id[i]);
+            CHECK_TRUE(id[i] >= 0 && id[i] < (data_t)_shape[dim],
+                "Index %g is out of bound for dimension %d with size %lld",
+                id[i], dim, _shape[dim]);
+            idx[i] = (index_t)id[i];
+        }
+        Shape shape(_shape);
+        shape[dim] = n_index;
+        auto src = contiguous();
+        auto ptr = empty(shape);
+        indexing::index_select(static_cast<const TensorImpl&>(*src).data(), idx.data(), n_index, ptr->data(),
+            _shape.sub_size(0, dim), _shape[dim], _shape.sub_size(dim + 1));
+        return ptr;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::gather(int dim, const TensorImpl& index) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        CHECK_EQUAL(index.n_dim(), n_dim(),
+            "gather() expects an index with %lld dimensions, but got %lld", n_dim(), index.n_dim());
+        for (index_t i = 0; i < n_dim(); ++i)
+            CHECK_TRUE(i == dim || index._shape[i] == _shape[i],
+                "gather() expects the index to match the input except in dimension %d", dim);
+        auto idx = index.contiguous();
+        const data_t* id = static_cast<const TensorImpl&>(*idx).data();
+        CHECK_TRUE(indexing::in_range(id, index.d_size(), _shape[dim]),
+            "gather() expects integer indices in [0, %lld) for dimension %d", _shape[dim], dim);
+        auto src = contiguous();
+        auto ptr = empty(index._shape);
+        indexing::gather(static_cast<const TensorImpl&>(*src).data(), id, ptr->data(),
+            _shape.sub_size(0, dim), _shape[dim], index._shape[dim], _shape.sub_size(dim + 1));
+        return ptr;
+    }
+
+    TensorImpl& TensorImpl::scatter(int dim, const TensorImpl& index, const TensorImpl& src, bool accumulate) {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        CHECK_TRUE(index._shape == src._shape, "scatter() expects the index and source to be equal size");
+        CHECK_EQUAL(index.n_dim(), n_dim(),
+            "scatter() expects an index with %lld dimensions, but got %lld", n_dim(), index.n_dim());
+        for (index_t i = 0; i < n_dim(); ++i)
+            CHECK_TRUE(i == dim || index._shape[i] == _shape[i],
+                "scatter() expects the index to match the destination except in dimension %d", dim);
+        auto idx = index.contiguous();
+        const data_t* id = static_cast<const TensorImpl&>(*idx).data();
+        CHECK_TRUE(indexing::in_range(id, index.d_size(), _shape[dim]),
+            "scatter() expects integer indices in [0, %lld) for dimension %d", _shape[dim], dim);
+        auto values = src.contiguous();
+        Alloc::NonTrivalUniquePtr<TensorImpl> dst = is_contiguous() ? nullptr : contiguous();
+        indexing::scatter(dst ? dst->data() : data(), id, static_cast<const TensorImpl&>(*values).data(),
+            _shape.sub_size(0, dim), _shape[dim], index._shape[dim], _shape.sub_size(dim + 1), accumulate);
+        if (dst) copy_(*dst);
+        return *this;
+    }
+
+    TensorImpl& TensorImpl::scatter_(int dim, const TensorImpl& index, const TensorImpl& src) {
+        return scatter(dim, index, src, false);
+    }
+
+    TensorImpl& TensorImpl::scatter_add_(int dim, const TensorImpl& index, const TensorImpl& src) {
+        return scatter(dim, index, src, true);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::masked_select(const TensorImpl& mask) const {
+        CHECK_TRUE(mask._shape == _shape, "masked_select() expects the mask to match the input size");
+        auto m = mask.contiguous();
+        auto src = contiguous();
+        const data_t* md = static_cast<const TensorImpl&>(*m).data();
+        std::vector<index_t> offsets = indexing::mask_offsets(md, d_size());
+        auto ptr = empty(Shape({ offsets.back() }));
+        indexing::masked_select(static_cast<const TensorImpl&>(*src).data(), md, offsets, ptr->data(), d_size());
+        return ptr;
+    }
+
+    std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+        TensorImpl::sort(int dim, bool descending) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        auto src = contiguous();
+        auto values = empty(_shape), indices = empty(_shape);
+        sorting::sort(static_cast<const TensorImpl&>(*src).data(), values->data(), indices->data(),
+            _shape.sub_size(0, dim), _shape[dim], _shape.sub_size(dim + 1), descending);
+        return { std::move(values), std::move(indices) };
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::argsort(int dim, bool descending) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        auto src = contiguous();
+        auto indices = empty(_shape);
+        sorting::sort(static_cast<const TensorImpl&>(*src).data(), nullptr, indices->data(),
+            _shape.sub_size(0, dim), _shape[dim], _shape.sub_size(dim + 1), descending);
+        return indices;
+    }
+
+    std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+        TensorImpl::topk(index_t k, int dim, bool largest, bool sorted) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        CHECK_IN_RANGE(k, 0, _shape[dim] + 1,
+            "k (%lld) is out of range for dimension %d with size %lld", k, dim, _shape[dim]);
+        Shape shape(_shape);
+        shape[dim] = k;
+        auto src = contiguous();
+        auto values = empty(shape), indices = empty(shape);
+        sorting::topk(static_cast<const TensorImpl&>(*src).data(), values->data(), indices->data(),
+            _shape.sub_size(0, dim), _shape[dim], _shape.sub_size(dim + 1), k, largest, sorted);
+        return { std::move(values), std::move(indices) };
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::cumulative(int kind, int dim, TensorImpl* indices) const {
+        CHECK_IN_RANGE(dim, 0, n_dim(),
+            "Dimension out of range (expected to be in range of [0, %lld), but got %d)",
+            n_dim(), dim);
+        auto src = contiguous();
+        auto values = empty(_shape);
+        scan::scan(static_cast<const TensorImpl&>(*src).data(), values->data(), indices ? indices->data() : nullptr,
+            _shape.sub_size(0, dim), _shape[dim], _shape.sub_size(dim + 1), (scan::Kind)kind);
+        return values;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl> TensorImpl::cumsum(int dim) const {
+        return cumulative((int)scan::Kind::Sum, dim, nullptr);
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl> TensorImpl::cumprod(int dim) const {
+        return cumulative((int)scan::Kind::Prod, dim, nullptr);
+    }
+
+    std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+        TensorImpl::cummax(int dim) const {
+        auto indices = empty(_shape);
+        auto values = cumulative((int)scan::Kind::Max, dim, indices.get());
+        return { std::move(values), std::move(indices) };
+    }
+
+    std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+        TensorImpl::cummin(int dim) const {
+        auto indices = empty(_shape);
+        auto values = cumulative((int)scan::Kind::Min, dim, indices.get());
+        return { std::move(values), std::move(indices) };
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl> TensorImpl::logcumsumexp(int dim) const {
+        return cumulative((int)scan::Kind::LogSumExp, dim, nullptr);
+    }
+
+    namespace {
+
+        void check_square(const TensorImpl& t, const char* name) {
+            CHECK_TRUE(t.n_dim() >= 2 && t.size(t.n_dim() - 1) == t.size(t.n_dim() - 2),
+                "%s() expects a batch of square matrices", name);
+        }
+
+        index_t batch_of(const TensorImpl& t) {
+            index_t batch = 1;
+            for (index_t d = 0; d < t.n_dim() - 2; ++d) batch *= t.size(d);
+            return batch;
+        }
+
+        // Columns of the right-hand side of a solve against the matrices of `a`.
+        index_t rhs_columns(const TensorImpl& a, const TensorImpl& b, const char* name) {
+            index_t n = a.size(a.n_dim() - 1);
+            bool vector = b.n_dim() == a.n_dim() - 1;
+            CHECK_TRUE(vector || b.n_dim() == a.n_dim(),
+                "%s() expects a right-hand side of %lld or %lld dimensions, but got %lld",
+                name, a.n_dim() - 1, a.n_dim(), b.n_dim());
+            for (index_t d = 0; d < a.n_dim() - 2; ++d)
+                CHECK_EQUAL(b.size(d), a.size(d),
+                    "%s() expects matching batch dimensions, but got %lld and %lld at dimension %lld",
+                    name, a.size(d), b.size(d), d);
+            CHECK_EQUAL(b.size(a.n_dim() - 2), n,
+                "%s() expects %lld rows in the right-hand side, but got %lld", name, n, b.size(a.n_dim() - 2));
+            return vector ? 1 : b.size(b.n_dim() - 1);
+        }
+
+        // LU-factors every matrix of `a` in place. Returns false if any is
+        // singular.
+        bool factor(data_t* a, index_t* pivots, index_t batch, index_t n) {
+            std::vector<char> ok(batch, 1);
+            ThreadPool::self().parallel_for(0, batch, 1, [&](index_t begin, index_t end) {
+                for (index_t i = begin; i < end; ++i) ok[i] = linalg::lu(a + i * n * n, n, pivots + i * n);
+            });
+            return std::all_of(ok.begin(), ok.end(), [](char v) { return v != 0; });
+        }
+
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::inverse() const {
+        check_square(*this, "inverse");
+        index_t n = size(n_dim() - 1), batch = batch_of(*this);
+        Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
+        bool ok = true;
+        if (small::supported(n)) {
+            auto src = contiguous();
+            ptr = Alloc::unique_construct<TensorImpl>(_shape);
+            ok = small::inverse(static_cast<const TensorImpl&>(*src).data(), ptr->data(), batch, n);
+        }
+        else {
+            auto a = empty(_shape);
+            a->copy_(*this);
+            ptr = empty(_shape);
+            data_t* ad = a->data();
+            data_t* x = ptr->data();
+            std::vector<index_t> pivots(batch * n);
+            ok = factor(ad, pivots.data(), batch, n);
+            std::fill(x, x + batch * n * n, 0);
+            ThreadPool::self().parallel_for(0, batch, 1, [&](index_t begin, index_t end) {
+                for (index_t i = begin; i < end; ++i) {
+                    data_t* xi = x + i * n * n;
+                    for (index_t j = 0; j < n; ++j) xi[j * n + j] = 1;
+                    linalg::lu_solve(ad + i * n * n, pivots.data() + i * n, xi, n, n);
                 }
-                out << std::endl;
+            });
+        }
+        CHECK_TRUE(ok, "inverse(): the input contains a singular matrix");
+        return ptr;
+    }
 
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::det() const {
+        check_square(*this, "det");
+        index_t n = size(n_dim() - 1), batch = batch_of(*this);
+        Alloc::NonTrivalUniquePtr<TensorImpl> ptr;
+        if (n_dim() == 2) ptr = Alloc::unique_construct<TensorImpl>(Shape({ 1 }));
+        else ptr = Alloc::unique_construct<TensorImpl>(Shape(Shape(_shape, n_dim() - 1), n_dim() - 2));
+        if (small::supported(n)) {
+            auto src = contiguous();
+            small::det(static_cast<const TensorImpl&>(*src).data(), ptr->data(), batch, n);
+        }
+        else {
+            auto a = empty(_shape);
+            a->copy_(*this);
+            data_t* ad = a->data();
+            std::vector<index_t> pivots(batch * n);
+            factor(ad, pivots.data(), batch, n);
+            for (index_t i = 0; i < batch; ++i) {
+                data_t d = 1;
+                for (index_t j = 0; j < n; ++j) {
+                    d *= ad[i * n * n + j * n + j];
+                    if (pivots[i * n + j] != j) d = -d;
+                }
+                ptr->data()[i] = d;
             }
-            ++cnt;
         }
-        return out;
+        return ptr;
+    }
+
+    std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+        TensorImpl::lu() const {
+        check_square(*this, "lu");
+        index_t n = size(n_dim() - 1), batch = batch_of(*this);
+        auto a = empty(_shape);
+        a->copy_(*this);
+        auto pivots = empty(Shape(_shape, n_dim() - 1));
+        std::vector<index_t> p(batch * n);
+        factor(a->data(), p.data(), batch, n);
+        for (index_t i = 0; i < batch * n; ++i) pivots->data()[i] = (data_t)p[i];
+        return { std::move(a), std::move(pivots) };
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::cholesky() const {
+        check_square(*this, "cholesky");
+        index_t n = size(n_dim() - 1), batch = batch_of(*this);
+        auto a = empty(_shape);
+        a->copy_(*this);
+        data_t* ad = a->data();
+        std::vector<char> ok(batch, 1);
+        ThreadPool::self().parallel_for(0, batch, 1, [&](index_t begin, index_t end) {
+            for (index_t i = begin; i < end; ++i) ok[i] = linalg::cholesky(ad + i * n * n, n);
+        });
+        CHECK_TRUE(std::all_of(ok.begin(), ok.end(), [](char v) { return v != 0; }),
+            "cholesky(): the input is not positive-definite");
+        return a;
+    }
+
+    std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+        TensorImpl::qr() const {
+        CHECK_TRUE(n_dim() >= 2, "qr() expects a batch of matrices, but got a %lldD tensor", n_dim());
+        index_t m = size(n_dim() - 2), n = size(n_dim() - 1), kk = std::min(m, n), batch = batch_of(*this);
+        Array<index_t> q_dims(n_dim()), r_dims(n_dim());
+        for (index_t d = 0; d < n_dim(); ++d) q_dims[d] = r_dims[d] = _shape[d];
+        q_dims[n_dim() - 1] = kk;
+        r_dims[n_dim() - 2] = kk;
+        auto a = empty(_shape);
+        a->copy_(*this);
+        auto q = empty(Shape(std::move(q_dims)));
+        auto r = empty(Shape(std::move(r_dims)));
+        data_t* ad = a->data();
+        data_t* qd = q->data();
+        data_t* rd = r->data();
+        ThreadPool::self().parallel_for(0, batch, 1, [&](index_t begin, index_t end) {
+            for (index_t i = begin; i < end; ++i)
+                linalg::qr(ad + i * m * n, qd + i * m * kk, rd + i * kk * n, m, n);
+        });
+        return { std::move(q), std::move(r) };
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::triangular_solve(const TensorImpl& b, bool upper, bool unitriangular) const {
+        check_square(*this, "triangular_solve");
+        index_t n = size(n_dim() - 1), batch = batch_of(*this);
+        index_t k = rhs_columns(*this, b, "triangular_solve");
+        auto src = contiguous();
+        const data_t* ad = static_cast<const TensorImpl&>(*src).data();
+        auto x = empty(b._shape);
+        x->copy_(b);
+        data_t* xd = x->data();
+        ThreadPool::self().parallel_for(0, batch, 1, [&](index_t begin, index_t end) {
+            for (index_t i = begin; i < end; ++i)
+                linalg::triangular_solve(ad + i * n * n, xd + i * n * k, n, k, upper, unitriangular);
+        });
+        return x;
+    }
+
+    Alloc::NonTrivalUniquePtr<TensorImpl>
+        TensorImpl::solve(const TensorImpl& b) const {
+        check_square(*this, "solve");
+        index_t n = size(n_dim() - 1), batch = batch_of(*this);
+        index_t k = rhs_columns(*this, b, "solve");
+        auto a = empty(_shape);
+        a->copy_(*this);
+        auto x = empty(b._shape);
+        x->copy_(b);
+        data_t* ad = a->data();
+        data_t* xd = x->data();
+        std::vector<index_t> pivots(batch * n);
+        CHECK_TRUE(factor(ad, pivots.data(), batch, n), "solve(): the input contains a singular matrix");
+        ThreadPool::self().parallel_for(0, batch, 1, [&](index_t begin, index_t end) {
+            for (index_t i = begin; i < end; ++i)
+                linalg::lu_solve(ad + i * n * n, pivots.data() + i * n, xd + i * n * k, n, k);
+        });
+        return x;
+    }
+
+    std::ostream& operator<<(std::ostream& out, const TensorImpl& tensor) {
+        std::vector<index_t> shape(tensor.n_dim());
+        for (index_t i = 0; i < tensor.n_dim(); ++i) shape[i] = tensor.size(i);
+        std::string buf;
+        printer::write(buf, tensor.data(), shape.data(), tensor.stride().data(), tensor.n_dim(), printoptions());
+        return out.write(buf.data(), buf.size());
     }
 
     data_t TensorImpl::sum() const {
         data_t res = 0;
         std::vector<index_t> idx(n_dim(), 0);
-        for (int i = 0; i < d_size(); ++i) {
+        bool masked = padded();
+        for (index_t i = 0; i < d_size(); ++i) {
             int cnt = 0;
-            res += eval(idx);
+            if (!masked || !padding(idx)) res += eval(idx);
             for (int j = 0; j < n_dim(); ++j) {
                 if (idx[j] + 1 < size()[j]) {
                     ++idx[j];
@@ -303,8 +1036,7 @@ namespace keith {
 
     TensorImpl TensorMaker::ones(const Shape& shape) {
         TensorImpl tensor(shape);
-        for (int i = 0; i < tensor.d_size(); ++i)
-            tensor.item(i) = 1;
+        std::fill_n(tensor.data(), tensor.d_size(), 1);
         return tensor;
     }
 
@@ -314,8 +1046,7 @@ namespace keith {
 
     TensorImpl TensorMaker::zeros(const Shape& shape) {
         TensorImpl tensor(shape);
-        for (int i = 0; i < tensor.d_size(); ++i)
-            tensor.item(i) = 0;
+        std::fill_n(tensor.data(), tensor.d_size(), 0);
         return tensor;
     }
 
@@ -328,8 +1059,9 @@ namespace keith {
         std::default_random_engine gen(rd());
         std::uniform_real_distribution<data_t> dis(0, 1);
         TensorImpl tensor(shape);
-        for (int i = 0; i < tensor.d_size(); ++i)
-            tensor.item(i) = dis(gen);
+        data_t* data = tensor.data();
+        for (index_t i = 0; i < tensor.d_size(); ++i)
+            data[i] = dis(gen);
         return tensor;
     }
 
@@ -342,8 +1074,9 @@ namespace keith {
         std::default_random_engine gen(rd());
         std::normal_distribution<data_t> dis(0, 1);
         TensorImpl tensor(shape);
-        for (int i = 0; i < tensor.d_size(); ++i)
-            tensor.item(i) = dis(gen);
+        data_t* data = tensor.data();
+        for (index_t i = 0; i < tensor.d_size(); ++i)
+            data[i] = dis(gen);
         return tensor;
     }
 
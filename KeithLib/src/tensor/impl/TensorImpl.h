@@ -3,68 +3,198 @@
 #include "../../utils/Shape.h"
 #include "../../utils/Storage.h"
 #include "../../utils/Allocator.h"
+#include "../../utils/SharedMemory.h"
 #include "../Exception.h"
 #include "../Exp.h"
+#include "../operations/Layout.h"
+#include "Printer.h"
 
 #include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace keith {
 
+    class TensorImpl;
+
+    // The operand of an expression whose memory format its result adopts.
+    template<typename ExpType>
+    struct FormatSource;
+
+    template<typename ExpType>
+    inline bool fast_assign(TensorImpl& dst, const std::shared_ptr<ExpType>& src) {
+        return false;
+    }
+
+    // Algebraic rewrites tried before any other path when an expression is
+    // materialized. Specializations live with the operators in Operations.h.
+    template<typename ExpType, typename = void>
+    struct Rewrite {
+        static bool assign(TensorImpl& dst, const std::shared_ptr<ExpType>& src) {
+            return false;
+        }
+    };
+
 	class TensorImpl
 	{
 	public:
 		TensorImpl(const keith::Storage& storage, const keith::Shape& shape, const Array<index_t>& stride);
 		TensorImpl(const keith::Storage& storage, const keith::Shape& shape);
 		explicit TensorImpl(const keith::Shape& shape);
+		// Zero-filled, laid out like `like` when it has the same shape and a
+		// memory format other than row-major.
+		TensorImpl(const keith::Shape& shape, const TensorImpl* like);
 		TensorImpl(const data_t* data, const keith::Shape& Shape);
 		TensorImpl(keith::Storage&& Storage, keith::Shape&& Shape, Array<index_t>&& stride);
 		TensorImpl(const TensorImpl& other) = default;
 		TensorImpl(TensorImpl&& other) = default;
 		template<typename ImplType>
-		explicit TensorImpl(const ImplType& impl) : TensorImpl(impl->size()) {
+		explicit TensorImpl(const ImplType& impl)
+			: TensorImpl(impl->size(), FormatSource<typename ImplType::element_type>::of(*impl)) {
 			this->operator=(impl);
 		}
+		explicit TensorImpl(const std::shared_ptr<TensorImpl>& impl);
     public:
         [[nodiscard]] index_t n_dim() const { return _shape.n_dim(); }
         [[nodiscard]] index_t d_size() const { return  _shape.d_size(); }
         [[nodiscard]] index_t size(index_t idx) const {
-            CHECK_IN_RANGE(idx, 0, n_dim(), "Index out of range (expected to be in range of [0, %d), but got %d)",
+            CHECK_IN_RANGE(idx, 0, n_dim(), "Index out of range (expected to be in range of [0, %lld), but got %lld)",
                 n_dim(), idx);
             return _shape[idx];
         }
         [[nodiscard]] const Shape& size() const { return _shape; }
         [[nodiscard]] index_t offset() const { return _storage.offset(); }
         [[nodiscard]] const Array<index_t>& stride() const { return _stride; }
+        [[nodiscard]] data_t* data() { return _storage.data(); }
+        [[nodiscard]] const data_t* data() const { return _storage.data(); }
+        // Mutable access for writing rows [begin, end) of dimension 0 only.
+        // Cached expressions over this tensor then recompute just those rows.
+        [[nodiscard]] data_t* data(index_t begin, index_t end);
+        // Counts writes to the underlying buffer.
+        [[nodiscard]] index_t version() const { return _storage.version(); }
+        // Whether every write since `version` was a row range, and if so the
+        // rows of this tensor they cover.
+        [[nodiscard]] bool written_since(index_t version, index_t& begin, index_t& end) const;
 
         bool is_contiguous() const;
+        bool is_contiguous(MemoryFormat format) const;
+        // True when the elements fill one block of memory in some order of
+        // the dimensions, as row-major and channels-last tensors do.
+        bool is_dense() const;
+        // Blocked for tensors made by to(MemoryFormat::Blocked), channels-last
+        // for a 4D tensor whose strides put C innermost, row-major otherwise.
+        [[nodiscard]] MemoryFormat memory_format() const;
+    public:
+        [[nodiscard]] bool requires_grad() const { return _requires_grad; }
+        TensorImpl& requires_grad_(bool requires_grad = true);
+        [[nodiscard]] const std::shared_ptr<TensorImpl>& grad() const { return _grad; }
+        void accumulate_grad(const data_t* grad);
+        void zero_grad();
     public:
-        data_t& operator[](std::initializer_list<index_t> dims);
+        // Reading through the mutable overloads does not bump version().
+        Storage::Element operator[](std::initializer_list<index_t> dims);
         data_t operator[](std::initializer_list<index_t> dims) const;
         [[nodiscard]] data_t item() const;
         [[nodiscard]] data_t item(index_t idx) const;
-        [[nodiscard]] data_t& item(index_t idx);
+        [[nodiscard]] Storage::Element item(index_t idx);
         [[nodiscard]] data_t eval(Array<index_t> idx) const;
         [[nodiscard]] data_t sum() const;
     public:
         [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> slice(index_t idx, index_t dim = 0) const;
         [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> slice(index_t start_idx, index_t end_idx, index_t dim) const;
         [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> transpose(index_t dim1, index_t dim2) const;
+        // Reverses `dim` without copying by walking it with a negated stride.
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> flip(index_t dim) const;
         [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> view(const Shape& Shape) const;
         [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> permute(std::initializer_list<index_t> dims) const;
         [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> sum(int idx) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> contiguous() const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> clone() const;
+        // This (N, C, H, W) tensor in `format`. Channels-last keeps the shape
+        // and reorders the strides; blocked has shape
+        // (N, ceil(C / block), H, W, block) and converts back to (N, C, H, W).
+        // Lanes of the last block past C are padding: element-wise assignment
+        // keeps them at zero and sum() and sum(dim) skip them.
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> to(MemoryFormat format, index_t block = layout::block) const;
+        // Per-channel sum over N, H and W of an (N, C, H, W) tensor in any format.
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> channel_sum() const;
+        // x * scale[c] + shift[c], in the format of this tensor.
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> channel_affine(const TensorImpl& scale, const TensorImpl& shift) const;
+        // 1x1 convolution with a (K, C) weight, in the format of this tensor.
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> conv1x1(const TensorImpl& weight) const;
+        TensorImpl& copy_(const TensorImpl& src);
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> softmax(int dim) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> log_softmax(int dim) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> layer_norm(int dim, data_t eps = 1e-5) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> layer_norm(int dim, const TensorImpl& weight, const TensorImpl& bias, data_t eps = 1e-5) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> rms_norm(int dim, data_t eps = 1e-5) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> rms_norm(int dim, const TensorImpl& weight, data_t eps = 1e-5) const;
+        [[nodiscard]] static Alloc::NonTrivalUniquePtr<TensorImpl> cat(const std::vector<const TensorImpl*>& tensors, int dim);
+        [[nodiscard]] static Alloc::NonTrivalUniquePtr<TensorImpl> stack(const std::vector<const TensorImpl*>& tensors, int dim);
+        // Copies this tensor into a new, published shared-memory segment,
+        // which the returned object owns.
+        std::shared_ptr<SharedMemory> share(const std::string& name) const;
+        // A tensor over a segment published by any process, without copying.
+        [[nodiscard]] static Alloc::NonTrivalUniquePtr<TensorImpl> attach(const std::string& name,
+            SharedMemory::Access access = SharedMemory::Access::ReadOnly);
+        // Einstein summation, e.g. einsum("bij,bjk->bik", { &a, &b }). A result
+        // with no labels is returned with shape (1).
+        [[nodiscard]] static Alloc::NonTrivalUniquePtr<TensorImpl> einsum(const std::string& equation, const std::vector<const TensorImpl*>& tensors);
+        [[nodiscard]] std::vector<Alloc::NonTrivalUniquePtr<TensorImpl>> split(index_t split_size, int dim) const;
+        [[nodiscard]] std::vector<Alloc::NonTrivalUniquePtr<TensorImpl>> chunk(index_t chunks, int dim) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> index_select(int dim, const TensorImpl& index) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> gather(int dim, const TensorImpl& index) const;
+        TensorImpl& scatter_(int dim, const TensorImpl& index, const TensorImpl& src);
+        TensorImpl& scatter_add_(int dim, const TensorImpl& index, const TensorImpl& src);
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> masked_select(const TensorImpl& mask) const;
+        // Sorted values along `dim` and the positions they came from.
+        [[nodiscard]] std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+            sort(int dim, bool descending = false) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> argsort(int dim, bool descending = false) const;
+        [[nodiscard]] std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+            topk(index_t k, int dim, bool largest = true, bool sorted = true) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> cumsum(int dim) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> cumprod(int dim) const;
+        // Running extreme along `dim` and the position it was taken from.
+        [[nodiscard]] std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+            cummax(int dim) const;
+        [[nodiscard]] std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+            cummin(int dim) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> logcumsumexp(int dim) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> inverse() const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> det() const;
+        // LU with partial pivoting of each matrix: L below its unit diagonal
+        // and U on and above it in one tensor, and the row each row was
+        // swapped with at every step.
+        [[nodiscard]] std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+            lu() const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> cholesky() const;
+        // Reduced QR, Q of (..., m, min(m, n)) and R of (..., min(m, n), n).
+        [[nodiscard]] std::pair<Alloc::NonTrivalUniquePtr<TensorImpl>, Alloc::NonTrivalUniquePtr<TensorImpl>>
+            qr() const;
+        // X with A X = B for this A, where B is (..., n, k) or (..., n).
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> triangular_solve(const TensorImpl& b, bool upper, bool unitriangular = false) const;
+        [[nodiscard]] Alloc::NonTrivalUniquePtr<TensorImpl> solve(const TensorImpl& b) const;
     public:
         friend std::ostream& operator<<(std::ostream& out, const TensorImpl& tensor);
 
         template<typename ImplType>
         TensorImpl& operator=(const ImplType& src) {
+            if (Rewrite<typename ImplType::element_type>::assign(*this, src)) return *this;
+            // The padding lanes of a blocked tensor are never evaluated, as
+            // the kernels behind fast_assign would, and are kept at zero.
+            bool masked = padded();
+            if (!masked && fast_assign(*this, src)) return *this;
             std::vector<index_t> dim_cnt(n_dim(), 0);
-            int cnt = 0;
+            data_t* dst = data();
+            index_t cnt = 0;
             while (cnt < d_size()) {
-                int idx = 0;
+                index_t idx = 0;
                 for (int i = 0; i < n_dim(); ++i) {
                     idx += dim_cnt[i] * _stride[i];
                 }
-                item(idx) = src->eval(dim_cnt);
+                dst[idx] = masked && padding(dim_cnt) ? 0 : src->eval(dim_cnt);
                 for (int i = n_dim() - 1; i >= 0; --i) {
                     if (dim_cnt[i] + 1 < _shape[i]) {
                         dim_cnt[i]++;
@@ -80,11 +210,58 @@ namespace keith {
         }
 
     protected:
+        static Alloc::NonTrivalUniquePtr<TensorImpl> empty(const Shape& shape);
+        // An (N, C, H, W) tensor laid out in `format`.
+        static Alloc::NonTrivalUniquePtr<TensorImpl> empty(const Shape& shape, MemoryFormat format, index_t block);
+        Alloc::NonTrivalUniquePtr<TensorImpl> channels_input(const char* op) const;
+        // A blocked tensor whose last channel block is only partly used.
+        [[nodiscard]] bool padded() const { return _format == MemoryFormat::Blocked && _channels % _shape[4] != 0; }
+        // Whether `idx` falls in the unused lanes of a blocked tensor.
+        [[nodiscard]] bool padding(const std::vector<index_t>& idx) const { return idx[1] * _shape[4] + idx[4] >= _channels; }
+        Alloc::NonTrivalUniquePtr<TensorImpl> normalize(int kind, int dim, const TensorImpl* weight, const TensorImpl* bias, data_t eps) const;
+        TensorImpl& scatter(int dim, const TensorImpl& index, const TensorImpl& src, bool accumulate);
+        Alloc::NonTrivalUniquePtr<TensorImpl> cumulative(int kind, int dim, TensorImpl* indices) const;
+
         Storage _storage;
         Shape _shape;
         Array<index_t> _stride;
+        // Blocked tensors are tagged; the other formats follow from the strides.
+        MemoryFormat _format = MemoryFormat::RowMajor;
+        // C of a blocked tensor, whose last block may be padding.
+        index_t _channels = 0;
+        bool _requires_grad = false;
+        std::shared_ptr<TensorImpl> _grad;
 	};
 
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<TensorImpl>& src);
+
+    template<typename ExpType>
+    struct FormatSource {
+        static const TensorImpl* of(const ExpType& exp) { return nullptr; }
+    };
+
+    template<>
+    struct FormatSource<TensorImpl> {
+        static const TensorImpl* of(const TensorImpl& tensor) {
+            return tensor.memory_format() == MemoryFormat::RowMajor ? nullptr : &tensor;
+        }
+    };
+
+    template<typename Op, typename LhsType>
+    struct FormatSource<UnaryExp<Op, LhsType>> {
+        static const TensorImpl* of(const UnaryExp<Op, LhsType>& exp) {
+            return FormatSource<LhsType>::of(*exp.lhs());
+        }
+    };
+
+    template<typename Op, typename LhsType, typename RhsType>
+    struct FormatSource<BinaryExp<Op, LhsType, RhsType>> {
+        static const TensorImpl* of(const BinaryExp<Op, LhsType, RhsType>& exp) {
+            if (const TensorImpl* lhs = FormatSource<LhsType>::of(*exp.lhs())) return lhs;
+            return FormatSource<RhsType>::of(*exp.rhs());
+        }
+    };
+
     struct TensorMaker {
         static TensorImpl ones(const Shape& shape);
         static TensorImpl ones_like(const TensorImpl& tensor);
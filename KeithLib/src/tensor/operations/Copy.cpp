@@ -0,0 +1,167 @@
+#include "Copy.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace keith {
+
+    namespace strided {
+
+        namespace {
+
+            constexpr index_t grain = 1 << 14;
+            constexpr index_t block = 64;
+
+            // dst[j * ds + i] = src[i * ss + j] for one tile. Full tiles use
+            // constant bounds so the compiler can keep them in vector registers.
+            template<typename I>
+            inline void transpose_tile(data_t* dst, I ds, const data_t* src, I ss, I rows, I cols) {
+                if (rows == (I)tile && cols == (I)tile) {
+                    for (I j = 0; j < (I)tile; ++j)
+                        for (I i = 0; i < (I)tile; ++i)
+                            dst[j * ds + i] = src[i * ss + j];
+                    return;
+                }
+                for (I j = 0; j < cols; ++j)
+                    for (I i = 0; i < rows; ++i)
+                        dst[j * ds + i] = src[i * ss + j];
+            }
+
+            // Tiled walk over two dimensions with arbitrary strides on both sides.
+            template<typename I>
+            void transpose_strided(data_t* dst, I dr, I dc, const data_t* src, I sr, I sc, I rows, I cols) {
+                const I t = (I)tile, b = (I)block;
+                if (sc == 1 && dr == 1) {
+                    for (I bi = 0; bi < rows; bi += b)
+                        for (I bj = 0; bj < cols; bj += b) {
+                            I ie = std::min(rows, bi + b), je = std::min(cols, bj + b);
+                            for (I i = bi; i < ie; i += t)
+                                for (I j = bj; j < je; j += t)
+                                    transpose_tile<I>(dst + j * dc + i, dc, src + i * sr + j, sr,
+                                        std::min(t, ie - i), std::min(t, je - j));
+                        }
+                    return;
+                }
+                for (I i = 0; i < rows; i += t)
+                    for (I j = 0; j < cols; j += t) {
+                        I ie = std::min(rows, i + t), je = std::min(cols, j + t);
+                        for (I jj = j; jj < je; ++jj)
+                            for (I ii = i; ii < ie; ++ii)
+                                dst[ii * dr + jj * dc] = src[ii * sr + jj * sc];
+                    }
+            }
+
+            index_t fastest(const index_t* stride, const index_t* shape, index_t n_dim) {
+                index_t best = n_dim;
+                for (index_t i = 0; i < n_dim; ++i) {
+                    if (shape[i] == 1) continue;
+                    if (best == n_dim || std::llabs(stride[i]) < std::llabs(stride[best])) best = i;
+                }
+                return best;
+            }
+
+            template<typename I>
+            void copy_outer(data_t* dst, const index_t* dst_stride, const data_t* src, const index_t* src_stride,
+                const index_t* shape, const std::vector<index_t>& outer, index_t p, index_t q, index_t n_outer, index_t inner) {
+                ThreadPool::self().parallel_for(0, n_outer, std::max<index_t>(grain / inner, 1),
+                    [&](index_t begin, index_t end) {
+                        for (I o = (I)begin; o < (I)end; ++o) {
+                            I rem = o, d_off = 0, s_off = 0;
+                            for (int k = (int)outer.size() - 1; k >= 0; --k) {
+                                index_t dim = outer[k];
+                                I v = rem % (I)shape[dim];
+                                rem /= (I)shape[dim];
+                                d_off += v * (I)dst_stride[dim];
+                                s_off += v * (I)src_stride[dim];
+                            }
+                            data_t* d = dst + d_off;
+                            const data_t* s = src + s_off;
+                            if (p == q) {
+                                I ds = (I)dst_stride[p], ss = (I)src_stride[p], n = (I)shape[p];
+                                if (ds == 1 && ss == 1) std::memcpy(d, s, n * sizeof(data_t));
+                                else for (I i = 0; i < n; ++i) d[i * ds] = s[i * ss];
+                            }
+                            else {
+                                transpose_strided<I>(d, (I)dst_stride[p], (I)dst_stride[q],
+                                    s, (I)src_stride[p], (I)src_stride[q], (I)shape[p], (I)shape[q]);
+                            }
+                        }
+                    });
+            }
+
+        }
+
+        bool fits_int32(const index_t* shape, const index_t* stride, index_t n_dim) {
+            index_t reach = 0;
+            for (index_t i = 0; i < n_dim; ++i) {
+                if (shape[i] == 0) return true;
+                reach += (shape[i] - 1) * std::llabs(stride[i]);
+            }
+            return reach <= std::numeric_limits<index32_t>::max();
+        }
+
+        bool dense(const index_t* stride, const index_t* shape, index_t n_dim) {
+            std::vector<index_t> order;
+            for (index_t i = 0; i < n_dim; ++i) {
+                if (shape[i] == 0) return true;
+                if (shape[i] != 1) order.push_back(i);
+            }
+            std::sort(order.begin(), order.end(), [&](index_t a, index_t b) { return stride[a] < stride[b]; });
+            index_t expect = 1;
+            for (index_t i : order) {
+                if (stride[i] != expect) return false;
+                expect *= shape[i];
+            }
+            return true;
+        }
+
+        void transpose(data_t* dst, index_t dst_stride, const data_t* src, index_t src_stride,
+            index_t rows, index_t cols) {
+            index_t shape[] = { rows, cols }, ds[] = { 1, dst_stride }, ss[] = { src_stride, 1 };
+            if (fits_int32(shape, ds, 2) && fits_int32(shape, ss, 2))
+                transpose_strided<index32_t>(dst, 1, (index32_t)dst_stride, src, (index32_t)src_stride, 1,
+                    (index32_t)rows, (index32_t)cols);
+            else
+                transpose_strided<index_t>(dst, 1, dst_stride, src, src_stride, 1, rows, cols);
+        }
+
+        void copy(data_t* dst, const index_t* dst_stride, const data_t* src, const index_t* src_stride,
+            const index_t* shape, index_t n_dim) {
+            index_t total = 1;
+            for (index_t i = 0; i < n_dim; ++i) total *= shape[i];
+            if (total == 0) return;
+            index_t p = fastest(dst_stride, shape, n_dim);
+            if (p == n_dim) {
+                *dst = *src;
+                return;
+            }
+            index_t q = fastest(src_stride, shape, n_dim);
+
+            bool same = true;
+            for (index_t i = 0; i < n_dim; ++i)
+                if (shape[i] != 1 && dst_stride[i] != src_stride[i]) same = false;
+            if (same && dense(dst_stride, shape, n_dim)) {
+                std::memcpy(dst, src, total * sizeof(data_t));
+                return;
+            }
+
+            std::vector<index_t> outer;
+            for (index_t i = 0; i < n_dim; ++i)
+                if (i != p && i != q && shape[i] != 1) outer.push_back(i);
+            index_t inner = p == q ? shape[p] : shape[p] * shape[q];
+            index_t n_outer = total / inner;
+
+            if (total <= std::numeric_limits<index32_t>::max()
+                && fits_int32(shape, dst_stride, n_dim) && fits_int32(shape, src_stride, n_dim))
+                copy_outer<index32_t>(dst, dst_stride, src, src_stride, shape, outer, p, q, n_outer, inner);
+            else
+                copy_outer<index_t>(dst, dst_stride, src, src_stride, shape, outer, p, q, n_outer, inner);
+        }
+
+    }
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+namespace keith {
+
+    // Copies between arbitrarily strided views of the same shape. When both
+    // sides are dense with the same strides the copy is a single memcpy; when the
+    // fastest dimension of the source differs from that of the destination the
+    // two dimensions are walked in cache-sized blocks of small square tiles so
+    // that both sides stay resident in L1 and the TLB. Strides may be negative.
+    // Offsets are computed in 32 bits whenever both views fit.
+    namespace strided {
+
+        constexpr index_t tile = 8;
+
+        // True when every element of the view lies within 2^31 - 1 elements
+        // of its first one.
+        bool fits_int32(const index_t* shape, const index_t* stride, index_t n_dim);
+
+        // True when the view covers one block of memory exactly once, in any
+        // order of its dimensions and with positive strides.
+        bool dense(const index_t* stride, const index_t* shape, index_t n_dim);
+
+        void copy(data_t* dst, const index_t* dst_stride,
+            const data_t* src, const index_t* src_stride,
+            const index_t* shape, index_t n_dim);
+
+        void transpose(data_t* dst, index_t dst_stride,
+            const data_t* src, index_t src_stride,
+            index_t rows, index_t cols);
+
+    }
+
+}
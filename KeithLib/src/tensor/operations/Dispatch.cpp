@@ -0,0 +1,192 @@
+#include "Dispatch.h"
+#include "Copy.h"
+
+#include <cstdlib>
+#include <sstream>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace keith {
+
+    namespace dispatch {
+
+        namespace {
+
+            bool dense(const index_t* stride, const index_t* shape, index_t n_dim) {
+                index_t expect = 1;
+                for (index_t i = n_dim - 1; i >= 0; --i) {
+                    if (shape[i] == 1) continue;
+                    if (stride[i] != expect) return false;
+                    expect *= shape[i];
+                }
+                return true;
+            }
+
+            Isa detect() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+                int info[4];
+                __cpuid(info, 0);
+                if (info[0] < 7) return Isa::Generic;
+                __cpuid(info, 1);
+                bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+                if (!os_avx) return Isa::Generic;
+                unsigned long long xcr0 = _xgetbv(0);
+                __cpuidex(info, 7, 0);
+                if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0) return Isa::Avx512;
+                if ((xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0) return Isa::Avx2;
+                return Isa::Generic;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx512f")) return Isa::Avx512;
+                if (__builtin_cpu_supports("avx2")) return Isa::Avx2;
+                return Isa::Generic;
+#else
+                return Isa::Generic;
+#endif
+            }
+
+            std::string key_of(const std::string& op, DType dtype, Layout layout) {
+                return op + '/' + std::to_string((int)dtype) + '/' + std::to_string((int)layout);
+            }
+
+        }
+
+        // Operands that all share the output's strides are walked as flat
+        // memory too when the output is dense in some other order, such as
+        // channels-last.
+        Layout classify(const Args& args) {
+            bool contiguous = dense(args.out_stride, args.shape, args.n_dim);
+            bool matched = !contiguous && strided::dense(args.out_stride, args.shape, args.n_dim);
+            bool broadcast = false;
+            index_t scalar = -1, scalars = 0;
+            for (index_t k = 0; k < args.n_in; ++k) {
+                bool any = false, all = true;
+                for (index_t d = 0; d < args.n_dim; ++d) {
+                    if (args.shape[d] == 1) continue;
+                    if (args.in_stride[k][d] == 0) any = true;
+                    else all = false;
+                }
+                if (any && all) {
+                    scalar = k;
+                    ++scalars;
+                }
+                else if (any) broadcast = true;
+                else {
+                    contiguous = contiguous && dense(args.in_stride[k], args.shape, args.n_dim);
+                    for (index_t d = 0; d < args.n_dim; ++d)
+                        if (args.shape[d] != 1 && args.in_stride[k][d] != args.out_stride[d]) matched = false;
+                }
+            }
+            contiguous = contiguous || matched;
+            if (scalars == 1 && args.n_in == 2 && !broadcast && contiguous)
+                return scalar == 0 ? Layout::ScalarLhs : Layout::ScalarRhs;
+            if (broadcast || scalar >= 0) return Layout::Broadcast;
+            return contiguous ? Layout::Contiguous : Layout::Strided;
+        }
+
+        Isa host_isa() {
+            static const Isa isa = detect();
+            return isa;
+        }
+
+        const char* name(Layout layout) {
+            switch (layout) {
+            case Layout::Contiguous: return "contiguous";
+            case Layout::Strided: return "strided";
+            case Layout::Broadcast: return "broadcast";
+            case Layout::ScalarLhs: return "scalar-lhs";
+            case Layout::ScalarRhs: return "scalar-rhs";
+            }
+            return "";
+        }
+
+        const char* name(Isa isa) {
+            switch (isa) {
+            case Isa::Generic: return "generic";
+            case Isa::Avx2: return "avx2";
+            case Isa::Avx512: return "avx512";
+            }
+            return "";
+        }
+
+        Registry& Registry::self() {
+            static Registry registry;
+            return registry;
+        }
+
+        Registry::Registry() : isa_(host_isa()) {
+            if (const char* env = std::getenv("KEITH_ISA")) {
+                for (Isa isa : { Isa::Generic, Isa::Avx2, Isa::Avx512 })
+                    if (name(isa) == std::string(env) && isa < isa_) isa_ = isa;
+            }
+            if (const char* env = std::getenv("KEITH_KERNELS")) {
+                std::stringstream list(env);
+                std::string item;
+                while (std::getline(list, item, ',')) {
+                    auto colon = item.find(':');
+                    if (colon != std::string::npos) forced_[item.substr(0, colon)] = item.substr(colon + 1);
+                }
+            }
+        }
+
+        void Registry::add(const std::string& op, DType dtype, Layout layout, Isa isa,
+            const std::string& variant, Kernel kernel) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cache_.clear();
+            for (Entry& e : entries_) {
+                if (e.op == op && e.dtype == dtype && e.layout == layout && e.isa == isa && e.variant == variant) {
+                    e.kernel = kernel;
+                    return;
+                }
+            }
+            entries_.push_back({ op, dtype, layout, isa, variant, kernel });
+        }
+
+        Kernel Registry::find(const std::string& op, DType dtype, Layout layout) {
+            std::string key = key_of(op, dtype, layout);
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = cache_.find(key);
+            if (it != cache_.end()) return it->second;
+            Kernel kernel = resolve(op, dtype, layout);
+            if (kernel == nullptr && layout != Layout::Strided) kernel = resolve(op, dtype, Layout::Strided);
+            cache_.emplace(std::move(key), kernel);
+            return kernel;
+        }
+
+        Kernel Registry::resolve(const std::string& op, DType dtype, Layout layout) const {
+            auto forced = forced_.find(op);
+            if (forced != forced_.end() && forced->second == "eval") return nullptr;
+            const Entry* best = nullptr;
+            for (const Entry& e : entries_) {
+                if (e.op != op || e.dtype != dtype || e.layout != layout || e.isa > isa_) continue;
+                if (forced != forced_.end()) {
+                    if (e.variant == forced->second) best = &e;
+                    continue;
+                }
+                if (best == nullptr || e.isa >= best->isa) best = &e;
+            }
+            return best != nullptr ? best->kernel : nullptr;
+        }
+
+        void Registry::force(const std::string& op, const std::string& variant) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cache_.clear();
+            if (variant.empty()) forced_.erase(op);
+            else forced_[op] = variant;
+        }
+
+        std::vector<std::string> Registry::variants(const std::string& op) const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<std::string> res;
+            for (const Entry& e : entries_) {
+                if (e.op != op) continue;
+                res.push_back(e.variant + " (" + name(e.layout) + ", " + name(e.isa) + ")");
+            }
+            return res;
+        }
+
+    }
+
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+#include "../../utils/ThreadPool.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace keith {
+
+    // Registry of element-wise kernels keyed by (op, dtype, layout, ISA).
+    // A materialization classifies its operands once, asks the registry for
+    // the best kernel the host can run and falls back to per-index `eval` when
+    // nothing is registered. Resolved lookups are cached until the next
+    // registration.
+    //
+    // KEITH_KERNELS forces a variant per op for A/B testing, e.g.
+    // "exp:generic,add:eval", where "eval" disables dispatch for that op.
+    // KEITH_ISA caps the detected instruction set (generic, avx2, avx512).
+    namespace dispatch {
+
+        enum class DType {
+            Float64
+        };
+
+        // ScalarLhs and ScalarRhs are dense operations where that input is a
+        // single value broadcast over the whole output.
+        enum class Layout {
+            Contiguous,
+            Strided,
+            Broadcast,
+            ScalarLhs,
+            ScalarRhs
+        };
+
+        enum class Isa {
+            Generic,
+            Avx2,
+            Avx512
+        };
+
+        // Operands of one element-wise materialization. Inputs are laid out
+        // over the output's shape; broadcast dimensions carry a zero stride.
+        struct Args {
+            data_t* out;
+            const index_t* out_stride;
+            const data_t* in[2];
+            const index_t* in_stride[2];
+            const index_t* shape;
+            index_t n_dim;
+            index_t n_in;
+            index_t size;
+        };
+
+        using Kernel = void(*)(const Args& args);
+
+        Layout classify(const Args& args);
+        Isa host_isa();
+        const char* name(Layout layout);
+        const char* name(Isa isa);
+
+        class Registry
+        {
+        public:
+            static Registry& self();
+
+            // A later registration with the same key and variant name replaces
+            // the earlier one.
+            void add(const std::string& op, DType dtype, Layout layout, Isa isa,
+                const std::string& variant, Kernel kernel);
+            // Best kernel for the key, or nullptr to fall back to eval. Other
+            // layouts fall back to strided kernels.
+            [[nodiscard]] Kernel find(const std::string& op, DType dtype, Layout layout);
+            // Same as one entry of KEITH_KERNELS; an empty variant clears it.
+            void force(const std::string& op, const std::string& variant);
+            [[nodiscard]] std::vector<std::string> variants(const std::string& op) const;
+        private:
+            Registry();
+            Registry(const Registry& other) = delete;
+            Registry& operator=(const Registry& other) = delete;
+
+            struct Entry {
+                std::string op;
+                DType dtype;
+                Layout layout;
+                Isa isa;
+                std::string variant;
+                Kernel kernel;
+            };
+
+            Kernel resolve(const std::string& op, DType dtype, Layout layout) const;
+
+            mutable std::mutex mutex_;
+            std::vector<Entry> entries_;
+            std::unordered_map<std::string, std::string> forced_;
+            std::unordered_map<std::string, Kernel> cache_;
+            Isa isa_;
+        };
+
+        struct Registrar {
+            Registrar(const std::string& op, DType dtype, Layout layout, Isa isa,
+                const std::string& variant, Kernel kernel) {
+                Registry::self().add(op, dtype, layout, isa, variant, kernel);
+            }
+        };
+
+        // Walks the output row by row along its innermost dimension, in
+        // parallel. `row(out, out_step, in, in_step, n)` receives the first
+        // element of each row on every operand and the innermost strides.
+        template<typename Row>
+        void for_each_row(const Args& args, Row row) {
+            index_t last = args.n_dim - 1;
+            index_t n = args.n_dim > 0 ? args.shape[last] : 1;
+            index_t os = args.n_dim > 0 ? args.out_stride[last] : 0;
+            index_t is[2] = { 0, 0 };
+            for (index_t k = 0; k < args.n_in && args.n_dim > 0; ++k) is[k] = args.in_stride[k][last];
+            index_t rows = n == 0 ? 0 : args.size / n;
+            ThreadPool::self().parallel_for(0, rows, std::max<index_t>((1 << 14) / std::max<index_t>(n, 1), 1),
+                [&](index_t begin, index_t end) {
+                    for (index_t r = begin; r < end; ++r) {
+                        index_t rem = r, o_off = 0, i_off[2] = { 0, 0 };
+                        for (index_t d = last - 1; d >= 0; --d) {
+                            index_t v = rem % args.shape[d];
+                            rem /= args.shape[d];
+                            o_off += v * args.out_stride[d];
+                            for (index_t k = 0; k < args.n_in; ++k) i_off[k] += v * args.in_stride[k][d];
+                        }
+                        const data_t* in[2] = { args.in[0] + i_off[0], args.n_in > 1 ? args.in[1] + i_off[1] : nullptr };
+                        row(args.out + o_off, os, in, is, n);
+                    }
+                });
+        }
+
+    }
+
+}
@@ -0,0 +1,368 @@
+#include "Einsum.h"
+#include "Copy.h"
+#include "Gemm.h"
+#include "../Exception.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <memory>
+
+namespace keith {
+
+    namespace contraction {
+
+        namespace {
+
+            constexpr index_t grain = 1 << 14;
+
+            struct Spec {
+                std::vector<std::string> inputs;
+                std::string output;
+                index_t sizes[128];
+            };
+
+            // A label string per operand with repeated labels merged; the
+            // diagonal is walked with the sum of their strides.
+            struct Term {
+                std::string labels;
+                std::vector<index_t> stride;
+                const data_t* data;
+                std::shared_ptr<std::vector<data_t>> own;
+            };
+
+            inline bool has(const std::string& labels, char c) {
+                return labels.find(c) != std::string::npos;
+            }
+
+            index_t volume(const std::string& labels, const index_t* sizes) {
+                index_t res = 1;
+                for (char c : labels) res *= sizes[(int)c];
+                return res;
+            }
+
+            std::string unique(const std::string& labels) {
+                std::string res;
+                for (char c : labels)
+                    if (!has(res, c)) res += c;
+                return res;
+            }
+
+            Spec parse(const std::string& equation, const std::vector<Operand>& operands) {
+                Spec spec;
+                std::fill_n(spec.sizes, 128, -1);
+                std::string eq;
+                for (char c : equation)
+                    if (c != ' ') eq += c;
+                std::string::size_type arrow = eq.find("->");
+                std::string lhs = eq.substr(0, arrow);
+                std::string::size_type start = 0;
+                while (true) {
+                    std::string::size_type comma = lhs.find(',', start);
+                    spec.inputs.push_back(lhs.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+                    if (comma == std::string::npos) break;
+                    start = comma + 1;
+                }
+                CHECK_EQUAL((index_t)spec.inputs.size(), (index_t)operands.size(),
+                    "einsum() equation has %lld operands, but got %lld", (index_t)spec.inputs.size(), (index_t)operands.size());
+
+                index_t count[128] = {};
+                for (index_t t = 0; t < (index_t)operands.size(); ++t) {
+                    const std::string& labels = spec.inputs[t];
+                    CHECK_EQUAL((index_t)labels.size(), operands[t].n_dim,
+                        "einsum() operand %lld has %lld dimensions, but the equation gives it %lld labels",
+                        t, operands[t].n_dim, (index_t)labels.size());
+                    for (index_t d = 0; d < (index_t)labels.size(); ++d) {
+                        char c = labels[d];
+                        CHECK_TRUE(std::isalpha((unsigned char)c), "einsum() labels must be letters, but got '%c'", c);
+                        index_t n = operands[t].shape[d];
+                        CHECK_TRUE(spec.sizes[(int)c] < 0 || spec.sizes[(int)c] == n,
+                            "einsum() label '%c' has size %lld in one place and %lld in another", c, spec.sizes[(int)c], n);
+                        spec.sizes[(int)c] = n;
+                        ++count[(int)c];
+                    }
+                }
+
+                if (arrow == std::string::npos) {
+                    for (int c = 0; c < 128; ++c)
+                        if (count[c] == 1) spec.output += (char)c;
+                }
+                else {
+                    spec.output = eq.substr(arrow + 2);
+                    for (char c : spec.output) {
+                        CHECK_TRUE(std::isalpha((unsigned char)c) && count[(int)c] > 0,
+                            "einsum() output label '%c' does not appear in any operand", c);
+                        CHECK_TRUE(spec.output.find(c) == spec.output.rfind(c),
+                            "einsum() output label '%c' appears more than once", c);
+                    }
+                }
+                return spec;
+            }
+
+            Term from_operand(const Operand& op, const std::string& labels) {
+                Term t;
+                t.data = op.data;
+                for (index_t d = 0; d < op.n_dim; ++d) {
+                    std::string::size_type pos = t.labels.find(labels[d]);
+                    if (pos == std::string::npos) {
+                        t.labels += labels[d];
+                        t.stride.push_back(op.stride[d]);
+                    }
+                    else {
+                        t.stride[pos] += op.stride[d];
+                    }
+                }
+                return t;
+            }
+
+            // Labels every step after contracting terms i and j still needs.
+            std::string keep_for(const std::vector<std::string>& terms, index_t i, index_t j, const std::string& output) {
+                std::string keep = output;
+                for (index_t t = 0; t < (index_t)terms.size(); ++t)
+                    if (t != i && t != j) keep += terms[t];
+                return keep;
+            }
+
+            std::string joined(const std::string& a, const std::string& b, const std::string& keep) {
+                std::string res;
+                for (char c : a + b)
+                    if (has(keep, c) && !has(res, c)) res += c;
+                return res;
+            }
+
+            void search(const std::vector<std::string>& terms, const std::string& output, const index_t* sizes,
+                index_t cost, std::vector<std::pair<index_t, index_t>>& steps, Plan& best) {
+                if (cost >= best.flops) return;
+                if (terms.size() == 1) {
+                    best.flops = cost;
+                    best.steps = steps;
+                    return;
+                }
+                index_t n = (index_t)terms.size();
+                for (index_t i = 0; i < n; ++i)
+                    for (index_t j = i + 1; j < n; ++j) {
+                        std::string keep = keep_for(terms, i, j, output);
+                        std::vector<std::string> next;
+                        for (index_t t = 0; t < n; ++t)
+                            if (t != i && t != j) next.push_back(terms[t]);
+                        next.push_back(joined(terms[i], terms[j], keep));
+                        steps.emplace_back(i, j);
+                        search(next, output, sizes, cost + volume(unique(terms[i] + terms[j]), sizes), steps, best);
+                        steps.pop_back();
+                    }
+            }
+
+            Plan greedy(std::vector<std::string> terms, const std::string& output, const index_t* sizes) {
+                Plan res{ {}, 0 };
+                while (terms.size() > 1) {
+                    index_t n = (index_t)terms.size(), bi = 0, bj = 1;
+                    index_t best_cost = std::numeric_limits<index_t>::max(), best_size = 0;
+                    for (index_t i = 0; i < n; ++i)
+                        for (index_t j = i + 1; j < n; ++j) {
+                            index_t cost = volume(unique(terms[i] + terms[j]), sizes);
+                            index_t size = volume(joined(terms[i], terms[j], keep_for(terms, i, j, output)), sizes);
+                            if (cost < best_cost || (cost == best_cost && size < best_size)) {
+                                best_cost = cost;
+                                best_size = size;
+                                bi = i;
+                                bj = j;
+                            }
+                        }
+                    std::string result = joined(terms[bi], terms[bj], keep_for(terms, bi, bj, output));
+                    terms.erase(terms.begin() + bj);
+                    terms.erase(terms.begin() + bi);
+                    terms.push_back(result);
+                    res.steps.emplace_back(bi, bj);
+                    res.flops += best_cost;
+                }
+                return res;
+            }
+
+            Plan plan_terms(const std::vector<std::string>& terms, const std::string& output, const index_t* sizes) {
+                if ((index_t)terms.size() > optimal_max) return greedy(terms, output, sizes);
+                Plan best{ {}, std::numeric_limits<index_t>::max() };
+                std::vector<std::pair<index_t, index_t>> steps;
+                search(terms, output, sizes, 0, steps, best);
+                return best;
+            }
+
+            std::vector<std::string> term_labels(const Spec& spec) {
+                std::vector<std::string> res;
+                for (const std::string& labels : spec.inputs) res.push_back(unique(labels));
+                return res;
+            }
+
+            // Elements copied to lay `t` out densely in `order`; zero when it
+            // already is.
+            index_t copies(const Term& t, const std::string& order, const index_t* sizes) {
+                index_t expect = 1;
+                for (index_t i = (index_t)order.size() - 1; i >= 0; --i) {
+                    index_t n = sizes[(int)order[i]];
+                    if (n == 1) continue;
+                    if (t.stride[t.labels.find(order[i])] != expect) return volume(order, sizes);
+                    expect *= n;
+                }
+                return 0;
+            }
+
+            Term fresh(const std::string& labels, const index_t* sizes) {
+                Term t;
+                t.labels = labels;
+                t.stride.resize(labels.size());
+                index_t expect = 1;
+                for (index_t i = (index_t)labels.size() - 1; i >= 0; --i) {
+                    t.stride[i] = expect;
+                    expect *= sizes[(int)labels[i]];
+                }
+                t.own = std::make_shared<std::vector<data_t>>(expect);
+                t.data = t.own->data();
+                return t;
+            }
+
+            Term arrange(const Term& t, const std::string& order, const index_t* sizes) {
+                if (copies(t, order, sizes) == 0) {
+                    Term res = t;
+                    res.labels = order;
+                    for (index_t i = 0; i < (index_t)order.size(); ++i) res.stride[i] = t.stride[t.labels.find(order[i])];
+                    return res;
+                }
+                Term res = fresh(order, sizes);
+                std::vector<index_t> shape(order.size()), stride(order.size());
+                for (index_t i = 0; i < (index_t)order.size(); ++i) {
+                    shape[i] = sizes[(int)order[i]];
+                    stride[i] = t.stride[t.labels.find(order[i])];
+                }
+                strided::copy(res.own->data(), res.stride.data(), t.data, stride.data(), shape.data(), (index_t)order.size());
+                return res;
+            }
+
+            // Sums out every label of `t` that is not in `keep`.
+            Term reduce(const Term& t, const std::string& keep, const index_t* sizes) {
+                std::string kept, summed;
+                for (char c : t.labels) (has(keep, c) ? kept : summed) += c;
+                if (summed.empty()) return t;
+                Term src = arrange(t, kept + summed, sizes);
+                Term res = fresh(kept, sizes);
+                index_t rows = volume(kept, sizes), len = volume(summed, sizes);
+                const data_t* x = src.data;
+                data_t* y = res.own->data();
+                ThreadPool::self().parallel_for(0, rows, std::max<index_t>(grain / std::max<index_t>(len, 1), 1),
+                    [&](index_t begin, index_t end) {
+                        for (index_t r = begin; r < end; ++r) {
+                            data_t acc = 0;
+                            for (index_t i = 0; i < len; ++i) acc += x[r * len + i];
+                            y[r] = acc;
+                        }
+                    });
+                return res;
+            }
+
+            Term multiply(const Term& lhs, const Term& rhs, const std::string& keep, const index_t* sizes) {
+                Term a = reduce(lhs, keep + rhs.labels, sizes);
+                Term b = reduce(rhs, keep + a.labels, sizes);
+
+                // Orders for (first, second) taken from first's label order.
+                struct Layout {
+                    std::string batch, m, k, n;
+                };
+                auto layout = [&](const Term& first, const Term& second) {
+                    Layout l;
+                    for (char c : first.labels) {
+                        if (!has(second.labels, c)) l.m += c;
+                        else if (has(keep, c)) l.batch += c;
+                        else l.k += c;
+                    }
+                    for (char c : second.labels)
+                        if (!has(first.labels, c)) l.n += c;
+                    return l;
+                };
+                Layout ab = layout(a, b), ba = layout(b, a);
+                index_t cost_ab = copies(a, ab.batch + ab.m + ab.k, sizes) + copies(b, ab.batch + ab.k + ab.n, sizes);
+                index_t cost_ba = copies(b, ba.batch + ba.m + ba.k, sizes) + copies(a, ba.batch + ba.k + ba.n, sizes);
+                const Term& first = cost_ba < cost_ab ? b : a;
+                const Term& second = cost_ba < cost_ab ? a : b;
+                const Layout& l = cost_ba < cost_ab ? ba : ab;
+
+                Term x = arrange(first, l.batch + l.m + l.k, sizes);
+                Term y = arrange(second, l.batch + l.k + l.n, sizes);
+                Term res = fresh(l.batch + l.m + l.n, sizes);
+                index_t batch = volume(l.batch, sizes), m = volume(l.m, sizes), n = volume(l.n, sizes), k = volume(l.k, sizes);
+                const data_t* xd = x.data;
+                const data_t* yd = y.data;
+                data_t* c = res.own->data();
+                if (l.k.empty()) {
+                    ThreadPool::self().parallel_for(0, batch * m, std::max<index_t>(grain / std::max<index_t>(n, 1), 1),
+                        [&](index_t begin, index_t end) {
+                            for (index_t r = begin; r < end; ++r) {
+                                data_t v = xd[r];
+                                const data_t* yr = yd + r / std::max<index_t>(m, 1) * n;
+                                for (index_t j = 0; j < n; ++j) c[r * n + j] = v * yr[j];
+                            }
+                        });
+                }
+                else if (m == 1 && n == 1) {
+                    ThreadPool::self().parallel_for(0, batch, std::max<index_t>(grain / std::max<index_t>(k, 1), 1),
+                        [&](index_t begin, index_t end) {
+                            for (index_t r = begin; r < end; ++r) {
+                                data_t acc = 0;
+                                for (index_t p = 0; p < k; ++p) acc += xd[r * k + p] * yd[r * k + p];
+                                c[r] = acc;
+                            }
+                        });
+                }
+                else {
+                    gemm::run(xd, yd, c, m, n, k, batch);
+                }
+                return res;
+            }
+
+        }
+
+        Plan plan(const std::string& equation, const std::vector<Operand>& operands) {
+            Spec spec = parse(equation, operands);
+            return plan_terms(term_labels(spec), spec.output, spec.sizes);
+        }
+
+        std::vector<index_t> output_shape(const std::string& equation, const std::vector<Operand>& operands) {
+            Spec spec = parse(equation, operands);
+            std::vector<index_t> shape;
+            for (char c : spec.output) shape.push_back(spec.sizes[(int)c]);
+            return shape;
+        }
+
+        void contract(const std::string& equation, const std::vector<Operand>& operands, data_t* out) {
+            Spec spec = parse(equation, operands);
+            std::vector<std::string> labels = term_labels(spec);
+            std::vector<Term> terms;
+            for (index_t t = 0; t < (index_t)operands.size(); ++t) terms.push_back(from_operand(operands[t], spec.inputs[t]));
+
+            Plan p = plan_terms(labels, spec.output, spec.sizes);
+            for (const auto& step : p.steps) {
+                index_t i = step.first, j = step.second;
+                Term res = multiply(terms[i], terms[j], keep_for(labels, i, j, spec.output), spec.sizes);
+                terms.erase(terms.begin() + j);
+                terms.erase(terms.begin() + i);
+                labels.erase(labels.begin() + j);
+                labels.erase(labels.begin() + i);
+                labels.push_back(res.labels);
+                terms.push_back(std::move(res));
+            }
+
+            Term last = reduce(terms[0], spec.output, spec.sizes);
+            index_t n_dim = (index_t)spec.output.size();
+            std::vector<index_t> shape(n_dim), src_stride(n_dim), dst_stride(n_dim);
+            index_t expect = 1;
+            for (index_t i = n_dim - 1; i >= 0; --i) {
+                char c = spec.output[i];
+                shape[i] = spec.sizes[(int)c];
+                src_stride[i] = last.stride[last.labels.find(c)];
+                dst_stride[i] = expect;
+                expect *= shape[i];
+            }
+            strided::copy(out, dst_stride.data(), last.data, src_stride.data(), shape.data(), n_dim);
+        }
+
+    }
+
+}
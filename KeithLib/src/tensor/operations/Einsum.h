@@ -0,0 +1,50 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace keith {
+
+    // Einstein summation over strided operands. Equations use one letter per
+    // dimension, e.g. "bij,bjk->bik"; without "->" the output holds the labels
+    // that appear once, in alphabetical order. A label repeated within one
+    // operand takes its diagonal. Operands are contracted two at a time in the
+    // order with the fewest multiply-adds: exhaustively for up to
+    // `optimal_max` operands, greedily beyond that. Each pairwise step first
+    // sums out labels no later step needs, then permutes both sides into
+    // (batch, free, contracted) order, copying only when that order is not
+    // already dense, and runs a batched GEMM. Steps with nothing to contract
+    // are element-wise products and steps with no free labels are dot
+    // products, neither of which goes through the GEMM.
+    namespace contraction {
+
+        constexpr index_t optimal_max = 6;
+
+        struct Operand {
+            const data_t* data;
+            const index_t* shape;
+            const index_t* stride;
+            index_t n_dim;
+        };
+
+        // Pairs of positions in the current operand list; each step removes
+        // both and appends their product.
+        struct Plan {
+            std::vector<std::pair<index_t, index_t>> steps;
+            index_t flops;
+        };
+
+        // Only the shapes of the operands are read.
+        [[nodiscard]] Plan plan(const std::string& equation, const std::vector<Operand>& operands);
+        [[nodiscard]] std::vector<index_t> output_shape(const std::string& equation, const std::vector<Operand>& operands);
+
+        // Writes the result densely into `out`, which has output_shape().
+        void contract(const std::string& equation, const std::vector<Operand>& operands, data_t* out);
+
+    }
+
+}
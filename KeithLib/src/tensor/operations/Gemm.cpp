@@ -0,0 +1,135 @@
+#include "Gemm.h"
+#include "MathFunctions.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+
+namespace keith {
+
+    namespace gemm {
+
+        namespace {
+
+            constexpr index_t mc = 64;
+            constexpr index_t nc = 256;
+            constexpr index_t kc = 256;
+
+            constexpr data_t sqrt1_2 = 0.70710678118654752440;
+
+            // Rows [i0, i1) of C over columns [j0, j1) hold their final product.
+            void finish(data_t* c, const data_t* residual, index_t n,
+                index_t i0, index_t i1, index_t j0, index_t j1, const Epilogue& e) {
+                index_t len = j1 - j0;
+                for (index_t i = i0; i < i1; ++i) {
+                    data_t* ci = c + i * n + j0;
+                    if (e.bias != nullptr) {
+                        const data_t* bias = e.bias + j0;
+                        for (index_t j = 0; j < len; ++j) ci[j] = e.alpha * ci[j] + bias[j];
+                    }
+                    else if (e.alpha != 1) {
+                        for (index_t j = 0; j < len; ++j) ci[j] *= e.alpha;
+                    }
+                    switch (e.activation) {
+                    case Activation::None: break;
+                    case Activation::ReLU:
+                        for (index_t j = 0; j < len; ++j) ci[j] = ci[j] < 0 ? 0 : ci[j];
+                        break;
+                    case Activation::GELU:
+                        for (index_t j = 0; j < len; ++j) ci[j] = 0.5 * ci[j] * (1 + vmath::erf(ci[j] * sqrt1_2));
+                        break;
+                    case Activation::Sigmoid: vmath::sigmoid(ci, ci, len); break;
+                    case Activation::Tanh: vmath::tanh(ci, ci, len); break;
+                    }
+                    if (residual != nullptr) {
+                        const data_t* ri = residual + i * n + j0;
+                        for (index_t j = 0; j < len; ++j) ci[j] += ri[j];
+                    }
+                }
+            }
+
+            // Rows are lda, ldb and ldc apart; alpha scales each element of A
+            // as it is loaded.
+            void tile(const data_t* a, index_t lda, const data_t* b, index_t ldb, data_t* c, index_t ldc,
+                index_t k, data_t alpha, index_t i0, index_t i1, index_t j0, index_t j1, bool accumulate,
+                const Epilogue* epilogue, const data_t* residual) {
+                if (!accumulate)
+                    for (index_t i = i0; i < i1; ++i) std::fill(c + i * ldc + j0, c + i * ldc + j1, 0);
+                if (k == 0 && epilogue != nullptr) finish(c, residual, ldc, i0, i1, j0, j1, *epilogue);
+                for (index_t p0 = 0; p0 < k; p0 += kc) {
+                    index_t p1 = std::min(k, p0 + kc);
+                    const Epilogue* last = p1 == k ? epilogue : nullptr;
+                    index_t i = i0;
+                    for (; i + 4 <= i1; i += 4) {
+                        data_t* c0 = c + i * ldc;
+                        data_t* c1 = c0 + ldc;
+                        data_t* c2 = c1 + ldc;
+                        data_t* c3 = c2 + ldc;
+                        for (index_t p = p0; p < p1; ++p) {
+                            data_t a0 = alpha * a[i * lda + p], a1 = alpha * a[(i + 1) * lda + p];
+                            data_t a2 = alpha * a[(i + 2) * lda + p], a3 = alpha * a[(i + 3) * lda + p];
+                            const data_t* bp = b + p * ldb;
+                            for (index_t j = j0; j < j1; ++j) {
+                                data_t bv = bp[j];
+                                c0[j] += a0 * bv;
+                                c1[j] += a1 * bv;
+                                c2[j] += a2 * bv;
+                                c3[j] += a3 * bv;
+                            }
+                        }
+                        if (last != nullptr) finish(c, residual, ldc, i, i + 4, j0, j1, *last);
+                    }
+                    for (; i < i1; ++i) {
+                        data_t* ci = c + i * ldc;
+                        for (index_t p = p0; p < p1; ++p) {
+                            data_t av = alpha * a[i * lda + p];
+                            const data_t* bp = b + p * ldb;
+                            for (index_t j = j0; j < j1; ++j) ci[j] += av * bp[j];
+                        }
+                        if (last != nullptr) finish(c, residual, ldc, i, i + 1, j0, j1, *last);
+                    }
+                }
+            }
+
+            void run_tiles(const data_t* a, const data_t* b, data_t* c,
+                index_t m, index_t n, index_t k, index_t batch, bool accumulate, const Epilogue* epilogue) {
+                index_t mt = (m + mc - 1) / mc, nt = (n + nc - 1) / nc;
+                index_t per_batch = mt * nt;
+                ThreadPool::self().parallel_for(0, batch * per_batch, 1, [&](index_t begin, index_t end) {
+                    for (index_t t = begin; t < end; ++t) {
+                        index_t bi = t / per_batch, r = t % per_batch;
+                        index_t i0 = r / nt * mc, j0 = r % nt * nc;
+                        const data_t* residual = epilogue != nullptr && epilogue->residual != nullptr
+                            ? epilogue->residual + bi * m * n : nullptr;
+                        tile(a + bi * m * k, k, b + bi * k * n, n, c + bi * m * n, n, k, 1,
+                            i0, std::min(m, i0 + mc), j0, std::min(n, j0 + nc), accumulate, epilogue, residual);
+                    }
+                });
+            }
+
+        }
+
+        void run(const data_t* a, const data_t* b, data_t* c,
+            index_t m, index_t n, index_t k, index_t batch, bool accumulate) {
+            run_tiles(a, b, c, m, n, k, batch, accumulate, nullptr);
+        }
+
+        void run(const data_t* a, const data_t* b, data_t* c,
+            index_t m, index_t n, index_t k, index_t batch, const Epilogue& epilogue) {
+            run_tiles(a, b, c, m, n, k, batch, false, &epilogue);
+        }
+
+        void update(const data_t* a, index_t lda, const data_t* b, index_t ldb, data_t* c, index_t ldc,
+            index_t m, index_t n, index_t k, data_t alpha) {
+            index_t mt = (m + mc - 1) / mc, nt = (n + nc - 1) / nc;
+            ThreadPool::self().parallel_for(0, mt * nt, 1, [&](index_t begin, index_t end) {
+                for (index_t t = begin; t < end; ++t) {
+                    index_t i0 = t / nt * mc, j0 = t % nt * nc;
+                    tile(a, lda, b, ldb, c, ldc, k, alpha,
+                        i0, std::min(m, i0 + mc), j0, std::min(n, j0 + nc), true, nullptr, nullptr);
+                }
+            });
+        }
+
+    }
+
+}
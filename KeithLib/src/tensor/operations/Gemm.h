@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+namespace keith {
+
+    // General matrix multiply over row-major buffers, C = A * B with A of
+    // (m, k), B of (k, n) and C of (m, n), repeated for `batch` consecutive
+    // matrices. C is split into tiles that are computed in parallel; each
+    // tile walks k in panels and updates four rows of C per pass so one row
+    // of B is loaded for four multiply-adds.
+    namespace gemm {
+
+        enum class Activation { None, ReLU, GELU, Sigmoid, Tanh };
+
+        // Work folded into the GEMM as it writes C, applied to each block of
+        // rows right after its last k panel while the block is still in
+        // cache: C = activation(alpha * A * B + bias) + residual. `bias` has
+        // n entries shared by every row and batch; `residual` is laid out
+        // like C and must not alias it.
+        struct Epilogue {
+            data_t alpha = 1;
+            const data_t* bias = nullptr;
+            Activation activation = Activation::None;
+            const data_t* residual = nullptr;
+        };
+
+        void run(const data_t* a, const data_t* b, data_t* c,
+            index_t m, index_t n, index_t k, index_t batch = 1, bool accumulate = false);
+        void run(const data_t* a, const data_t* b, data_t* c,
+            index_t m, index_t n, index_t k, index_t batch, const Epilogue& epilogue);
+
+        // C += alpha * A * B on sub-matrices of larger row-major buffers whose
+        // rows are lda, ldb and ldc elements apart; the trailing update of the
+        // blocked factorizations.
+        void update(const data_t* a, index_t lda, const data_t* b, index_t ldb, data_t* c, index_t ldc,
+            index_t m, index_t n, index_t k, data_t alpha);
+
+        // Multiply-adds for one product, used to order chains of products.
+        [[nodiscard]] inline index_t cost(index_t m, index_t n, index_t k) { return m * n * k; }
+
+    }
+
+}
@@ -0,0 +1,127 @@
+#include "Indexing.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+namespace keith {
+
+    namespace indexing {
+
+        namespace {
+
+            constexpr index_t grain = 1 << 14;
+            constexpr index_t mask_block = 1 << 16;
+            constexpr index_t col_tile = 256;
+
+        }
+
+        void cat(const std::vector<const data_t*>& srcs, const std::vector<index_t>& widths,
+            data_t* dst, index_t outer) {
+            index_t n_parts = (index_t)srcs.size(), row = 0;
+            std::vector<index_t> begin(n_parts);
+            for (index_t p = 0; p < n_parts; ++p) {
+                begin[p] = row;
+                row += widths[p];
+            }
+            if (row == 0) return;
+            ThreadPool::self().parallel_for(0, outer * n_parts, std::max<index_t>(grain * n_parts / row, 1),
+                [&](index_t lo, index_t hi) {
+                    for (index_t t = lo; t < hi; ++t) {
+                        index_t o = t / n_parts, p = t % n_parts;
+                        std::memcpy(dst + o * row + begin[p], srcs[p] + o * widths[p], widths[p] * sizeof(data_t));
+                    }
+                });
+        }
+
+        void index_select(const data_t* src, const index_t* index, index_t n_index, data_t* dst,
+            index_t outer, index_t n, index_t inner) {
+            ThreadPool::self().parallel_for(0, outer * n_index, std::max<index_t>(grain / inner, 1),
+                [&](index_t lo, index_t hi) {
+                    for (index_t t = lo; t < hi; ++t) {
+                        index_t o = t / n_index, i = t % n_index;
+                        const data_t* s = src + (o * n + index[i]) * inner;
+                        data_t* d = dst + t * inner;
+                        if (inner == 1) *d = *s;
+                        else std::memcpy(d, s, inner * sizeof(data_t));
+                    }
+                });
+        }
+
+        void gather(const data_t* src, const data_t* index, data_t* dst,
+            index_t outer, index_t n, index_t n_index, index_t inner) {
+            ThreadPool::self().parallel_for(0, outer * n_index, std::max<index_t>(grain / inner, 1),
+                [&](index_t lo, index_t hi) {
+                    for (index_t t = lo; t < hi; ++t) {
+                        const data_t* s = src + t / n_index * n * inner;
+                        const data_t* idx = index + t * inner;
+                        data_t* d = dst + t * inner;
+                        for (index_t c = 0; c < inner; ++c)
+                            d[c] = s[(index_t)idx[c] * inner + c];
+                    }
+                });
+        }
+
+        void scatter(data_t* dst, const data_t* index, const data_t* src,
+            index_t outer, index_t n, index_t n_index, index_t inner, bool accumulate) {
+            // Each task owns a tile of columns of one outer slice, so writes never
+            // race even when indices repeat, and repeats resolve in source order.
+            index_t tiles = (inner + col_tile - 1) / col_tile;
+            ThreadPool::self().parallel_for(0, outer * tiles, std::max<index_t>(grain / (n_index * col_tile), 1),
+                [&](index_t lo, index_t hi) {
+                    for (index_t t = lo; t < hi; ++t) {
+                        index_t o = t / tiles, c0 = t % tiles * col_tile;
+                        index_t c1 = std::min(inner, c0 + col_tile);
+                        data_t* d = dst + o * n * inner;
+                        for (index_t i = 0; i < n_index; ++i) {
+                            const data_t* idx = index + (o * n_index + i) * inner;
+                            const data_t* s = src + (o * n_index + i) * inner;
+                            if (accumulate)
+                                for (index_t c = c0; c < c1; ++c) d[(index_t)idx[c] * inner + c] += s[c];
+                            else
+                                for (index_t c = c0; c < c1; ++c) d[(index_t)idx[c] * inner + c] = s[c];
+                        }
+                    }
+                });
+        }
+
+        bool in_range(const data_t* index, index_t size, index_t bound) {
+            std::atomic<bool> ok(true);
+            ThreadPool::self().parallel_for(0, size, grain, [&](index_t lo, index_t hi) {
+                bool good = true;
+                for (index_t i = lo; i < hi; ++i) good &= index[i] >= 0 && index[i] < bound && index[i] == std::floor(index[i]);
+                if (!good) ok = false;
+            });
+            return ok;
+        }
+
+        std::vector<index_t> mask_offsets(const data_t* mask, index_t size) {
+            index_t n_blocks = (size + mask_block - 1) / mask_block;
+            std::vector<index_t> start(n_blocks + 1, 0);
+            ThreadPool::self().parallel_for(0, n_blocks, 1, [&](index_t lo, index_t hi) {
+                for (index_t b = lo; b < hi; ++b) {
+                    index_t end = std::min(size, (b + 1) * mask_block), cnt = 0;
+                    for (index_t i = b * mask_block; i < end; ++i) cnt += mask[i] != 0;
+                    start[b + 1] = cnt;
+                }
+            });
+            for (index_t b = 0; b < n_blocks; ++b) start[b + 1] += start[b];
+            return start;
+        }
+
+        void masked_select(const data_t* src, const data_t* mask, const std::vector<index_t>& offsets,
+            data_t* dst, index_t size) {
+            ThreadPool::self().parallel_for(0, (index_t)offsets.size() - 1, 1, [&](index_t lo, index_t hi) {
+                for (index_t b = lo; b < hi; ++b) {
+                    index_t end = std::min(size, (b + 1) * mask_block), k = offsets[b];
+                    for (index_t i = b * mask_block; i < end; ++i)
+                        if (mask[i] != 0) dst[k++] = src[i];
+                }
+            });
+        }
+
+    }
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+#include <vector>
+
+namespace keith {
+
+    // Bulk concatenation and indexing kernels over contiguous buffers viewed as
+    // (outer, n, inner), operating along the middle dimension. Whole runs of
+    // `inner` elements are moved with memcpy; per-element lookups keep the
+    // index loop innermost and contiguous so it compiles to vector gathers.
+    // Work is split across rows of the outer and indexed dimensions. Indices
+    // are stored as data_t and must already be validated by the caller.
+    namespace indexing {
+
+        // Copies each srcs[p], viewed as (outer, widths[p]), side by side into
+        // dst of row width sum(widths).
+        void cat(const std::vector<const data_t*>& srcs, const std::vector<index_t>& widths,
+            data_t* dst, index_t outer);
+
+        // dst(o, i, :) = src(o, index[i], :) for i in [0, n_index).
+        void index_select(const data_t* src, const index_t* index, index_t n_index, data_t* dst,
+            index_t outer, index_t n, index_t inner);
+
+        // dst(o, i, c) = src(o, index(o, i, c), c) for i in [0, n_index).
+        void gather(const data_t* src, const data_t* index, data_t* dst,
+            index_t outer, index_t n, index_t n_index, index_t inner);
+
+        // dst(o, index(o, i, c), c) = src(o, i, c), or += when `accumulate`.
+        // Duplicate indices without accumulation keep the last write.
+        void scatter(data_t* dst, const data_t* index, const data_t* src,
+            index_t outer, index_t n, index_t n_index, index_t inner, bool accumulate);
+
+        // True when every index is a whole number in [0, bound).
+        bool in_range(const data_t* index, index_t size, index_t bound);
+
+        // Start of each block of selected elements in the packed output; the
+        // last entry is the total count. Sizes the output of masked_select.
+        std::vector<index_t> mask_offsets(const data_t* mask, index_t size);
+
+        // Packs the elements of src whose mask is non-zero into dst.
+        void masked_select(const data_t* src, const data_t* mask, const std::vector<index_t>& offsets,
+            data_t* dst, index_t size);
+
+    }
+
+}
@@ -0,0 +1,215 @@
+#include "Layout.h"
+#include "Gemm.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace keith {
+
+    namespace layout {
+
+        namespace {
+
+            constexpr index_t grain = 1 << 14;
+            // Pixels per task of the blocked 1x1 convolution.
+            constexpr index_t pixel_tile = 64;
+
+            index_t blocks(index_t c, index_t block) {
+                return (c + block - 1) / block;
+            }
+
+
+            // Output pixels [p0, p1) of one output channel block, each summed
+            // over every input block while it sits in registers. B fixes the
+            // block size at compile time for the common ones; 0 reads it from
+            // `width`.
+            template<index_t B>
+            void mix(const data_t* in, const data_t* slices, data_t* out,
+                index_t cb, index_t hw, index_t p0, index_t p1, index_t width) {
+                const index_t b = B > 0 ? B : width;
+                data_t fixed[B > 0 ? B : 1];
+                std::vector<data_t> spill(B > 0 ? 0 : b);
+                data_t* acc = B > 0 ? fixed : spill.data();
+                for (index_t p = p0; p < p1; ++p) {
+                    std::fill(acc, acc + b, 0);
+                    for (index_t j = 0; j < cb; ++j) {
+                        const data_t* v = in + (j * hw + p) * b;
+                        const data_t* slice = slices + j * b * b;
+                        for (index_t i = 0; i < b; ++i)
+                            for (index_t q = 0; q < b; ++q) acc[q] += v[i] * slice[i * b + q];
+                    }
+                    std::copy(acc, acc + b, out + p * b);
+                }
+            }
+
+        }
+
+        void to_blocked(const data_t* src, const index_t* stride, data_t* dst,
+            index_t n, index_t c, index_t h, index_t w, index_t block) {
+            index_t cb = blocks(c, block), hw = h * w;
+            ThreadPool::self().parallel_for(0, n * cb, std::max<index_t>(grain / (hw * block + 1), 1), [&](index_t begin, index_t end) {
+                for (index_t t = begin; t < end; ++t) {
+                    index_t b = t / cb, g = t % cb;
+                    data_t* out = dst + t * hw * block;
+                    for (index_t i = 0; i < block; ++i) {
+                        index_t ch = g * block + i;
+                        if (ch >= c) {
+                            for (index_t p = 0; p < hw; ++p) out[p * block + i] = 0;
+                            continue;
+                        }
+                        const data_t* plane = src + b * stride[0] + ch * stride[1];
+                        for (index_t y = 0; y < h; ++y)
+                            for (index_t x = 0; x < w; ++x)
+                                out[(y * w + x) * block + i] = plane[y * stride[2] + x * stride[3]];
+                    }
+                }
+            });
+        }
+
+        void from_blocked(const data_t* src, data_t* dst, const index_t* stride,
+            index_t n, index_t c, index_t h, index_t w, index_t block) {
+            index_t cb = blocks(c, block), hw = h * w;
+            ThreadPool::self().parallel_for(0, n * cb, std::max<index_t>(grain / (hw * block + 1), 1), [&](index_t begin, index_t end) {
+                for (index_t t = begin; t < end; ++t) {
+                    index_t b = t / cb, g = t % cb;
+                    const data_t* in = src + t * hw * block;
+                    for (index_t i = 0; i < block && g * block + i < c; ++i) {
+                        data_t* plane = dst + b * stride[0] + (g * block + i) * stride[1];
+                        for (index_t y = 0; y < h; ++y)
+                            for (index_t x = 0; x < w; ++x)
+                                plane[y * stride[2] + x * stride[3]] = in[(y * w + x) * block + i];
+                    }
+                }
+            });
+        }
+
+        void channel_sum(const data_t* x, data_t* out, MemoryFormat format,
+            index_t n, index_t c, index_t hw, index_t block) {
+            ThreadPool& pool = ThreadPool::self();
+            if (format == MemoryFormat::RowMajor) {
+                pool.parallel_for(0, c, std::max<index_t>(grain / (n * hw + 1), 1), [&](index_t begin, index_t end) {
+                    for (index_t ch = begin; ch < end; ++ch) {
+                        data_t s = 0;
+                        for (index_t b = 0; b < n; ++b) {
+                            const data_t* plane = x + (b * c + ch) * hw;
+                            for (index_t p = 0; p < hw; ++p) s += plane[p];
+                        }
+                        out[ch] = s;
+                    }
+                });
+                return;
+            }
+            // Rows of `width` channels, the channels of one pixel in one
+            // channel block, split into a fixed number of chunks whose
+            // partial sums are added up afterwards.
+            index_t groups = format == MemoryFormat::Blocked ? blocks(c, block) : 1;
+            index_t width = format == MemoryFormat::Blocked ? block : c;
+            index_t rows = n * groups * hw, span = groups * width;
+            index_t chunks = std::min<index_t>(std::max<index_t>(rows * width / grain, 1), 64);
+            std::vector<data_t> partial(chunks * span, 0);
+            pool.parallel_for(0, chunks, 1, [&](index_t begin, index_t end) {
+                for (index_t m = begin; m < end; ++m) {
+                    data_t* part = partial.data() + m * span;
+                    index_t r = rows * m / chunks, last = rows * (m + 1) / chunks;
+                    while (r < last) {
+                        index_t stop = std::min(last, (r / hw + 1) * hw);
+                        data_t* acc = part + r / hw % groups * width;
+                        for (; r < stop; ++r) {
+                            const data_t* row = x + r * width;
+                            for (index_t i = 0; i < width; ++i) acc[i] += row[i];
+                        }
+                    }
+                }
+            });
+            for (index_t ch = 0; ch < c; ++ch) {
+                data_t s = 0;
+                for (index_t m = 0; m < chunks; ++m) s += partial[m * span + ch];
+                out[ch] = s;
+            }
+        }
+
+        void channel_affine(const data_t* x, data_t* y, const data_t* scale, const data_t* shift,
+            MemoryFormat format, index_t n, index_t c, index_t hw, index_t block) {
+            ThreadPool& pool = ThreadPool::self();
+            if (format == MemoryFormat::RowMajor) {
+                pool.parallel_for(0, n * c, std::max<index_t>(grain / (hw + 1), 1), [&](index_t begin, index_t end) {
+                    for (index_t t = begin; t < end; ++t) {
+                        data_t s = scale[t % c], o = shift[t % c];
+                        for (index_t p = t * hw; p < (t + 1) * hw; ++p) y[p] = x[p] * s + o;
+                    }
+                });
+                return;
+            }
+            if (format == MemoryFormat::ChannelsLast) {
+                pool.parallel_for(0, n * hw, std::max<index_t>(grain / (c + 1), 1), [&](index_t begin, index_t end) {
+                    for (index_t p = begin; p < end; ++p) {
+                        const data_t* in = x + p * c;
+                        data_t* out = y + p * c;
+                        for (index_t ch = 0; ch < c; ++ch) out[ch] = in[ch] * scale[ch] + shift[ch];
+                    }
+                });
+                return;
+            }
+            // Padding channels see a zero scale and shift and so stay zero.
+            index_t cb = blocks(c, block);
+            pool.parallel_for(0, n * cb, std::max<index_t>(grain / (hw * block + 1), 1), [&](index_t begin, index_t end) {
+                std::vector<data_t> s(block), o(block);
+                for (index_t t = begin; t < end; ++t) {
+                    index_t g = t % cb;
+                    for (index_t i = 0; i < block; ++i) {
+                        index_t ch = g * block + i;
+                        s[i] = ch < c ? scale[ch] : 0;
+                        o[i] = ch < c ? shift[ch] : 0;
+                    }
+                    const data_t* in = x + t * hw * block;
+                    data_t* out = y + t * hw * block;
+                    for (index_t p = 0; p < hw; ++p)
+                        for (index_t i = 0; i < block; ++i) out[p * block + i] = in[p * block + i] * s[i] + o[i];
+                }
+            });
+        }
+
+        void conv1x1(const data_t* x, const data_t* w, data_t* y, MemoryFormat format,
+            index_t n, index_t c, index_t k, index_t hw, index_t block) {
+            if (format == MemoryFormat::RowMajor) {
+                // Y[b] (k, hw) = W (k, c) X[b] (c, hw).
+                for (index_t b = 0; b < n; ++b) gemm::run(w, x + b * c * hw, y + b * k * hw, k, hw, c, 1);
+                return;
+            }
+            if (format == MemoryFormat::ChannelsLast) {
+                // Y (n hw, k) = X (n hw, c) W^T, a single GEMM over all pixels.
+                std::vector<data_t> wt(c * k);
+                for (index_t i = 0; i < k; ++i)
+                    for (index_t j = 0; j < c; ++j) wt[j * k + i] = w[i * c + j];
+                gemm::run(x, wt.data(), y, n * hw, k, c, 1);
+                return;
+            }
+
+            // Each pair of input and output blocks gets a (block, block) slice
+            // of the weight, transposed so one input channel scales a whole
+            // row of output channels: y[p][o] += x[p][i] * slice[i][o].
+            index_t cb = blocks(c, block), kb = blocks(k, block);
+            std::vector<data_t> packed(kb * cb * block * block, 0);
+            for (index_t ko = 0; ko < k; ++ko)
+                for (index_t ci = 0; ci < c; ++ci)
+                    packed[((ko / block * cb + ci / block) * block + ci % block) * block + ko % block] = w[ko * c + ci];
+            index_t tiles = (hw + pixel_tile - 1) / pixel_tile;
+            index_t work = c * block * pixel_tile;
+            ThreadPool::self().parallel_for(0, n * kb * tiles, std::max<index_t>(grain / (work + 1), 1), [&](index_t begin, index_t end) {
+                for (index_t t = begin; t < end; ++t) {
+                    index_t b = t / (kb * tiles), g = t / tiles % kb, p0 = t % tiles * pixel_tile;
+                    index_t p1 = std::min(hw, p0 + pixel_tile);
+                    const data_t* in = x + b * cb * hw * block;
+                    const data_t* slices = packed.data() + g * cb * block * block;
+                    data_t* out = y + (b * kb + g) * hw * block;
+                    if (block == 8) mix<8>(in, slices, out, cb, hw, p0, p1, block);
+                    else if (block == 16) mix<16>(in, slices, out, cb, hw, p0, p1, block);
+                    else mix<0>(in, slices, out, cb, hw, p0, p1, block);
+                }
+            });
+        }
+
+    }
+
+}
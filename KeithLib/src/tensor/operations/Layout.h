@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+namespace keith {
+
+    // How an (N, C, H, W) activation is laid out in memory. Row-major keeps
+    // each channel plane contiguous, channels-last (NHWC) keeps the channels
+    // of one pixel contiguous, and blocked (NCHWc) groups the channels into
+    // blocks of `block`, stored as (N, C / block, H, W, block) with the last
+    // block zero-padded.
+    enum class MemoryFormat {
+        RowMajor,
+        ChannelsLast,
+        Blocked
+    };
+
+    // Per-channel and channel-mixing kernels for each memory format. In the
+    // two channel-innermost formats the inner loop runs over neighbouring
+    // channels of one pixel, so per-channel parameters stay in registers and
+    // the loop vectorizes without gathers; row-major walks whole planes.
+    // Kernels take the logical sizes: `c` counts real channels and `hw` pixels
+    // per image. Blocked data has ceil(c / block) blocks per image.
+    namespace layout {
+
+        // Eight doubles, one AVX-512 register or two AVX2 ones.
+        constexpr index_t block = 8;
+
+        // Packs an (N, C, H, W) view with arbitrary strides into blocked form.
+        void to_blocked(const data_t* src, const index_t* stride, data_t* dst,
+            index_t n, index_t c, index_t h, index_t w, index_t block);
+
+        // Unpacks blocked data into an (N, C, H, W) view with arbitrary strides.
+        void from_blocked(const data_t* src, data_t* dst, const index_t* stride,
+            index_t n, index_t c, index_t h, index_t w, index_t block);
+
+        // out[c] = sum of channel c over N, H and W.
+        void channel_sum(const data_t* x, data_t* out, MemoryFormat format,
+            index_t n, index_t c, index_t hw, index_t block);
+
+        // y = x * scale[c] + shift[c]. y has the layout of x.
+        void channel_affine(const data_t* x, data_t* y, const data_t* scale, const data_t* shift,
+            MemoryFormat format, index_t n, index_t c, index_t hw, index_t block);
+
+        // 1x1 convolution, y[k] = sum over c of w[k, c] x[c] at every pixel,
+        // for a (k, c) weight. y has the layout of x with k channels.
+        void conv1x1(const data_t* x, const data_t* w, data_t* y, MemoryFormat format,
+            index_t n, index_t c, index_t k, index_t hw, index_t block);
+
+    }
+
+}
@@ -0,0 +1,248 @@
+#include "Linalg.h"
+#include "Gemm.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace keith {
+
+    namespace linalg {
+
+        namespace {
+
+            constexpr index_t grain = 1 << 14;
+
+            // Unblocked LU of columns [k0, k1) over rows [k0, n). Pivoting
+            // swaps whole rows, which also applies the swap to the finished
+            // columns on the left and the pending ones on the right.
+            bool lu_panel(data_t* a, index_t n, index_t k0, index_t k1, index_t* pivots) {
+                bool ok = true;
+                for (index_t j = k0; j < k1; ++j) {
+                    index_t p = j;
+                    for (index_t i = j + 1; i < n; ++i)
+                        if (std::fabs(a[i * n + j]) > std::fabs(a[p * n + j])) p = i;
+                    pivots[j] = p;
+                    if (p != j) std::swap_ranges(a + p * n, a + (p + 1) * n, a + j * n);
+                    data_t d = a[j * n + j];
+                    if (d == 0) {
+                        ok = false;
+                        continue;
+                    }
+                    const data_t* uj = a + j * n;
+                    for (index_t i = j + 1; i < n; ++i) {
+                        data_t* ai = a + i * n;
+                        data_t l = ai[j] /= d;
+                        for (index_t c = j + 1; c < k1; ++c) ai[c] -= l * uj[c];
+                    }
+                }
+                return ok;
+            }
+
+            // The Householder vectors of one QR panel as a compact WY block,
+            // H_k0 ... H_k1-1 = I - V T V^T, kept dense for the GEMMs.
+            struct Reflector {
+                index_t k0, w, rows;
+                std::vector<data_t> v, vt, t, tt;
+            };
+
+            Reflector reflector(const data_t* a, const data_t* tau, index_t m, index_t n, index_t k0, index_t k1) {
+                Reflector h{ k0, k1 - k0, m - k0 };
+                index_t w = h.w, rows = h.rows;
+                h.v.assign(rows * w, 0);
+                h.vt.assign(w * rows, 0);
+                for (index_t r = 0; r < rows; ++r)
+                    for (index_t j = 0; j < w && j <= r; ++j) {
+                        data_t v = r == j ? 1 : a[(k0 + r) * n + k0 + j];
+                        h.v[r * w + j] = v;
+                        h.vt[j * rows + r] = v;
+                    }
+                h.t.assign(w * w, 0);
+                std::vector<data_t> z(w);
+                for (index_t i = 0; i < w; ++i) {
+                    data_t ti = tau[k0 + i];
+                    h.t[i * w + i] = ti;
+                    for (index_t p = 0; p < i; ++p) {
+                        data_t s = 0;
+                        for (index_t r = i; r < rows; ++r) s += h.vt[p * rows + r] * h.vt[i * rows + r];
+                        z[p] = s;
+                    }
+                    for (index_t p = 0; p < i; ++p) {
+                        data_t s = 0;
+                        for (index_t q = p; q < i; ++q) s += h.t[p * w + q] * z[q];
+                        h.t[p * w + i] = -ti * s;
+                    }
+                }
+                h.tt.assign(w * w, 0);
+                for (index_t i = 0; i < w; ++i)
+                    for (index_t j = 0; j < w; ++j) h.tt[j * w + i] = h.t[i * w + j];
+                return h;
+            }
+
+            // C -= V op(T) V^T C over the reflector's rows, with op(T) = T^T
+            // when `transpose`, i.e. C = H^T C.
+            void apply(const Reflector& h, data_t* c, index_t ldc, index_t cols, bool transpose) {
+                if (cols == 0) return;
+                std::vector<data_t> w(h.w * cols, 0), w2(h.w * cols, 0);
+                gemm::update(h.vt.data(), h.rows, c, ldc, w.data(), cols, h.w, cols, h.rows, 1);
+                gemm::update(transpose ? h.tt.data() : h.t.data(), h.w, w.data(), cols, w2.data(), cols, h.w, cols, h.w, 1);
+                gemm::update(h.v.data(), h.w, w2.data(), cols, c, ldc, h.rows, cols, h.w, -1);
+            }
+
+        }
+
+        bool lu(data_t* a, index_t n, index_t* pivots) {
+            bool ok = true;
+            for (index_t k0 = 0; k0 < n; k0 += block) {
+                index_t k1 = std::min(n, k0 + block);
+                ok = lu_panel(a, n, k0, k1, pivots) && ok;
+                if (k1 == n) break;
+                for (index_t i = k0; i < k1; ++i) {
+                    data_t* ai = a + i * n;
+                    for (index_t p = k0; p < i; ++p) {
+                        data_t l = ai[p];
+                        const data_t* up = a + p * n;
+                        for (index_t c = k1; c < n; ++c) ai[c] -= l * up[c];
+                    }
+                }
+                gemm::update(a + k1 * n + k0, n, a + k0 * n + k1, n, a + k1 * n + k1, n, n - k1, n - k1, k1 - k0, -1);
+            }
+            return ok;
+        }
+
+        bool cholesky(data_t* a, index_t n) {
+            std::vector<data_t> t;
+            for (index_t k0 = 0; k0 < n; k0 += block) {
+                index_t k1 = std::min(n, k0 + block), w = k1 - k0;
+                for (index_t j = k0; j < k1; ++j) {
+                    data_t* aj = a + j * n;
+                    data_t d = aj[j];
+                    for (index_t p = k0; p < j; ++p) d -= aj[p] * aj[p];
+                    if (!(d > 0)) return false;
+                    aj[j] = std::sqrt(d);
+                    for (index_t i = j + 1; i < k1; ++i) {
+                        data_t* ai = a + i * n;
+                        data_t s = ai[j];
+                        for (index_t p = k0; p < j; ++p) s -= ai[p] * aj[p];
+                        ai[j] = s / aj[j];
+                    }
+                }
+                if (k1 == n) break;
+
+                // L21 = A21 L11^-T, one independent row at a time.
+                index_t rest = n - k1;
+                ThreadPool::self().parallel_for(k1, n, std::max<index_t>(grain / (w * w), 1), [&](index_t begin, index_t end) {
+                    for (index_t i = begin; i < end; ++i) {
+                        data_t* ai = a + i * n;
+                        for (index_t j = k0; j < k1; ++j) {
+                            const data_t* aj = a + j * n;
+                            data_t s = ai[j];
+                            for (index_t p = k0; p < j; ++p) s -= ai[p] * aj[p];
+                            ai[j] = s / aj[j];
+                        }
+                    }
+                });
+
+                // A22 -= L21 L21^T, only on and below the diagonal blocks.
+                t.assign(w * rest, 0);
+                for (index_t i = k1; i < n; ++i)
+                    for (index_t j = k0; j < k1; ++j) t[(j - k0) * rest + i - k1] = a[i * n + j];
+                index_t row_blocks = (rest + block - 1) / block;
+                ThreadPool::self().parallel_for(0, row_blocks, 1, [&](index_t begin, index_t end) {
+                    for (index_t b = begin; b < end; ++b) {
+                        index_t r0 = k1 + b * block, r1 = std::min(n, r0 + block);
+                        gemm::update(a + r0 * n + k0, n, t.data(), rest, a + r0 * n + k1, n, r1 - r0, r1 - k1, w, -1);
+                    }
+                });
+            }
+            for (index_t i = 0; i < n; ++i) std::fill(a + i * n + i + 1, a + (i + 1) * n, 0);
+            return true;
+        }
+
+        void qr(data_t* a, data_t* q, data_t* r, index_t m, index_t n) {
+            index_t kk = std::min(m, n);
+            std::vector<data_t> tau(kk), s;
+            std::vector<Reflector> panels;
+            for (index_t k0 = 0; k0 < kk; k0 += block) {
+                index_t k1 = std::min(kk, k0 + block);
+                for (index_t j = k0; j < k1; ++j) {
+                    data_t alpha = a[j * n + j], norm = 0;
+                    for (index_t i = j + 1; i < m; ++i) norm += a[i * n + j] * a[i * n + j];
+                    if (norm == 0) {
+                        tau[j] = 0;
+                        continue;
+                    }
+                    data_t beta = -std::copysign(std::sqrt(alpha * alpha + norm), alpha);
+                    tau[j] = (beta - alpha) / beta;
+                    data_t scale = 1 / (alpha - beta);
+                    for (index_t i = j + 1; i < m; ++i) a[i * n + j] *= scale;
+                    a[j * n + j] = beta;
+
+                    // Rest of the panel: s = tau * v^T A, A -= v s.
+                    index_t c0 = j + 1;
+                    if (c0 == k1) continue;
+                    s.assign(a + j * n + c0, a + j * n + k1);
+                    for (index_t i = j + 1; i < m; ++i) {
+                        data_t v = a[i * n + j];
+                        for (index_t c = c0; c < k1; ++c) s[c - c0] += v * a[i * n + c];
+                    }
+                    for (data_t& x : s) x *= tau[j];
+                    for (index_t c = c0; c < k1; ++c) a[j * n + c] -= s[c - c0];
+                    for (index_t i = j + 1; i < m; ++i) {
+                        data_t v = a[i * n + j];
+                        for (index_t c = c0; c < k1; ++c) a[i * n + c] -= v * s[c - c0];
+                    }
+                }
+                panels.push_back(reflector(a, tau.data(), m, n, k0, k1));
+                if (k1 < n) apply(panels.back(), a + k0 * n + k1, n, n - k1, true);
+            }
+
+            for (index_t i = 0; i < kk; ++i)
+                for (index_t c = 0; c < n; ++c) r[i * n + c] = c >= i ? a[i * n + c] : 0;
+
+            // Q = H_0 ... H_kk-1 I, accumulated from the last panel back so each
+            // block only touches the columns it can change.
+            std::fill(q, q + m * kk, 0);
+            for (index_t i = 0; i < kk; ++i) q[i * kk + i] = 1;
+            for (auto it = panels.rbegin(); it != panels.rend(); ++it)
+                apply(*it, q + it->k0 * kk + it->k0, kk, kk - it->k0, false);
+        }
+
+        void triangular_solve(const data_t* a, data_t* b, index_t n, index_t k, bool upper, bool unit) {
+            index_t blocks = (n + block - 1) / block;
+            for (index_t s = 0; s < blocks; ++s) {
+                index_t i0 = (upper ? blocks - 1 - s : s) * block, i1 = std::min(n, i0 + block), w = i1 - i0;
+                if (upper && i1 < n)
+                    gemm::update(a + i0 * n + i1, n, b + i1 * k, k, b + i0 * k, k, w, k, n - i1, -1);
+                if (!upper && i0 > 0)
+                    gemm::update(a + i0 * n, n, b, k, b + i0 * k, k, w, k, i0, -1);
+                ThreadPool::self().parallel_for(0, k, std::max<index_t>(grain / (w * w), 16), [&](index_t c0, index_t c1) {
+                    for (index_t t = 0; t < w; ++t) {
+                        index_t i = upper ? i1 - 1 - t : i0 + t;
+                        data_t* bi = b + i * k;
+                        index_t p0 = upper ? i + 1 : i0, p1 = upper ? i1 : i;
+                        for (index_t p = p0; p < p1; ++p) {
+                            data_t l = a[i * n + p];
+                            const data_t* bp = b + p * k;
+                            for (index_t c = c0; c < c1; ++c) bi[c] -= l * bp[c];
+                        }
+                        if (!unit) {
+                            data_t d = a[i * n + i];
+                            for (index_t c = c0; c < c1; ++c) bi[c] /= d;
+                        }
+                    }
+                });
+            }
+        }
+
+        void lu_solve(const data_t* lu, const index_t* pivots, data_t* b, index_t n, index_t k) {
+            for (index_t i = 0; i < n; ++i)
+                if (pivots[i] != i) std::swap_ranges(b + pivots[i] * k, b + (pivots[i] + 1) * k, b + i * k);
+            triangular_solve(lu, b, n, k, false, true);
+            triangular_solve(lu, b, n, k, true, false);
+        }
+
+    }
+
+}
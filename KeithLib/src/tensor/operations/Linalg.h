@@ -0,0 +1,41 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+namespace keith {
+
+    // Blocked factorizations and solvers over dense row-major matrices. Each
+    // walks the matrix in panels of `block` columns: the panel is factored
+    // with a plain kernel and everything to its right is brought up to date
+    // with one GEMM, which is where nearly all of the work goes for large
+    // matrices. Callers run independent matrices of a batch in parallel;
+    // a single large matrix gets its parallelism from the GEMM.
+    namespace linalg {
+
+        constexpr index_t block = 64;
+
+        // In-place LU with partial pivoting of an (n, n) matrix, P A = L U.
+        // L has a unit diagonal and is stored below it, U on and above it.
+        // Row i was swapped with row pivots[i] at step i. Returns false when
+        // U has a zero on its diagonal; the factors are completed regardless.
+        bool lu(data_t* a, index_t n, index_t* pivots);
+
+        // In-place lower Cholesky factor of an (n, n) matrix, A = L L^T, with
+        // the strict upper triangle zeroed. Returns false when A is not
+        // positive-definite.
+        bool cholesky(data_t* a, index_t n);
+
+        // Householder QR of an (m, n) matrix, overwriting it. q is
+        // (m, min(m, n)) with orthonormal columns and r is (min(m, n), n).
+        void qr(data_t* a, data_t* q, data_t* r, index_t m, index_t n);
+
+        // Solves A X = B for triangular (n, n) A, overwriting the (n, k) B.
+        void triangular_solve(const data_t* a, data_t* b, index_t n, index_t k, bool upper, bool unit);
+
+        // Solves A X = B from the output of lu(), overwriting the (n, k) B.
+        void lu_solve(const data_t* lu, const index_t* pivots, data_t* b, index_t n, index_t k);
+
+    }
+
+}
@@ -0,0 +1,115 @@
+#include "MathFunctions.h"
+#include "../../utils/ThreadPool.h"
+
+#include <atomic>
+
+namespace keith {
+
+    namespace vmath {
+
+        namespace {
+
+            constexpr index_t grain = 1 << 14;
+
+            std::atomic<Mode> current_mode{ Mode::Strict };
+
+            template<typename Func>
+            void map(const data_t* x, data_t* y, index_t n, Func func) {
+                ThreadPool::self().parallel_for(0, n, grain, [&](index_t begin, index_t end) {
+                    for (index_t i = begin; i < end; ++i) y[i] = func(x[i]);
+                });
+            }
+
+            // The mode is read once per call so the inner loops stay free of
+            // the atomic load and vectorize.
+            template<typename Strict, typename Fast>
+            void dispatch(const data_t* x, data_t* y, index_t n, Strict strict, Fast fast) {
+                if (mode() == Mode::Fast) map(x, y, n, fast);
+                else map(x, y, n, strict);
+            }
+
+        }
+
+        void set_mode(Mode mode) {
+            current_mode.store(mode, std::memory_order_relaxed);
+        }
+
+        Mode mode() {
+            return current_mode.load(std::memory_order_relaxed);
+        }
+
+        void exp(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return detail::exp_impl<detail::exp_strict_degree>(v); },
+                [](data_t v) { return detail::exp_impl<detail::exp_fast_degree>(v); });
+        }
+
+        void log(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return detail::log_impl<7>(v); },
+                [](data_t v) { return detail::log_impl<4>(v); });
+        }
+
+        void sin(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return detail::sin_impl<true>(v); },
+                [](data_t v) { return detail::sin_impl<false>(v); });
+        }
+
+        void cos(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return detail::cos_impl<true>(v); },
+                [](data_t v) { return detail::cos_impl<false>(v); });
+        }
+
+        void tan(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return detail::tan_impl<true>(v); },
+                [](data_t v) { return detail::tan_impl<false>(v); });
+        }
+
+        void tanh(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return detail::tanh_impl<detail::exp_strict_degree>(v); },
+                [](data_t v) { return detail::tanh_impl<detail::exp_fast_degree>(v); });
+        }
+
+        void sigmoid(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return detail::sigmoid_impl<detail::exp_strict_degree>(v); },
+                [](data_t v) { return detail::sigmoid_impl<detail::exp_fast_degree>(v); });
+        }
+
+        void erf(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return std::erf(v); },
+                [](data_t v) { return detail::erf_fast(v); });
+        }
+
+        void sqrt(const data_t* x, data_t* y, index_t n) {
+            map(x, y, n, [](data_t v) { return std::sqrt(v); });
+        }
+
+        void rsqrt(const data_t* x, data_t* y, index_t n) {
+            dispatch(x, y, n,
+                [](data_t v) { return 1.0 / std::sqrt(v); },
+                [](data_t v) { return detail::rsqrt_fast(v); });
+        }
+
+        void pow(const data_t* x, const data_t* e, data_t* y, index_t n) {
+            bool fast = mode() == Mode::Fast;
+            ThreadPool::self().parallel_for(0, n, grain, [&](index_t begin, index_t end) {
+                if (fast) {
+                    for (index_t i = begin; i < end; ++i)
+                        y[i] = x[i] > 0 ? detail::exp_impl<detail::exp_fast_degree>(e[i] * detail::log_impl<4>(x[i]))
+                            : std::pow(x[i], e[i]);
+                }
+                else {
+                    for (index_t i = begin; i < end; ++i) y[i] = std::pow(x[i], e[i]);
+                }
+            });
+        }
+
+    }
+
+}
@@ -0,0 +1,197 @@
+#include "Normalization.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace keith {
+
+    namespace norm {
+
+        namespace {
+
+            constexpr index_t chunk = 64;
+            constexpr index_t row_block = 16;
+            constexpr index_t col_tile = 256;
+            constexpr index_t grain = 1 << 14;
+
+            // Running statistics of one normalized line. For the softmax family
+            // `a` is the running max and `b` the sum of exp(x - a); for layer
+            // norm `a` is the mean and `b` the sum of squared deviations; for
+            // rms norm only `b`, the sum of squares, is used.
+            struct Stats {
+                data_t a;
+                data_t b;
+                index_t count;
+            };
+
+            Stats init(Kind kind) {
+                if (kind == Kind::Softmax || kind == Kind::LogSoftmax)
+                    return { -std::numeric_limits<data_t>::infinity(), 0, 0 };
+                return { 0, 0, 0 };
+            }
+
+            // Folds one chunk of m contiguous values into the statistics.
+            inline void update(Kind kind, Stats& st, const data_t* x, index_t m) {
+                if (kind == Kind::Softmax || kind == Kind::LogSoftmax) {
+                    data_t cm = st.a;
+                    for (index_t i = 0; i < m; ++i) cm = std::max(cm, x[i]);
+                    if (cm > st.a) {
+                        st.b *= std::exp(st.a - cm);
+                        st.a = cm;
+                    }
+                    data_t s = 0;
+                    for (index_t i = 0; i < m; ++i) s += std::exp(x[i] - cm);
+                    st.b += s;
+                }
+                else if (kind == Kind::LayerNorm) {
+                    data_t mean = 0;
+                    for (index_t i = 0; i < m; ++i) mean += x[i];
+                    mean /= m;
+                    data_t m2 = 0;
+                    for (index_t i = 0; i < m; ++i) {
+                        data_t d = x[i] - mean;
+                        m2 += d * d;
+                    }
+                    index_t total = st.count + m;
+                    data_t delta = mean - st.a;
+                    st.a += delta * m / total;
+                    st.b += m2 + delta * delta * ((data_t)st.count * m / total);
+                }
+                else {
+                    data_t s = 0;
+                    for (index_t i = 0; i < m; ++i) s += x[i] * x[i];
+                    st.b += s;
+                }
+                st.count += m;
+            }
+
+            // Turns statistics into y = (x - shift) * scale, followed by the
+            // optional per-position weight and bias.
+            inline void finalize(Kind kind, const Stats& st, index_t n, data_t eps, data_t& shift, data_t& scale) {
+                switch (kind) {
+                case Kind::Softmax: shift = st.a; scale = 1 / st.b; break;
+                case Kind::LogSoftmax: shift = st.a + std::log(st.b); scale = 1; break;
+                case Kind::LayerNorm: shift = st.a; scale = 1 / std::sqrt(st.b / n + eps); break;
+                case Kind::RmsNorm: shift = 0; scale = 1 / std::sqrt(st.b / n + eps); break;
+                }
+            }
+
+            void write_row(Kind kind, const data_t* x, data_t* y, index_t n, data_t shift, data_t scale,
+                const data_t* weight, const data_t* bias) {
+                if (kind == Kind::Softmax) {
+                    for (index_t i = 0; i < n; ++i) y[i] = std::exp(x[i] - shift) * scale;
+                    return;
+                }
+                for (index_t i = 0; i < n; ++i) y[i] = (x[i] - shift) * scale;
+                if (weight != nullptr)
+                    for (index_t i = 0; i < n; ++i) y[i] *= weight[i];
+                if (bias != nullptr)
+                    for (index_t i = 0; i < n; ++i) y[i] += bias[i];
+            }
+
+            // Normalized dimension is the innermost one: every line is a
+            // contiguous row.
+            void run_rows(Kind kind, const data_t* src, data_t* dst, index_t rows, index_t n,
+                const data_t* weight, const data_t* bias, data_t eps) {
+                ThreadPool::self().parallel_for(0, rows, std::max<index_t>(grain / n, 1),
+                    [&](index_t begin, index_t end) {
+                        for (index_t r = begin; r < end; ++r) {
+                            const data_t* x = src + r * n;
+                            Stats st = init(kind);
+                            for (index_t i = 0; i < n; i += chunk)
+                                update(kind, st, x + i, std::min(chunk, n - i));
+                            data_t shift = 0, scale = 1;
+                            finalize(kind, st, n, eps, shift, scale);
+                            write_row(kind, x, dst + r * n, n, shift, scale, weight, bias);
+                        }
+                    });
+            }
+
+            // Normalized dimension has inner stride > 1: each task owns a tile of
+            // columns and sweeps down the lines in blocks of rows. Statistics are
+            // kept per column so every inner loop runs along contiguous memory.
+            void run_columns(Kind kind, const data_t* src, data_t* dst, index_t outer, index_t n, index_t inner,
+                const data_t* weight, const data_t* bias, data_t eps) {
+                index_t tiles = (inner + col_tile - 1) / col_tile;
+                bool soft = kind == Kind::Softmax || kind == Kind::LogSoftmax;
+                ThreadPool::self().parallel_for(0, outer * tiles, std::max<index_t>(grain / (n * col_tile), 1),
+                    [&](index_t begin, index_t end) {
+                        std::vector<data_t> a(col_tile), b(col_tile), ca(col_tile), cb(col_tile);
+                        std::vector<data_t> shift(col_tile), scale(col_tile);
+                        for (index_t t = begin; t < end; ++t) {
+                            index_t o = t / tiles, c0 = (t % tiles) * col_tile;
+                            index_t width = std::min(col_tile, inner - c0);
+                            const data_t* x = src + o * n * inner + c0;
+                            data_t* y = dst + o * n * inner + c0;
+                            Stats first = init(kind);
+                            std::fill_n(a.begin(), width, first.a);
+                            std::fill_n(b.begin(), width, first.b);
+                            for (index_t r = 0; r < n; r += row_block) {
+                                index_t m = std::min(row_block, n - r);
+                                const data_t* xb = x + r * inner;
+                                if (soft) {
+                                    std::copy_n(a.begin(), width, ca.begin());
+                                    for (index_t i = 0; i < m; ++i)
+                                        for (index_t c = 0; c < width; ++c) ca[c] = std::max(ca[c], xb[i * inner + c]);
+                                    for (index_t c = 0; c < width; ++c) {
+                                        b[c] *= std::exp(a[c] - ca[c]);
+                                        a[c] = ca[c];
+                                    }
+                                    for (index_t i = 0; i < m; ++i)
+                                        for (index_t c = 0; c < width; ++c) b[c] += std::exp(xb[i * inner + c] - a[c]);
+                                }
+                                else if (kind == Kind::LayerNorm) {
+                                    std::fill_n(ca.begin(), width, 0);
+                                    std::fill_n(cb.begin(), width, 0);
+                                    for (index_t i = 0; i < m; ++i)
+                                        for (index_t c = 0; c < width; ++c) ca[c] += xb[i * inner + c];
+                                    for (index_t c = 0; c < width; ++c) ca[c] /= m;
+                                    for (index_t i = 0; i < m; ++i)
+                                        for (index_t c = 0; c < width; ++c) {
+                                            data_t d = xb[i * inner + c] - ca[c];
+                                            cb[c] += d * d;
+                                        }
+                                    data_t w_new = (data_t)m / (r + m), w_cross = (data_t)r * m / (r + m);
+                                    for (index_t c = 0; c < width; ++c) {
+                                        data_t delta = ca[c] - a[c];
+                                        a[c] += delta * w_new;
+                                        b[c] += cb[c] + delta * delta * w_cross;
+                                    }
+                                }
+                                else {
+                                    for (index_t i = 0; i < m; ++i)
+                                        for (index_t c = 0; c < width; ++c) b[c] += xb[i * inner + c] * xb[i * inner + c];
+                                }
+                            }
+                            for (index_t c = 0; c < width; ++c)
+                                finalize(kind, { a[c], b[c], n }, n, eps, shift[c], scale[c]);
+                            for (index_t r = 0; r < n; ++r) {
+                                const data_t* xr = x + r * inner;
+                                data_t* yr = y + r * inner;
+                                if (kind == Kind::Softmax) {
+                                    for (index_t c = 0; c < width; ++c) yr[c] = std::exp(xr[c] - shift[c]) * scale[c];
+                                    continue;
+                                }
+                                data_t w = weight != nullptr ? weight[r] : 1;
+                                data_t bv = bias != nullptr ? bias[r] : 0;
+                                for (index_t c = 0; c < width; ++c) yr[c] = (xr[c] - shift[c]) * scale[c] * w + bv;
+                            }
+                        }
+                    });
+            }
+
+        }
+
+        void run(Kind kind, const data_t* src, data_t* dst, index_t outer, index_t n, index_t inner,
+            const data_t* weight, const data_t* bias, data_t eps) {
+            if (outer == 0 || n == 0 || inner == 0) return;
+            if (inner == 1) run_rows(kind, src, dst, outer, n, weight, bias, eps);
+            else run_columns(kind, src, dst, outer, n, inner, weight, bias, eps);
+        }
+
+    }
+
+}
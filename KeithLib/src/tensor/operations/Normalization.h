@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+namespace keith {
+
+    // Fused normalization kernels over a contiguous tensor viewed as
+    // (outer, n, inner), normalizing along the middle dimension. Statistics are
+    // gathered in a single read of the input using chunked online updates
+    // (running max with rescaled sum, or merged per-chunk mean/variance), and
+    // the result is written straight into the output buffer in a second pass.
+    namespace norm {
+
+        enum class Kind {
+            Softmax,
+            LogSoftmax,
+            LayerNorm,
+            RmsNorm
+        };
+
+        void run(Kind kind, const data_t* src, data_t* dst,
+            index_t outer, index_t n, index_t inner,
+            const data_t* weight = nullptr, const data_t* bias = nullptr, data_t eps = 1e-5);
+
+    }
+
+}
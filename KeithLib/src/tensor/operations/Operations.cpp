@@ -1 +1,416 @@
 #include "Operations.h"
+#include "SmallMatrix.h"
+#include "Dispatch.h"
+#include "Gemm.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace keith {
+
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<op::MatrixMul_3dim, TensorImpl, TensorImpl>>& src) {
+        const TensorImpl& lhs = *src->lhs();
+        const TensorImpl& rhs = *src->rhs();
+        if (lhs.n_dim() != 3 || rhs.n_dim() != 3 || dst.n_dim() != 3) return false;
+        index_t batch = lhs.size(0), n = lhs.size(1);
+        if (!small::supported(n) || lhs.size(2) != n || !(rhs.size() == lhs.size()) || !(dst.size() == lhs.size())
+            || !lhs.is_contiguous() || !rhs.is_contiguous() || !dst.is_contiguous())
+            return gemm_assign(dst, lhs, rhs);
+        small::bmm(lhs.data(), rhs.data(), dst.data(), batch, n);
+        return true;
+    }
+
+    namespace {
+
+        using dispatch::Args;
+        using dispatch::DType;
+        using dispatch::Isa;
+        using dispatch::Layout;
+        using dispatch::Registrar;
+
+        constexpr index_t grain = 1 << 14;
+        constexpr index_t row_chunk = 256;
+
+        template<typename Op>
+        void map_contiguous(const Args& args) {
+            Op::map(args.in[0], args.out, args.size);
+        }
+
+        // Rows with a non-unit stride are staged through a small buffer so the
+        // array kernel still sees contiguous input.
+        template<typename Op>
+        void map_strided(const Args& args) {
+            dispatch::for_each_row(args, [](data_t* y, index_t ys, const data_t* const* x, const index_t* xs, index_t n) {
+                if (ys == 1 && xs[0] == 1) {
+                    Op::map(x[0], y, n);
+                    return;
+                }
+                data_t xb[row_chunk], yb[row_chunk];
+                for (index_t i0 = 0; i0 < n; i0 += row_chunk) {
+                    index_t m = std::min(row_chunk, n - i0);
+                    for (index_t i = 0; i < m; ++i) xb[i] = x[0][(i0 + i) * xs[0]];
+                    Op::map(xb, yb, m);
+                    for (index_t i = 0; i < m; ++i) y[(i0 + i) * ys] = yb[i];
+                }
+            });
+        }
+
+        template<typename F>
+        void unary_contiguous(const Args& args) {
+            const data_t* x = args.in[0];
+            data_t* y = args.out;
+            ThreadPool::self().parallel_for(0, args.size, grain, [&](index_t begin, index_t end) {
+                F f;
+                for (index_t i = begin; i < end; ++i) y[i] = f(x[i]);
+            });
+        }
+
+        template<typename F>
+        void unary_strided(const Args& args) {
+            dispatch::for_each_row(args, [](data_t* y, index_t ys, const data_t* const* x, const index_t* xs, index_t n) {
+                F f;
+                for (index_t i = 0; i < n; ++i) y[i * ys] = f(x[0][i * xs[0]]);
+            });
+        }
+
+        template<typename F>
+        void binary_contiguous(const Args& args) {
+            const data_t* a = args.in[0];
+            const data_t* b = args.in[1];
+            data_t* y = args.out;
+            ThreadPool::self().parallel_for(0, args.size, grain, [&](index_t begin, index_t end) {
+                F f;
+                for (index_t i = begin; i < end; ++i) y[i] = f(a[i], b[i]);
+            });
+        }
+
+        template<typename F>
+        void binary_strided(const Args& args) {
+            dispatch::for_each_row(args, [](data_t* y, index_t ys, const data_t* const* x, const index_t* xs, index_t n) {
+                F f;
+                for (index_t i = 0; i < n; ++i) y[i * ys] = f(x[0][i * xs[0]], x[1][i * xs[1]]);
+            });
+        }
+
+        // The scalar operand is read once into a local so the loop keeps it in
+        // a broadcast register.
+        template<typename F, bool ScalarLhs>
+        void binary_scalar(const Args& args) {
+            const data_t* x = args.in[ScalarLhs ? 1 : 0];
+            const data_t s = *args.in[ScalarLhs ? 0 : 1];
+            data_t* y = args.out;
+            ThreadPool::self().parallel_for(0, args.size, grain, [&](index_t begin, index_t end) {
+                F f;
+                if constexpr (ScalarLhs)
+                    for (index_t i = begin; i < end; ++i) y[i] = f(s, x[i]);
+                else
+                    for (index_t i = begin; i < end; ++i) y[i] = f(x[i], s);
+            });
+        }
+
+        void pow_scalar(const Args& args) {
+            const data_t* x = args.in[0];
+            const data_t e = *args.in[1];
+            data_t* y = args.out;
+            ThreadPool::self().parallel_for(0, args.size, grain, [&](index_t begin, index_t end) {
+                if (e == 2)
+                    for (index_t i = begin; i < end; ++i) y[i] = x[i] * x[i];
+                else
+                    for (index_t i = begin; i < end; ++i) y[i] = vmath::pow(x[i], e);
+            });
+        }
+
+        void pow_contiguous(const Args& args) {
+            op::Pow::map(args.in[0], args.in[1], args.out, args.size);
+        }
+
+        struct PowF {
+            data_t operator()(data_t x, data_t e) const { return vmath::pow(x, e); }
+        };
+
+        template<typename Op>
+        Registrar map_kernel(Layout layout) {
+            return Registrar(Op::name, DType::Float64, layout, Isa::Generic, "generic",
+                layout == Layout::Contiguous ? map_contiguous<Op> : map_strided<Op>);
+        }
+
+        // Division keeps its per-element divisor check in eval and is left out.
+        const Registrar registrations[] = {
+            { op::Add::name, DType::Float64, Layout::Contiguous, Isa::Generic, "generic", binary_contiguous<std::plus<data_t>> },
+            { op::Add::name, DType::Float64, Layout::Strided, Isa::Generic, "generic", binary_strided<std::plus<data_t>> },
+            { op::Add::name, DType::Float64, Layout::ScalarLhs, Isa::Generic, "generic", binary_scalar<std::plus<data_t>, true> },
+            { op::Add::name, DType::Float64, Layout::ScalarRhs, Isa::Generic, "generic", binary_scalar<std::plus<data_t>, false> },
+            { op::Sub::name, DType::Float64, Layout::Contiguous, Isa::Generic, "generic", binary_contiguous<std::minus<data_t>> },
+            { op::Sub::name, DType::Float64, Layout::Strided, Isa::Generic, "generic", binary_strided<std::minus<data_t>> },
+            { op::Sub::name, DType::Float64, Layout::ScalarLhs, Isa::Generic, "generic", binary_scalar<std::minus<data_t>, true> },
+            { op::Sub::name, DType::Float64, Layout::ScalarRhs, Isa::Generic, "generic", binary_scalar<std::minus<data_t>, false> },
+            { op::Mul::name, DType::Float64, Layout::Contiguous, Isa::Generic, "generic", binary_contiguous<std::multiplies<data_t>> },
+            { op::Mul::name, DType::Float64, Layout::Strided, Isa::Generic, "generic", binary_strided<std::multiplies<data_t>> },
+            { op::Mul::name, DType::Float64, Layout::ScalarLhs, Isa::Generic, "generic", binary_scalar<std::multiplies<data_t>, true> },
+            { op::Mul::name, DType::Float64, Layout::ScalarRhs, Isa::Generic, "generic", binary_scalar<std::multiplies<data_t>, false> },
+            { op::Pow::name, DType::Float64, Layout::Contiguous, Isa::Generic, "generic", pow_contiguous },
+            { op::Pow::name, DType::Float64, Layout::Strided, Isa::Generic, "generic", binary_strided<PowF> },
+            { op::Pow::name, DType::Float64, Layout::ScalarRhs, Isa::Generic, "generic", pow_scalar },
+            { op::Neg::name, DType::Float64, Layout::Contiguous, Isa::Generic, "generic", unary_contiguous<std::negate<data_t>> },
+            { op::Neg::name, DType::Float64, Layout::Strided, Isa::Generic, "generic", unary_strided<std::negate<data_t>> },
+            map_kernel<op::Sin>(Layout::Contiguous), map_kernel<op::Sin>(Layout::Strided),
+            map_kernel<op::Cos>(Layout::Contiguous), map_kernel<op::Cos>(Layout::Strided),
+            map_kernel<op::Tan>(Layout::Contiguous), map_kernel<op::Tan>(Layout::Strided),
+            map_kernel<op::Exponential>(Layout::Contiguous), map_kernel<op::Exponential>(Layout::Strided),
+            map_kernel<op::Log>(Layout::Contiguous), map_kernel<op::Log>(Layout::Strided),
+            map_kernel<op::Tanh>(Layout::Contiguous), map_kernel<op::Tanh>(Layout::Strided),
+            map_kernel<op::Sigmoid>(Layout::Contiguous), map_kernel<op::Sigmoid>(Layout::Strided),
+            map_kernel<op::Erf>(Layout::Contiguous), map_kernel<op::Erf>(Layout::Strided),
+            map_kernel<op::Sqrt>(Layout::Contiguous), map_kernel<op::Sqrt>(Layout::Strided),
+            map_kernel<op::Rsqrt>(Layout::Contiguous), map_kernel<op::Rsqrt>(Layout::Strided),
+        };
+
+        // Right-aligns `src` against the output shape, giving broadcast
+        // dimensions a zero stride. Fails on shapes that do not broadcast.
+        bool broadcast_strides(const TensorImpl& src, const TensorImpl& dst, index_t* stride) {
+            index_t lead = dst.n_dim() - src.n_dim();
+            if (lead < 0) return false;
+            for (index_t d = 0; d < dst.n_dim(); ++d) {
+                if (d < lead) {
+                    stride[d] = 0;
+                    continue;
+                }
+                index_t n = src.size()[d - lead];
+                if (n == dst.size()[d]) stride[d] = n == 1 ? 0 : src.stride()[d - lead];
+                else if (n == 1) stride[d] = 0;
+                else return false;
+            }
+            return true;
+        }
+
+    }
+
+    namespace {
+
+        // Operands are tensors, or a single value when `value` is set for
+        // that slot.
+        bool dispatch_run(const char* op, TensorImpl& dst, const TensorImpl* const* in, const data_t* const* value, index_t n_in) {
+            index_t n_dim = dst.n_dim();
+            std::vector<index_t> shape(n_dim), out_stride(n_dim), in_stride[2] = { std::vector<index_t>(n_dim), std::vector<index_t>(n_dim) };
+            for (index_t k = 0; k < n_in; ++k)
+                if (value[k] == nullptr && !broadcast_strides(*in[k], dst, in_stride[k].data())) return false;
+            for (index_t d = 0; d < n_dim; ++d) {
+                shape[d] = dst.size()[d];
+                out_stride[d] = dst.stride()[d];
+            }
+            Args args{};
+            args.out_stride = out_stride.data();
+            args.shape = shape.data();
+            args.n_dim = n_dim;
+            args.n_in = n_in;
+            args.size = dst.d_size();
+            for (index_t k = 0; k < n_in; ++k) {
+                args.in[k] = value[k] != nullptr ? value[k] : in[k]->data();
+                args.in_stride[k] = in_stride[k].data();
+            }
+            dispatch::Kernel kernel = dispatch::Registry::self().find(op, DType::Float64, dispatch::classify(args));
+            if (kernel == nullptr) return false;
+            args.out = dst.data();
+            kernel(args);
+            return true;
+        }
+
+    }
+
+    bool dispatch_assign(const char* op, TensorImpl& dst, const TensorImpl& lhs, const TensorImpl* rhs) {
+        const TensorImpl* in[2] = { &lhs, rhs };
+        const data_t* value[2] = { nullptr, nullptr };
+        return dispatch_run(op, dst, in, value, rhs != nullptr ? 2 : 1);
+    }
+
+    bool dispatch_assign(const char* op, TensorImpl& dst, const TensorImpl& tensor, data_t scalar, bool scalar_lhs) {
+        const TensorImpl* in[2] = { &tensor, &tensor };
+        const data_t* value[2] = { scalar_lhs ? &scalar : nullptr, scalar_lhs ? nullptr : &scalar };
+        return dispatch_run(op, dst, in, value, 2);
+    }
+
+    bool axpby_assign(TensorImpl& dst, data_t alpha, const TensorImpl& x, data_t beta, const TensorImpl& y) {
+        if (!(x.size() == dst.size()) || !(y.size() == dst.size()) || !dst.is_dense())
+            return false;
+        // Any dense layout runs flat as long as all three share it.
+        for (index_t d = 0; d < dst.n_dim(); ++d)
+            if (dst.size(d) != 1 && (x.stride()[d] != dst.stride()[d] || y.stride()[d] != dst.stride()[d]))
+                return false;
+        const data_t* xd = x.data();
+        const data_t* yd = y.data();
+        data_t* out = dst.data();
+        ThreadPool::self().parallel_for(0, dst.d_size(), grain, [&](index_t begin, index_t end) {
+            for (index_t i = begin; i < end; ++i) out[i] = alpha * xd[i] + beta * yd[i];
+        });
+        return true;
+    }
+
+    bool gemm_assign(TensorImpl& dst, const TensorImpl& lhs, const TensorImpl& rhs, const gemm::Epilogue* epilogue) {
+        index_t ln = lhs.n_dim(), rn = rhs.n_dim();
+        if (ln < 2 || rn < 2 || dst.n_dim() != ln) return false;
+        index_t m = lhs.size(ln - 2), k = lhs.size(ln - 1), n = rhs.size(rn - 1);
+        if (rhs.size(rn - 2) != k || dst.size(ln - 2) != m || dst.size(ln - 1) != n) return false;
+        index_t batch = 1;
+        for (index_t d = 0; d < ln - 2; ++d) {
+            if (dst.size(d) != lhs.size(d)) return false;
+            if (rn != 2 && (rn != ln || rhs.size(d) != lhs.size(d))) return false;
+            batch *= lhs.size(d);
+        }
+        if (rn == 2) {
+            m *= batch;
+            batch = 1;
+        }
+        if (dst.d_size() == 0) return true;
+        auto a = lhs.contiguous();
+        auto b = rhs.contiguous();
+        const data_t* ad = static_cast<const TensorImpl&>(*a).data();
+        const data_t* bd = static_cast<const TensorImpl&>(*b).data();
+        // A, B and the epilogue operands are read while C is being written,
+        // so any of them that shares memory with dst goes through a separate
+        // buffer.
+        const data_t* begin = dst.data();
+        const data_t* end = begin + dst.d_size();
+        auto overlaps = [&](const data_t* p, index_t size) { return p != nullptr && p < end && begin < p + size; };
+        bool aliased = overlaps(ad, a->d_size()) || overlaps(bd, b->d_size())
+            || (epilogue != nullptr && (overlaps(epilogue->residual, dst.d_size()) || overlaps(epilogue->bias, n)));
+        auto product = [&](data_t* c) {
+            if (epilogue != nullptr) gemm::run(ad, bd, c, m, n, k, batch, *epilogue);
+            else gemm::run(ad, bd, c, m, n, k, batch);
+        };
+        if (dst.is_contiguous() && !aliased) {
+            product(dst.data());
+            return true;
+        }
+        auto out = Alloc::unique_construct<TensorImpl>(dst.size());
+        product(out->data());
+        dst.copy_(*out);
+        return true;
+    }
+
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<op::MatrixMul_2dim, TensorImpl, TensorImpl>>& src) {
+        return gemm_assign(dst, *src->lhs(), *src->rhs());
+    }
+
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<op::MatrixMul, TensorImpl, TensorImpl>>& src) {
+        return gemm_assign(dst, *src->lhs(), *src->rhs());
+    }
+
+    Exp<TensorImpl> linear(const Exp<TensorImpl>& input, const Exp<TensorImpl>& weight,
+        const TensorImpl* bias, gemm::Activation activation, data_t alpha, const TensorImpl* residual) {
+        const TensorImpl& x = input.self();
+        const TensorImpl& w = weight.self();
+        CHECK_EQUAL(w.n_dim(), 2, "linear() expects a 2D weight, but got %lldD", w.n_dim());
+        index_t k = w.size(0), n = w.size(1), last = x.n_dim() - 1;
+        CHECK_EQUAL(x.size(last), k,
+            "input and weight shapes cannot be multiplied (K is %lld for the input and %lld for the weight)", x.size(last), k);
+        Array<index_t> dims(x.n_dim());
+        index_t m = 1;
+        for (index_t d = 0; d < last; ++d) {
+            dims[d] = x.size(d);
+            m *= x.size(d);
+        }
+        dims[last] = n;
+        auto out = Alloc::shared_construct<TensorImpl>(Shape(std::move(dims)));
+
+        gemm::Epilogue epilogue;
+        epilogue.alpha = alpha;
+        epilogue.activation = activation;
+        Alloc::NonTrivalUniquePtr<TensorImpl> b, r;
+        if (bias != nullptr) {
+            CHECK_TRUE(bias->n_dim() == 1 && bias->size(0) == n, "linear() expects a bias of %lld elements", n);
+            b = bias->contiguous();
+            epilogue.bias = static_cast<const TensorImpl&>(*b).data();
+        }
+        if (residual != nullptr) {
+            CHECK_TRUE(residual->size() == out->size(), "linear() expects the residual to have the shape of the result");
+            r = residual->contiguous();
+            epilogue.residual = static_cast<const TensorImpl&>(*r).data();
+        }
+        auto a = x.contiguous();
+        auto wc = w.contiguous();
+        gemm::run(static_cast<const TensorImpl&>(*a).data(), static_cast<const TensorImpl&>(*wc).data(), out->data(),
+            m, n, k, 1, epilogue);
+        return Exp<TensorImpl>(std::move(out));
+    }
+
+    bool linear_assign(TensorImpl& dst, const TensorImpl& lhs, const TensorImpl& rhs, const TensorImpl& addend,
+        gemm::Activation activation) {
+        if (dst.n_dim() == 0) return false;
+        gemm::Epilogue epilogue;
+        epilogue.activation = activation;
+        auto held = addend.contiguous();
+        const data_t* data = static_cast<const TensorImpl&>(*held).data();
+        if (addend.n_dim() == 1 && addend.size(0) == dst.size(dst.n_dim() - 1)) epilogue.bias = data;
+        // The epilogue adds the residual after the activation, which only
+        // matches the expression when there is none.
+        else if (addend.size() == dst.size() && activation == gemm::Activation::None) epilogue.residual = data;
+        else return false;
+        return gemm_assign(dst, lhs, rhs, &epilogue);
+    }
+
+    namespace rewrite {
+
+        namespace {
+
+            std::atomic<Mode> current_mode{ Mode::Exact };
+
+        }
+
+        void set_mode(Mode mode) {
+            current_mode.store(mode, std::memory_order_relaxed);
+        }
+
+        Mode mode() {
+            return current_mode.load(std::memory_order_relaxed);
+        }
+
+        bool multiply_chain(TensorImpl& dst, std::vector<Factor>& factors) {
+            index_t n = (index_t)factors.size();
+            bool pending = false;
+            for (const Factor& f : factors) {
+                if (f.shape.n_dim() != 2) return false;
+                pending = pending || f.value == nullptr;
+            }
+            if (n < 3 && !pending) return false;
+            for (index_t i = 0; i + 1 < n; ++i)
+                if (factors[i].shape[1] != factors[i + 1].shape[0]) return false;
+            if (dst.n_dim() != 2 || dst.size(0) != factors[0].shape[0] || dst.size(1) != factors[n - 1].shape[1])
+                return false;
+
+            std::vector<index_t> p(n + 1);
+            for (index_t i = 0; i < n; ++i) p[i] = factors[i].shape[0];
+            p[n] = factors[n - 1].shape[1];
+            std::vector<index_t> cost(n * n, 0), split(n * n, 0);
+            for (index_t len = 2; len <= n; ++len) {
+                for (index_t i = 0; i + len <= n; ++i) {
+                    index_t j = i + len - 1;
+                    cost[i * n + j] = std::numeric_limits<index_t>::max();
+                    for (index_t s = i; s < j; ++s) {
+                        index_t c = cost[i * n + s] + cost[(s + 1) * n + j] + gemm::cost(p[i], p[j + 1], p[s + 1]);
+                        if (c < cost[i * n + j]) {
+                            cost[i * n + j] = c;
+                            split[i * n + j] = s;
+                        }
+                    }
+                }
+            }
+
+            for (Factor& f : factors)
+                if (f.value == nullptr) f.value = f.make();
+            std::function<std::shared_ptr<TensorImpl>(index_t, index_t)> product = [&](index_t i, index_t j) {
+                if (i == j) return factors[i].value;
+                index_t s = split[i * n + j];
+                auto out = Alloc::shared_construct<TensorImpl>(Shape({ p[i], p[j + 1] }));
+                gemm_assign(*out, *product(i, s), *product(s + 1, j));
+                return out;
+            };
+            index_t s = split[n - 1];
+            return gemm_assign(dst, *product(0, s), *product(s + 1, n - 1));
+        }
+
+    }
+
+}
@@ -4,126 +4,168 @@
 #include "../../utils/Shape.h"
 #include "../Exp.h"
 #include "../impl/TensorImpl.h"
+#include "Gemm.h"
+#include "MathFunctions.h"
 
+#include <algorithm>
 #include <cmath>
 #include <assert.h>
+#include <functional>
+#include <type_traits>
+#include <vector>
 
 namespace keith {
 
 	namespace op {
 
+        // Shape of an element-wise result, aligning both operands on their
+        // trailing dimensions.
+        template<typename LhsPtr, typename RhsPtr>
+        Shape broadcast_size(const LhsPtr& lhs, const RhsPtr& rhs) {
+            const Shape& ls = lhs->size();
+            const Shape& rs = rhs->size();
+            index_t nl = ls.n_dim(), nr = rs.n_dim(), n = std::max(nl, nr);
+            Shape res(n);
+            for (index_t i = 0; i < n; ++i) {
+                index_t l = i < n - nl ? 1 : ls[i - (n - nl)];
+                index_t r = i < n - nr ? 1 : rs[i - (n - nr)];
+                res[i] = l == 1 ? r : l;
+            }
+            return res;
+        }
+
         struct Add {
-            template<typename LhsType, typename RhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs, std::shared_ptr<RhsType> rhs) {
+            static constexpr const char* name = "add";
+            template<typename LhsPtr, typename RhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs, const RhsPtr& rhs) {
                 CHECK_EXP_BROADCAST(lhs, rhs);
                 return lhs->eval(idx) + rhs->eval(idx);
             }
-            template<typename LhsType, typename RhsType>
-            static Shape size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
-                return lhs->size();
+            template<typename LhsPtr, typename RhsPtr>
+            static Shape size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return broadcast_size(lhs, rhs);
             }
-            template<typename LhsType, typename RhsType>
-            static index_t size(index_t idx, const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static index_t size(index_t idx, const LhsPtr& lhs, const RhsPtr& rhs) {
                 if (idx >= lhs->ndim()) return rhs->size(idx);
                 if (idx >= rhs->ndim()) return lhs->size(idx);
                 return std::max(lhs->size(idx), rhs->size(idx));
             }
-            template<typename LhsType, typename RhsType>
-            static index_t n_dim(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static index_t n_dim(const LhsPtr& lhs, const RhsPtr& rhs) {
                 return max(lhs->ndim(), rhs->ndim());
             }
         };
         struct Sub {
-            template<typename LhsType, typename RhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs, std::shared_ptr<RhsType> rhs) {
+            static constexpr const char* name = "sub";
+            template<typename LhsPtr, typename RhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs, const RhsPtr& rhs) {
                 CHECK_EXP_BROADCAST(lhs, rhs);
                 return lhs->eval(idx) - rhs->eval(idx);
             }
-            template<typename LhsType, typename RhsType>
-            static Shape size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
-                return lhs->size();
+            template<typename LhsPtr, typename RhsPtr>
+            static Shape size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return broadcast_size(lhs, rhs);
             }
         };
         struct Mul {
-            template<typename LhsType, typename RhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs, std::shared_ptr<RhsType> rhs) {
+            static constexpr const char* name = "mul";
+            template<typename LhsPtr, typename RhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs, const RhsPtr& rhs) {
                 CHECK_EXP_BROADCAST(lhs, rhs);
                 return lhs->eval(idx) * rhs->eval(idx);
             }
-            template<typename LhsType, typename RhsType>
-            static Shape size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
-                return lhs->size();
+            template<typename LhsPtr, typename RhsPtr>
+            static Shape size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return broadcast_size(lhs, rhs);
             }
         };
         struct Div {
-            template<typename LhsType, typename RhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs, std::shared_ptr<RhsType> rhs) {
+            static constexpr const char* name = "div";
+            template<typename LhsPtr, typename RhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs, const RhsPtr& rhs) {
                 CHECK_EXP_BROADCAST(lhs, rhs);
                 data_t r = rhs->eval(idx);
                 CHECK_FLOAT_EQUAL(r, 0, "divisor cannot be zero");
                 return lhs->eval(idx) / rhs->eval(idx);
             }
-            template<typename LhsType, typename RhsType>
-            static const Shape& size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
-                return lhs->size();
+            template<typename LhsPtr, typename RhsPtr>
+            static Shape size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return broadcast_size(lhs, rhs);
             }
         };
 
 
 
 
+        struct Pow {
+            static constexpr const char* name = "pow";
+            template<typename LhsPtr, typename RhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs, const RhsPtr& rhs) {
+                CHECK_EXP_BROADCAST(lhs, rhs);
+                return vmath::pow(lhs->eval(idx), rhs->eval(idx));
+            }
+            template<typename LhsPtr, typename RhsPtr>
+            static Shape size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return broadcast_size(lhs, rhs);
+            }
+            static void map(const data_t* x, const data_t* e, data_t* y, index_t n) {
+                vmath::pow(x, e, y, n);
+            }
+        };
+
         struct MatrixMul_2dim {
-            template<typename LhsType, typename RhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs, std::shared_ptr<RhsType> rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs, const RhsPtr& rhs) {
                 const Shape& ls = lhs->size();
                 const Shape& rs = rhs->size();
                 index_t l0 = ls[0], l1 = ls[1], r0 = rs[0], r1 = rs[1];
                 CHECK_EQUAL(l1, r0,
-                    "mat1 and mat2 shapes cannot be multiplied (%dx%d and %dx%d)", l0, l1, r0, r1);
+                    "mat1 and mat2 shapes cannot be multiplied (%lldx%lld and %lldx%lld)", l0, l1, r0, r1);
                 data_t res = 0;
                 for (index_t i = 0; i < l1; ++i) {
                     res += lhs->eval({ idx[0], i }) * rhs->eval({ i, idx[1] });
                 }
                 return res;
             }
-            template<typename LhsType, typename RhsType>
-            static Shape size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static Shape size(const LhsPtr& lhs, const RhsPtr& rhs) {
                 return Shape({ lhs->size()[0], rhs->size()[1] });
             }
         };
         struct MatrixMul_3dim {
-            template<typename LhsType, typename RhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs, std::shared_ptr<RhsType> rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs, const RhsPtr& rhs) {
                 const Shape& ls = lhs->size();
                 const Shape& rs = rhs->size();
                 index_t l0 = ls[0], l1 = ls[1], l2 = ls[2], r0 = rs[0], r1 = rs[1], r2 = rs[2];
 
-                CHECK_EQUAL(l1, r0,
-                    "mat1 and mat2 shapes cannot be multiplied (%dx%d and %dx%d)", l0, l1, r0, r1);
+                CHECK_EQUAL(l2, r1,
+                    "mat1 and mat2 shapes cannot be multiplied (%lldx%lld and %lldx%lld)", l1, l2, r1, r2);
                 data_t res = 0;
                 for (index_t i = 0; i < l2; ++i) {
                     res += lhs->eval({ idx[0], idx[1], i }) * rhs->eval({ idx[0], i, idx[2] });
                 }
                 return res;
             }
-            template<typename LhsType, typename RhsType>
-            static Shape size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static Shape size(const LhsPtr& lhs, const RhsPtr& rhs) {
                 return Shape({ lhs->size()[0], lhs->size()[1], rhs->size()[2] });
             }
         };
         struct MatrixMul {
-            template<typename LhsType, typename RhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs, std::shared_ptr<RhsType> rhs) {
-                int l0, l1;
+            template<typename LhsPtr, typename RhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs, const RhsPtr& rhs) {
+                index_t l0, l1;
                 l0 = lhs->size()[lhs->n_dim() - 2];
                 l1 = lhs->size()[lhs->n_dim() - 1];
-                int r0, r1;
+                index_t r0, r1;
                 r0 = rhs->size()[rhs->n_dim() - 2];
                 r1 = rhs->size()[rhs->n_dim() - 1];
                 data_t res = 0;
                 CHECK_EQUAL(l1, r0,
-                    "mat1 and mat2 shapes cannot be multiplied (%dx%d and %dx%d)", l0, l1, r0, r1);
-                for (int i = 0; i < l1; ++i) {
+                    "mat1 and mat2 shapes cannot be multiplied (%lldx%lld and %lldx%lld)", l0, l1, r0, r1);
+                for (index_t i = 0; i < l1; ++i) {
                     IndexArray lidx = idx;
                     IndexArray ridx = idx;
                     lidx[idx.size() - 1] = i;
@@ -132,8 +174,8 @@ namespace keith {
                 }
                 return res;
             }
-            template<typename LhsType, typename RhsType>
-            static Shape size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static Shape size(const LhsPtr& lhs, const RhsPtr& rhs) {
                 Shape res(std::max(lhs->n_dim(), rhs->n_dim()));
                 int n = res.n_dim();
                 int nl = lhs->n_dim() - 2, nr = rhs->n_dim() - 2;
@@ -153,45 +195,169 @@ namespace keith {
 
 
         struct Neg {
-            template<typename LhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs) {
+            static constexpr const char* name = "neg";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
                 return -lhs->eval(idx);
             }
-            template<typename LhsType, typename RhsType>
-            static const Shape& size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
                 return lhs->size();
             }
         };
         struct Sin {
-            template<typename LhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs) {
-                return std::sin(lhs->eval(idx));
+            static constexpr const char* name = "sin";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::sin(lhs->eval(idx));
             }
-            template<typename LhsType, typename RhsType>
-            static const Shape& size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
                 return lhs->size();
             }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::sin(x, y, n);
+            }
         };
         struct Cos {
-            template<typename LhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs) {
-                return std::cos(lhs->eval(idx));
+            static constexpr const char* name = "cos";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::cos(lhs->eval(idx));
             }
-            template<typename LhsType, typename RhsType>
-            static const Shape& size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
                 return lhs->size();
             }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::cos(x, y, n);
+            }
         };
         struct Tan {
-            template<typename LhsType>
-            static data_t eval(Array<index_t>& idx, std::shared_ptr<LhsType> lhs) {
-                return std::tan(lhs->eval(idx));
+            static constexpr const char* name = "tan";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::tan(lhs->eval(idx));
+            }
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return lhs->size();
+            }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::tan(x, y, n);
+            }
+        };
+        struct Exponential {
+            static constexpr const char* name = "exp";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::exp(lhs->eval(idx));
             }
-            template<typename LhsType, typename RhsType>
-            static const Shape& size(const std::shared_ptr<LhsType>& lhs, const std::shared_ptr<RhsType>& rhs) {
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
                 return lhs->size();
             }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::exp(x, y, n);
+            }
+        };
+        struct Log {
+            static constexpr const char* name = "log";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::log(lhs->eval(idx));
+            }
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return lhs->size();
+            }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::log(x, y, n);
+            }
         };
+        struct Tanh {
+            static constexpr const char* name = "tanh";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::tanh(lhs->eval(idx));
+            }
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return lhs->size();
+            }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::tanh(x, y, n);
+            }
+        };
+        struct Sigmoid {
+            static constexpr const char* name = "sigmoid";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::sigmoid(lhs->eval(idx));
+            }
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return lhs->size();
+            }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::sigmoid(x, y, n);
+            }
+        };
+        struct Erf {
+            static constexpr const char* name = "erf";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::erf(lhs->eval(idx));
+            }
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return lhs->size();
+            }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::erf(x, y, n);
+            }
+        };
+        struct Sqrt {
+            static constexpr const char* name = "sqrt";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::sqrt(lhs->eval(idx));
+            }
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return lhs->size();
+            }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::sqrt(x, y, n);
+            }
+        };
+        struct Rsqrt {
+            static constexpr const char* name = "rsqrt";
+            template<typename LhsPtr>
+            static data_t eval(Array<index_t>& idx, const LhsPtr& lhs) {
+                return vmath::rsqrt(lhs->eval(idx));
+            }
+            template<typename LhsPtr, typename RhsPtr>
+            static const Shape& size(const LhsPtr& lhs, const RhsPtr& rhs) {
+                return lhs->size();
+            }
+            static void map(const data_t* x, data_t* y, index_t n) {
+                vmath::rsqrt(x, y, n);
+            }
+        };
+
+        // Ops that provide a contiguous array kernel.
+        template<typename Op, typename = void>
+        struct has_map : std::false_type {};
+        template<typename Op>
+        struct has_map<Op, std::void_t<decltype(Op::map(std::declval<const data_t*>(), std::declval<data_t*>(), index_t()))>>
+            : std::true_type {};
+
+        // Element-wise ops whose materialization goes through the kernel registry.
+        template<typename Op, typename = void>
+        struct has_name : std::false_type {};
+        template<typename Op>
+        struct has_name<Op, std::void_t<decltype(Op::name)>> : std::true_type {};
 	}
 
 
@@ -218,14 +384,6 @@ namespace keith {
         );
     }
 
-    template<typename RhsType>
-    [[nodiscard]] inline Exp<BinaryExp<op::Mul, TensorImpl, RhsType>> operator*(data_t lhs_value, const Exp<RhsType>& rhs) {
-        auto lhs = Exp<TensorImpl>(std::make_shared<TensorImpl>(Storage(1, lhs_value), Shape({ 1 })));
-        return Exp<BinaryExp<op::Mul, TensorImpl, RhsType>>(
-            std::make_shared<BinaryExp<op::Mul, TensorImpl, RhsType>>(lhs.ptr(), rhs.ptr())
-        );
-    }
-
     template<typename LhsType, typename RhsType>
     [[nodiscard]] inline Exp<BinaryExp<op::Div, LhsType, RhsType>> operator/(const Exp<LhsType>& lhs, const Exp<RhsType>& rhs) {
         return Exp<BinaryExp<op::Div, LhsType, RhsType>>(
@@ -233,6 +391,62 @@ namespace keith {
         );
     }
 
+    template<typename RhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Add, Scalar, RhsType>> operator+(data_t lhs, const Exp<RhsType>& rhs) {
+        return Exp<BinaryExp<op::Add, Scalar, RhsType>>(
+            std::make_shared<BinaryExp<op::Add, Scalar, RhsType>>(Scalar(lhs), rhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Add, LhsType, Scalar>> operator+(const Exp<LhsType>& lhs, data_t rhs) {
+        return Exp<BinaryExp<op::Add, LhsType, Scalar>>(
+            std::make_shared<BinaryExp<op::Add, LhsType, Scalar>>(lhs.ptr(), Scalar(rhs))
+        );
+    }
+
+    template<typename RhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Sub, Scalar, RhsType>> operator-(data_t lhs, const Exp<RhsType>& rhs) {
+        return Exp<BinaryExp<op::Sub, Scalar, RhsType>>(
+            std::make_shared<BinaryExp<op::Sub, Scalar, RhsType>>(Scalar(lhs), rhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Sub, LhsType, Scalar>> operator-(const Exp<LhsType>& lhs, data_t rhs) {
+        return Exp<BinaryExp<op::Sub, LhsType, Scalar>>(
+            std::make_shared<BinaryExp<op::Sub, LhsType, Scalar>>(lhs.ptr(), Scalar(rhs))
+        );
+    }
+
+    template<typename RhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Mul, Scalar, RhsType>> operator*(data_t lhs, const Exp<RhsType>& rhs) {
+        return Exp<BinaryExp<op::Mul, Scalar, RhsType>>(
+            std::make_shared<BinaryExp<op::Mul, Scalar, RhsType>>(Scalar(lhs), rhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Mul, LhsType, Scalar>> operator*(const Exp<LhsType>& lhs, data_t rhs) {
+        return Exp<BinaryExp<op::Mul, LhsType, Scalar>>(
+            std::make_shared<BinaryExp<op::Mul, LhsType, Scalar>>(lhs.ptr(), Scalar(rhs))
+        );
+    }
+
+    template<typename RhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Div, Scalar, RhsType>> operator/(data_t lhs, const Exp<RhsType>& rhs) {
+        return Exp<BinaryExp<op::Div, Scalar, RhsType>>(
+            std::make_shared<BinaryExp<op::Div, Scalar, RhsType>>(Scalar(lhs), rhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Div, LhsType, Scalar>> operator/(const Exp<LhsType>& lhs, data_t rhs) {
+        return Exp<BinaryExp<op::Div, LhsType, Scalar>>(
+            std::make_shared<BinaryExp<op::Div, LhsType, Scalar>>(lhs.ptr(), Scalar(rhs))
+        );
+    }
+
     template<typename LhsType, typename RhsType>
     [[nodiscard]] inline Exp<BinaryExp<op::MatrixMul_2dim, LhsType, RhsType>> mm(const Exp<LhsType>& lhs, const Exp<RhsType>& rhs) {
         return Exp<BinaryExp<op::MatrixMul_2dim, LhsType, RhsType>>(
@@ -247,6 +461,8 @@ namespace keith {
         );
     }
 
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<op::MatrixMul_3dim, TensorImpl, TensorImpl>>& src);
+
     template<typename LhsType, typename RhsType>
     [[nodiscard]] inline Exp<BinaryExp<op::MatrixMul, LhsType, RhsType>> matmul(const Exp<LhsType>& lhs, const Exp<RhsType>& rhs) {
         return Exp<BinaryExp<op::MatrixMul, LhsType, RhsType>>(
@@ -254,25 +470,458 @@ namespace keith {
         );
     }
 
+    template<typename ExpType>
+    inline std::shared_ptr<TensorImpl> einsum_operand(const Exp<ExpType>& operand) {
+        if constexpr (std::is_same_v<ExpType, TensorImpl>) return operand.ptr();
+        else return Alloc::shared_construct<TensorImpl>(operand.ptr());
+    }
+
+    // Evaluates eagerly; sub-expression operands are materialized first.
+    template<typename... Types>
+    [[nodiscard]] inline Exp<TensorImpl> einsum(const std::string& equation, const Exp<Types>&... operands) {
+        std::shared_ptr<TensorImpl> values[] = { einsum_operand(operands)... };
+        std::vector<const TensorImpl*> tensors;
+        for (const auto& value : values) tensors.push_back(value.get());
+        return Exp<TensorImpl>(std::shared_ptr<TensorImpl>(TensorImpl::einsum(equation, tensors)));
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<UnaryExp<op::Neg, LhsType>> operator-(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Neg, LhsType>>(
+            std::make_shared<UnaryExp<op::Neg, LhsType>>(lhs.ptr())
+        );
+    }
+
     template<typename LhsType>
-    [[nodiscard]] inline UnaryExp<op::Neg, LhsType> operator-(const Exp<LhsType>& lhs) {
-        return UnaryExp<op::Neg, LhsType>(lhs.ptr());
+    [[nodiscard]] inline Exp<UnaryExp<op::Sin, LhsType>> sin(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Sin, LhsType>>(
+            std::make_shared<UnaryExp<op::Sin, LhsType>>(lhs.ptr())
+        );
     }
 
     template<typename LhsType>
-    [[nodiscard]] inline UnaryExp<op::Sin, LhsType> sin(const Exp<LhsType>& lhs) {
-        return UnaryExp<op::Sin, LhsType>(lhs.ptr());
+    [[nodiscard]] inline Exp<UnaryExp<op::Cos, LhsType>> cos(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Cos, LhsType>>(
+            std::make_shared<UnaryExp<op::Cos, LhsType>>(lhs.ptr())
+        );
     }
 
     template<typename LhsType>
-    [[nodiscard]] inline UnaryExp<op::Cos, LhsType> cos(const Exp<LhsType>& lhs) {
-        return UnaryExp<op::Cos, LhsType>(lhs.ptr());
+    [[nodiscard]] inline Exp<UnaryExp<op::Tan, LhsType>> tan(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Tan, LhsType>>(
+            std::make_shared<UnaryExp<op::Tan, LhsType>>(lhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<UnaryExp<op::Exponential, LhsType>> exp(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Exponential, LhsType>>(
+            std::make_shared<UnaryExp<op::Exponential, LhsType>>(lhs.ptr())
+        );
     }
 
     template<typename LhsType>
-    [[nodiscard]] inline UnaryExp<op::Tan, LhsType> tan(const Exp<LhsType>& lhs) {
-        return UnaryExp<op::Tan, LhsType>(lhs.ptr());
+    [[nodiscard]] inline Exp<UnaryExp<op::Log, LhsType>> log(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Log, LhsType>>(
+            std::make_shared<UnaryExp<op::Log, LhsType>>(lhs.ptr())
+        );
     }
 
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<UnaryExp<op::Tanh, LhsType>> tanh(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Tanh, LhsType>>(
+            std::make_shared<UnaryExp<op::Tanh, LhsType>>(lhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<UnaryExp<op::Sigmoid, LhsType>> sigmoid(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Sigmoid, LhsType>>(
+            std::make_shared<UnaryExp<op::Sigmoid, LhsType>>(lhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<UnaryExp<op::Erf, LhsType>> erf(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Erf, LhsType>>(
+            std::make_shared<UnaryExp<op::Erf, LhsType>>(lhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<UnaryExp<op::Sqrt, LhsType>> sqrt(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Sqrt, LhsType>>(
+            std::make_shared<UnaryExp<op::Sqrt, LhsType>>(lhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<UnaryExp<op::Rsqrt, LhsType>> rsqrt(const Exp<LhsType>& lhs) {
+        return Exp<UnaryExp<op::Rsqrt, LhsType>>(
+            std::make_shared<UnaryExp<op::Rsqrt, LhsType>>(lhs.ptr())
+        );
+    }
+
+    template<typename LhsType, typename RhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Pow, LhsType, RhsType>> pow(const Exp<LhsType>& lhs, const Exp<RhsType>& rhs) {
+        return Exp<BinaryExp<op::Pow, LhsType, RhsType>>(
+            std::make_shared<BinaryExp<op::Pow, LhsType, RhsType>>(lhs.ptr(), rhs.ptr())
+        );
+    }
+
+    template<typename LhsType>
+    [[nodiscard]] inline Exp<BinaryExp<op::Pow, LhsType, Scalar>> pow(const Exp<LhsType>& lhs, data_t rhs) {
+        return Exp<BinaryExp<op::Pow, LhsType, Scalar>>(
+            std::make_shared<BinaryExp<op::Pow, LhsType, Scalar>>(lhs.ptr(), Scalar(rhs))
+        );
+    }
+
+    // Looks up a registered kernel for `op` over the given operands and runs
+    // it. Returns false when none applies so the caller falls back to eval.
+    bool dispatch_assign(const char* op, TensorImpl& dst, const TensorImpl& lhs, const TensorImpl* rhs);
+
+    template<typename Op, typename = std::enable_if_t<op::has_name<Op>::value>>
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<UnaryExp<Op, TensorImpl>>& src) {
+        return dispatch_assign(Op::name, dst, *src->lhs(), nullptr);
+    }
+
+    template<typename Op, typename = std::enable_if_t<op::has_name<Op>::value>>
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<Op, TensorImpl, TensorImpl>>& src) {
+        return dispatch_assign(Op::name, dst, *src->lhs(), src->rhs().get());
+    }
+
+    // Same for an operation between a tensor and an inline scalar; the scalar
+    // is handed to the kernel by value so it stays in a register.
+    bool dispatch_assign(const char* op, TensorImpl& dst, const TensorImpl& tensor, data_t scalar, bool scalar_lhs);
+
+    template<typename Op, typename = std::enable_if_t<op::has_name<Op>::value>>
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<Op, Scalar, TensorImpl>>& src) {
+        return dispatch_assign(Op::name, dst, *src->rhs(), src->lhs().value(), true);
+    }
+
+    template<typename Op, typename = std::enable_if_t<op::has_name<Op>::value>>
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<Op, TensorImpl, Scalar>>& src) {
+        return dispatch_assign(Op::name, dst, *src->lhs(), src->rhs().value(), false);
+    }
+
+    // dst = alpha * x + beta * y in one pass over dense operands of dst's
+    // shape. Returns false for other layouts.
+    bool axpby_assign(TensorImpl& dst, data_t alpha, const TensorImpl& x, data_t beta, const TensorImpl& y);
+
+    namespace rewrite {
+
+        // A tensor leaf times an optional scalar: x, s * x or x * s.
+        template<typename ExpType>
+        struct Scaled : std::false_type {};
+
+        template<>
+        struct Scaled<TensorImpl> : std::true_type {
+            static data_t factor(const std::shared_ptr<TensorImpl>& ptr) { return 1; }
+            static const TensorImpl& tensor(const std::shared_ptr<TensorImpl>& ptr) { return *ptr; }
+        };
+
+        template<>
+        struct Scaled<BinaryExp<op::Mul, Scalar, TensorImpl>> : std::true_type {
+            using Self = BinaryExp<op::Mul, Scalar, TensorImpl>;
+            static data_t factor(const std::shared_ptr<Self>& ptr) { return ptr->lhs().value(); }
+            static const TensorImpl& tensor(const std::shared_ptr<Self>& ptr) { return *ptr->rhs(); }
+        };
+
+        template<>
+        struct Scaled<BinaryExp<op::Mul, TensorImpl, Scalar>> : std::true_type {
+            using Self = BinaryExp<op::Mul, TensorImpl, Scalar>;
+            static data_t factor(const std::shared_ptr<Self>& ptr) { return ptr->rhs().value(); }
+            static const TensorImpl& tensor(const std::shared_ptr<Self>& ptr) { return *ptr->lhs(); }
+        };
+
+        template<typename Op, typename LhsType, typename RhsType>
+        struct IsAxpby : std::bool_constant<(std::is_same_v<Op, op::Add> || std::is_same_v<Op, op::Sub>)
+            && Scaled<LhsType>::value && Scaled<RhsType>::value
+            && !(std::is_same_v<LhsType, TensorImpl> && std::is_same_v<RhsType, TensorImpl>)> {};
+
+    }
+
+    template<typename Op, typename LhsType, typename RhsType,
+        typename = std::enable_if_t<rewrite::IsAxpby<Op, LhsType, RhsType>::value>>
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<Op, LhsType, RhsType>>& src) {
+        data_t beta = rewrite::Scaled<RhsType>::factor(src->rhs());
+        if constexpr (std::is_same_v<Op, op::Sub>) beta = -beta;
+        return axpby_assign(dst, rewrite::Scaled<LhsType>::factor(src->lhs()), rewrite::Scaled<LhsType>::tensor(src->lhs()),
+            beta, rewrite::Scaled<RhsType>::tensor(src->rhs()));
+    }
+
+    // Writes lhs @ rhs into dst with the blocked GEMM. Handles 2D operands,
+    // batched operands of equal batch shape and a batched lhs against a 2D
+    // rhs. Returns false for other layouts.
+    bool gemm_assign(TensorImpl& dst, const TensorImpl& lhs, const TensorImpl& rhs, const gemm::Epilogue* epilogue = nullptr);
+
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<op::MatrixMul_2dim, TensorImpl, TensorImpl>>& src);
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<op::MatrixMul, TensorImpl, TensorImpl>>& src);
+
+    // activation(alpha * input @ weight + bias) + residual as a single GEMM;
+    // everything after the product is applied to each block of the output
+    // before it is written back. `input` is (..., K), `weight` (K, N), `bias`
+    // (N) and `residual` has the shape of the result, (..., N).
+    [[nodiscard]] Exp<TensorImpl> linear(const Exp<TensorImpl>& input, const Exp<TensorImpl>& weight,
+        const TensorImpl* bias = nullptr, gemm::Activation activation = gemm::Activation::None,
+        data_t alpha = 1, const TensorImpl* residual = nullptr);
+
+    // matmul(x, w) + y, where y is a bias row or a tensor of the result's
+    // shape, or tanh or sigmoid of that for a bias row. Returns false
+    // otherwise.
+    bool linear_assign(TensorImpl& dst, const TensorImpl& lhs, const TensorImpl& rhs, const TensorImpl& addend,
+        gemm::Activation activation);
+
+    namespace rewrite {
+
+        template<typename ExpType>
+        struct LinearProduct : std::false_type {};
+        template<>
+        struct LinearProduct<BinaryExp<op::MatrixMul, TensorImpl, TensorImpl>> : std::true_type {};
+        template<>
+        struct LinearProduct<BinaryExp<op::MatrixMul_2dim, TensorImpl, TensorImpl>> : std::true_type {};
+
+        // Unary ops the GEMM epilogue can apply.
+        template<typename Op>
+        struct Activation : std::false_type {};
+        template<>
+        struct Activation<op::Tanh> : std::true_type {
+            static constexpr gemm::Activation kind = gemm::Activation::Tanh;
+        };
+        template<>
+        struct Activation<op::Sigmoid> : std::true_type {
+            static constexpr gemm::Activation kind = gemm::Activation::Sigmoid;
+        };
+
+    }
+
+    template<typename LhsType, typename = std::enable_if_t<rewrite::LinearProduct<LhsType>::value>>
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<BinaryExp<op::Add, LhsType, TensorImpl>>& src) {
+        return linear_assign(dst, *src->lhs()->lhs(), *src->lhs()->rhs(), *src->rhs(), gemm::Activation::None);
+    }
+
+    template<typename Op, typename LhsType,
+        typename = std::enable_if_t<rewrite::Activation<Op>::value && rewrite::LinearProduct<LhsType>::value>>
+    bool fast_assign(TensorImpl& dst, const std::shared_ptr<UnaryExp<Op, BinaryExp<op::Add, LhsType, TensorImpl>>>& src) {
+        const auto& sum = src->lhs();
+        return linear_assign(dst, *sum->lhs()->lhs(), *sum->lhs()->rhs(), *sum->rhs(), rewrite::Activation<Op>::kind);
+    }
+
+    // Rewrites applied at materialization, before kernel dispatch:
+    //   -(-x)                  -> x
+    //   1 * x, x * 1           -> x
+    //   x / s                  -> x * (1/s) for an inline scalar s that is a
+    //                             power of two, where both give the same result
+    //   scalar-only subtrees   -> one folded scalar
+    //   chains of 2D matmuls   -> cheapest association by shape, with every
+    //                             intermediate product materialized once
+    // and in relaxed mode only, as they can change results:
+    //   a*b + a*c, a*c + b*c   -> a*(b+c), (a+b)*c, and likewise for -,
+    //                             unless the shared factor is an inline scalar;
+    //                             this rounds differently and can overflow
+    //   0 * x, x * 0           -> 0, even where x is inf or NaN
+    // The rest give the same elements as the expression as written, except
+    // for matmul chains, whose sums the GEMM already orders by its blocking.
+    namespace rewrite {
+
+        enum class Mode {
+            Exact,
+            Relaxed
+        };
+
+        // Exact by default.
+        void set_mode(Mode mode);
+        [[nodiscard]] Mode mode();
+
+        template<typename ExpType>
+        struct Constant {
+            static bool test(const std::shared_ptr<ExpType>& ptr) { return false; }
+        };
+
+        template<>
+        struct Constant<TensorImpl> {
+            static bool test(const std::shared_ptr<TensorImpl>& ptr) { return ptr->d_size() == 1; }
+        };
+
+        template<>
+        struct Constant<Scalar> {
+            static bool test(const Scalar& value) { return true; }
+        };
+
+        template<typename Op, typename LhsType, typename RhsType>
+        struct Constant<BinaryExp<Op, LhsType, RhsType>> {
+            static bool test(const std::shared_ptr<BinaryExp<Op, LhsType, RhsType>>& ptr) {
+                return Constant<LhsType>::test(ptr->lhs()) && Constant<RhsType>::test(ptr->rhs());
+            }
+        };
+
+        template<typename Op, typename LhsType>
+        struct Constant<UnaryExp<Op, LhsType>> {
+            static bool test(const std::shared_ptr<UnaryExp<Op, LhsType>>& ptr) {
+                return Constant<LhsType>::test(ptr->lhs());
+            }
+        };
+
+        template<typename ExpType>
+        Scalar fold(const std::shared_ptr<ExpType>& ptr) {
+            IndexArray idx(ptr->n_dim());
+            idx.memset(0);
+            return Scalar(ptr->eval(idx));
+        }
+
+        // Value of a single-element operand, if it is one.
+        inline bool scalar_value(const std::shared_ptr<TensorImpl>& ptr, data_t& value) {
+            if (ptr->d_size() != 1) return false;
+            value = static_cast<const TensorImpl&>(*ptr).data()[0];
+            return true;
+        }
+
+        inline bool scalar_value(const Scalar& scalar, data_t& value) {
+            value = scalar.value();
+            return true;
+        }
+
+        template<typename ExpType>
+        struct IsLeaf : std::bool_constant<std::is_same_v<ExpType, TensorImpl> || std::is_same_v<ExpType, Scalar>> {};
+
+        template<typename ExpType>
+        struct MulParts : std::false_type {};
+        template<typename LhsType, typename RhsType>
+        struct MulParts<BinaryExp<op::Mul, LhsType, RhsType>> : std::true_type {
+            using Lhs = LhsType;
+            using Rhs = RhsType;
+        };
+
+        template<typename Op>
+        struct IsMatmul : std::bool_constant<std::is_same_v<Op, op::MatrixMul> || std::is_same_v<Op, op::MatrixMul_2dim>> {};
+
+        // Flattens nested matmuls into their factors. Anything else is a
+        // factor, materialized lazily so shapes can be checked first.
+        struct Factor {
+            Shape shape;
+            std::shared_ptr<TensorImpl> value;
+            std::function<std::shared_ptr<TensorImpl>()> make;
+        };
+
+        template<typename ExpType>
+        struct Chain {
+            static void collect(const std::shared_ptr<ExpType>& ptr, std::vector<Factor>& factors) {
+                factors.push_back({ ptr->size(), nullptr, [ptr]() { return Alloc::shared_construct<TensorImpl>(ptr); } });
+            }
+        };
+
+        template<>
+        struct Chain<TensorImpl> {
+            static void collect(const std::shared_ptr<TensorImpl>& ptr, std::vector<Factor>& factors) {
+                factors.push_back({ ptr->size(), ptr, nullptr });
+            }
+        };
+
+        template<typename Op, typename LhsType, typename RhsType>
+        struct Chain<BinaryExp<Op, LhsType, RhsType>> {
+            static void collect(const std::shared_ptr<BinaryExp<Op, LhsType, RhsType>>& ptr, std::vector<Factor>& factors) {
+                if constexpr (IsMatmul<Op>::value) {
+                    Chain<LhsType>::collect(ptr->lhs(), factors);
+                    Chain<RhsType>::collect(ptr->rhs(), factors);
+                }
+                else {
+                    factors.push_back({ ptr->size(), nullptr, [ptr]() { return Alloc::shared_construct<TensorImpl>(ptr); } });
+                }
+            }
+        };
+
+        // Multiplies 2D factors in the order minimizing multiply-adds and
+        // writes the result into dst. Returns false when the chain does not
+        // qualify, before anything is computed.
+        bool multiply_chain(TensorImpl& dst, std::vector<Factor>& factors);
+
+    }
+
+    template<typename LhsType>
+    struct Rewrite<UnaryExp<op::Neg, UnaryExp<op::Neg, LhsType>>> {
+        static bool assign(TensorImpl& dst, const std::shared_ptr<UnaryExp<op::Neg, UnaryExp<op::Neg, LhsType>>>& src) {
+            dst = src->lhs()->lhs();
+            return true;
+        }
+    };
+
+    template<typename Op, typename LhsType, typename RhsType>
+    struct Rewrite<BinaryExp<Op, LhsType, RhsType>> {
+        using Self = BinaryExp<Op, LhsType, RhsType>;
+
+        static bool assign(TensorImpl& dst, const std::shared_ptr<Self>& src) {
+            if constexpr (rewrite::IsMatmul<Op>::value) {
+                std::vector<rewrite::Factor> factors;
+                rewrite::Chain<Self>::collect(src, factors);
+                return rewrite::multiply_chain(dst, factors);
+            }
+            else if constexpr (op::has_name<Op>::value) {
+                if constexpr (!rewrite::IsLeaf<LhsType>::value) {
+                    if (rewrite::Constant<LhsType>::test(src->lhs())) {
+                        dst = std::make_shared<BinaryExp<Op, Scalar, RhsType>>(rewrite::fold(src->lhs()), src->rhs());
+                        return true;
+                    }
+                }
+                if constexpr (!rewrite::IsLeaf<RhsType>::value) {
+                    if (rewrite::Constant<RhsType>::test(src->rhs())) {
+                        dst = std::make_shared<BinaryExp<Op, LhsType, Scalar>>(src->lhs(), rewrite::fold(src->rhs()));
+                        return true;
+                    }
+                }
+                if constexpr (std::is_same_v<Op, op::Mul>) {
+                    if constexpr (rewrite::IsLeaf<LhsType>::value && !std::is_same_v<RhsType, Scalar>)
+                        if (identity(dst, src->lhs(), src->rhs())) return true;
+                    if constexpr (rewrite::IsLeaf<RhsType>::value && !std::is_same_v<LhsType, Scalar>)
+                        if (identity(dst, src->rhs(), src->lhs())) return true;
+                }
+                if constexpr (std::is_same_v<Op, op::Div> && std::is_same_v<RhsType, Scalar>) {
+                    data_t r = src->rhs().value();
+                    int exponent;
+                    if (std::fabs(std::frexp(r, &exponent)) == 0.5 && std::isfinite(1 / r)) {
+                        dst = std::make_shared<BinaryExp<op::Mul, LhsType, Scalar>>(src->lhs(), Scalar(1 / r));
+                        return true;
+                    }
+                }
+                if constexpr ((std::is_same_v<Op, op::Add> || std::is_same_v<Op, op::Sub>)
+                    && rewrite::MulParts<LhsType>::value && rewrite::MulParts<RhsType>::value) {
+                    using A = typename rewrite::MulParts<LhsType>::Lhs;
+                    using B = typename rewrite::MulParts<LhsType>::Rhs;
+                    using C = typename rewrite::MulParts<RhsType>::Lhs;
+                    using D = typename rewrite::MulParts<RhsType>::Rhs;
+                    if constexpr (std::is_same_v<A, C> && !std::is_same_v<A, Scalar>) {
+                        if (rewrite::mode() == rewrite::Mode::Relaxed && src->lhs()->lhs() == src->rhs()->lhs()) {
+                            auto sum = std::make_shared<BinaryExp<Op, B, D>>(src->lhs()->rhs(), src->rhs()->rhs());
+                            dst = std::make_shared<BinaryExp<op::Mul, A, BinaryExp<Op, B, D>>>(src->lhs()->lhs(), sum);
+                            return true;
+                        }
+                    }
+                    if constexpr (std::is_same_v<B, D> && !std::is_same_v<B, Scalar>) {
+                        if (rewrite::mode() == rewrite::Mode::Relaxed && src->lhs()->rhs() == src->rhs()->rhs()) {
+                            auto sum = std::make_shared<BinaryExp<Op, A, C>>(src->lhs()->lhs(), src->rhs()->lhs());
+                            dst = std::make_shared<BinaryExp<op::Mul, BinaryExp<Op, A, C>, B>>(sum, src->lhs()->rhs());
+                            return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+        // x * 1, and x * 0 in relaxed mode, for a scalar factor; `other`
+        // must already have the destination's shape.
+        template<typename ScalarPtr, typename OtherPtr>
+        static bool identity(TensorImpl& dst, const ScalarPtr& scalar, const OtherPtr& other) {
+            data_t value;
+            if (!rewrite::scalar_value(scalar, value) || !(other->size() == dst.size())) return false;
+            if (value == 0 && rewrite::mode() == rewrite::Mode::Relaxed && dst.is_contiguous(dst.memory_format())) {
+                std::fill_n(dst.data(), dst.d_size(), 0);
+                return true;
+            }
+            if (value != 1) return false;
+            dst = other;
+            return true;
+        }
+    };
+
 }
 
@@ -0,0 +1,212 @@
+#include "Scan.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace keith {
+
+    namespace scan {
+
+        namespace {
+
+            constexpr index_t grain = 1 << 14;
+            constexpr index_t tile = 256;
+            // Shortest block a single long line is split into.
+            constexpr index_t block_min = 1 << 15;
+            constexpr int lanes = 4;
+            constexpr data_t inf = std::numeric_limits<data_t>::infinity();
+
+            struct Sum {
+                static constexpr bool extreme = false, blocked = true;
+                static constexpr data_t identity = 0;
+                static data_t apply(data_t a, data_t x) { return a + x; }
+            };
+
+            struct Prod {
+                static constexpr bool extreme = false, blocked = true;
+                static constexpr data_t identity = 1;
+                static data_t apply(data_t a, data_t x) { return a * x; }
+            };
+
+            struct LogSumExp {
+                static constexpr bool extreme = false, blocked = false;
+                static constexpr data_t identity = -inf;
+                static data_t apply(data_t a, data_t x) {
+                    if (a != a || x != x) return a + x;
+                    data_t hi = a > x ? a : x, lo = a > x ? x : a;
+                    if (lo == -inf || hi == inf) return hi;
+                    return hi + std::log1p(std::exp(lo - hi));
+                }
+            };
+
+            struct Max {
+                static constexpr bool extreme = true, blocked = false;
+                static constexpr data_t identity = -inf;
+                static bool take(data_t cur, data_t x) { return x != x || x >= cur; }
+            };
+
+            struct Min {
+                static constexpr bool extreme = true, blocked = false;
+                static constexpr data_t identity = inf;
+                static bool take(data_t cur, data_t x) { return x != x || x <= cur; }
+            };
+
+            // Folds a later (value, position) into the running one.
+            template<typename Op>
+            inline void combine(data_t& acc, index_t& at, data_t value, index_t pos) {
+                if constexpr (Op::extreme) {
+                    if (Op::take(acc, value)) {
+                        acc = value;
+                        at = pos;
+                    }
+                }
+                else {
+                    acc = Op::apply(acc, value);
+                }
+            }
+
+            // Scans x[begin, end) of one line into y starting from (acc, at).
+            // Blocked ops scan each group of lanes in registers first, leaving
+            // a single dependent step per group on the running value.
+            template<typename Op>
+            void run(const data_t* x, data_t* y, data_t* ind, index_t begin, index_t end, data_t acc, index_t at) {
+                if constexpr (Op::extreme) {
+                    for (index_t i = begin; i < end; ++i) {
+                        if (Op::take(acc, x[i])) {
+                            acc = x[i];
+                            at = i;
+                        }
+                        y[i] = acc;
+                        if (ind != nullptr) ind[i] = (data_t)at;
+                    }
+                }
+                else {
+                    index_t i = begin;
+                    if constexpr (Op::blocked) {
+                        for (; i + lanes <= end; i += lanes) {
+                            data_t v[lanes];
+                            for (int l = 0; l < lanes; ++l) v[l] = x[i + l];
+                            for (int s = 1; s < lanes; s <<= 1)
+                                for (int l = lanes - 1; l >= s; --l) v[l] = Op::apply(v[l - s], v[l]);
+                            for (int l = 0; l < lanes; ++l) y[i + l] = Op::apply(acc, v[l]);
+                            acc = y[i + lanes - 1];
+                        }
+                    }
+                    for (; i < end; ++i) y[i] = acc = Op::apply(acc, x[i]);
+                }
+            }
+
+            template<typename Op>
+            void reduce(const data_t* x, index_t begin, index_t end, data_t& acc, index_t& at) {
+                acc = Op::identity;
+                at = begin;
+                index_t i = begin;
+                if constexpr (Op::blocked) {
+                    data_t part[lanes];
+                    for (int l = 0; l < lanes; ++l) part[l] = Op::identity;
+                    for (; i + lanes <= end; i += lanes)
+                        for (int l = 0; l < lanes; ++l) part[l] = Op::apply(part[l], x[i + l]);
+                    for (int l = 0; l < lanes; ++l) acc = Op::apply(acc, part[l]);
+                }
+                for (; i < end; ++i) combine<Op>(acc, at, x[i], i);
+            }
+
+            // Scans columns [c0, c1) of one (n, inner) slab row by row.
+            template<typename Op>
+            void scan_columns(const data_t* x, data_t* y, data_t* ind, index_t n, index_t inner, index_t c0, index_t c1) {
+                for (index_t c = c0; c < c1; ++c) {
+                    y[c] = x[c];
+                    if (ind != nullptr) ind[c] = 0;
+                }
+                for (index_t i = 1; i < n; ++i) {
+                    const data_t* xr = x + i * inner;
+                    const data_t* yp = y + (i - 1) * inner;
+                    data_t* yr = y + i * inner;
+                    if constexpr (Op::extreme) {
+                        data_t* ip = ind != nullptr ? ind + (i - 1) * inner : nullptr;
+                        data_t* ir = ind != nullptr ? ind + i * inner : nullptr;
+                        for (index_t c = c0; c < c1; ++c) {
+                            bool take = Op::take(yp[c], xr[c]);
+                            yr[c] = take ? xr[c] : yp[c];
+                            if (ir != nullptr) ir[c] = take ? (data_t)i : ip[c];
+                        }
+                    }
+                    else {
+                        for (index_t c = c0; c < c1; ++c) yr[c] = Op::apply(yp[c], xr[c]);
+                    }
+                }
+            }
+
+            // Reduce every block but the last, scan the block totals serially,
+            // then scan all blocks from their carried-in prefix.
+            template<typename Op>
+            void scan_long(const data_t* x, data_t* y, data_t* ind, index_t n, index_t blocks) {
+                index_t len = (n + blocks - 1) / blocks;
+                std::vector<data_t> carry(blocks);
+                std::vector<index_t> carry_at(blocks);
+                ThreadPool::self().parallel_for(0, blocks - 1, 1, [&](index_t begin, index_t end) {
+                    for (index_t b = begin; b < end; ++b)
+                        reduce<Op>(x, b * len, std::min(n, (b + 1) * len), carry[b + 1], carry_at[b + 1]);
+                });
+                carry[0] = Op::identity;
+                carry_at[0] = 0;
+                for (index_t b = 1; b < blocks; ++b) {
+                    data_t total = carry[b];
+                    index_t pos = carry_at[b];
+                    carry[b] = carry[b - 1];
+                    carry_at[b] = carry_at[b - 1];
+                    combine<Op>(carry[b], carry_at[b], total, pos);
+                }
+                ThreadPool::self().parallel_for(0, blocks, 1, [&](index_t begin, index_t end) {
+                    for (index_t b = begin; b < end; ++b)
+                        run<Op>(x, y, ind, b * len, std::min(n, (b + 1) * len), carry[b], carry_at[b]);
+                });
+            }
+
+            template<typename Op>
+            void scan_all(const data_t* src, data_t* dst, data_t* ind, index_t outer, index_t n, index_t inner) {
+                if (outer == 0 || n == 0 || inner == 0) return;
+                if (inner > 1) {
+                    index_t tiles = (inner + tile - 1) / tile;
+                    ThreadPool::self().parallel_for(0, outer * tiles, std::max<index_t>(grain / (n * tile), 1),
+                        [&](index_t begin, index_t end) {
+                            for (index_t u = begin; u < end; ++u) {
+                                index_t o = u / tiles, t = u % tiles, base = o * n * inner;
+                                scan_columns<Op>(src + base, dst + base, ind != nullptr ? ind + base : nullptr,
+                                    n, inner, t * tile, std::min(inner, (t + 1) * tile));
+                            }
+                        });
+                    return;
+                }
+                index_t threads = std::max<index_t>(ThreadPool::self().n_threads(), 1);
+                index_t blocks = std::min(threads, n / block_min);
+                if (outer >= threads || blocks < 2) {
+                    ThreadPool::self().parallel_for(0, outer, std::max<index_t>(grain / n, 1), [&](index_t begin, index_t end) {
+                        for (index_t o = begin; o < end; ++o)
+                            run<Op>(src + o * n, dst + o * n, ind != nullptr ? ind + o * n : nullptr, 0, n, Op::identity, 0);
+                    });
+                    return;
+                }
+                for (index_t o = 0; o < outer; ++o)
+                    scan_long<Op>(src + o * n, dst + o * n, ind != nullptr ? ind + o * n : nullptr, n, blocks);
+            }
+
+        }
+
+        void scan(const data_t* src, data_t* dst, data_t* indices,
+            index_t outer, index_t n, index_t inner, Kind kind) {
+            switch (kind) {
+            case Kind::Sum: scan_all<Sum>(src, dst, nullptr, outer, n, inner); break;
+            case Kind::Prod: scan_all<Prod>(src, dst, nullptr, outer, n, inner); break;
+            case Kind::Max: scan_all<Max>(src, dst, indices, outer, n, inner); break;
+            case Kind::Min: scan_all<Min>(src, dst, indices, outer, n, inner); break;
+            case Kind::LogSumExp: scan_all<LogSumExp>(src, dst, nullptr, outer, n, inner); break;
+            }
+        }
+
+    }
+
+}
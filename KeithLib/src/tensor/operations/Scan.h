@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+namespace keith {
+
+    // Inclusive prefix scans over a contiguous tensor viewed as (outer, n, inner),
+    // scanning each of the outer * inner lines of length n. Scans across rows
+    // (inner > 1) run column tiles in parallel with the columns as the vector
+    // dimension. Innermost-dimension lines are scanned four elements at a time
+    // so the running value carries across a block in one step; independent
+    // lines run in parallel, and a line too long to share out that way is split
+    // into blocks that are reduced in parallel, combined, then scanned in
+    // parallel from their carried-in prefix.
+    namespace scan {
+
+        enum class Kind {
+            Sum,
+            Prod,
+            Max,
+            Min,
+            LogSumExp
+        };
+
+        // For Max and Min, `indices` (may be nullptr) receives the position of
+        // the running extreme as data_t. Ties take the later position, and NaN
+        // is the extreme once seen.
+        void scan(const data_t* src, data_t* dst, data_t* indices,
+            index_t outer, index_t n, index_t inner, Kind kind);
+
+    }
+
+}
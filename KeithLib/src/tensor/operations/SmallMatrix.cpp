@@ -0,0 +1,265 @@
+#include "SmallMatrix.h"
+#include "../../utils/ThreadPool.h"
+
+#include <atomic>
+#include <cmath>
+#include <utility>
+
+namespace keith {
+
+    namespace small {
+
+        namespace {
+
+            constexpr index_t grain = 256;
+
+            template<index_t N>
+            struct Block {
+                data_t v[N * N][lanes];
+
+                void load(const data_t* src, index_t count) {
+                    for (index_t w = 0; w < count; ++w)
+                        for (index_t e = 0; e < N * N; ++e)
+                            v[e][w] = src[w * N * N + e];
+                }
+                void store(data_t* dst, index_t count) const {
+                    for (index_t w = 0; w < count; ++w)
+                        for (index_t e = 0; e < N * N; ++e)
+                            dst[w * N * N + e] = v[e][w];
+                }
+            };
+
+            template<index_t N>
+            void bmm_block(const Block<N>& a, const Block<N>& b, Block<N>& c) {
+                for (index_t i = 0; i < N; ++i) {
+                    for (index_t j = 0; j < N; ++j) {
+                        data_t acc[lanes];
+                        for (index_t w = 0; w < lanes; ++w)
+                            acc[w] = a.v[i * N][w] * b.v[j][w];
+                        for (index_t k = 1; k < N; ++k)
+                            for (index_t w = 0; w < lanes; ++w)
+                                acc[w] += a.v[i * N + k][w] * b.v[k * N + j][w];
+                        for (index_t w = 0; w < lanes; ++w)
+                            c.v[i * N + j][w] = acc[w];
+                    }
+                }
+            }
+
+            template<index_t N>
+            void bmm_range(const data_t* a, const data_t* b, data_t* c, index_t begin, index_t end) {
+                Block<N> ab{}, bb{}, cb{};
+                for (index_t base = begin; base < end; base += lanes) {
+                    index_t count = std::min(lanes, end - base);
+                    ab.load(a + base * N * N, count);
+                    bb.load(b + base * N * N, count);
+                    bmm_block<N>(ab, bb, cb);
+                    cb.store(c + base * N * N, count);
+                }
+            }
+
+            // Closed forms for 2x2, 3x3 and 4x4 contain no data-dependent
+            // branches, so they run lane-parallel over a whole block. Larger
+            // sizes need pivoting and fall back to one matrix at a time.
+            template<index_t N>
+            void adjugate_block(const Block<N>& m, Block<N>& adj, data_t* det);
+
+            template<>
+            void adjugate_block<2>(const Block<2>& m, Block<2>& adj, data_t* det) {
+                for (index_t w = 0; w < lanes; ++w) {
+                    det[w] = m.v[0][w] * m.v[3][w] - m.v[1][w] * m.v[2][w];
+                    adj.v[0][w] = m.v[3][w];
+                    adj.v[1][w] = -m.v[1][w];
+                    adj.v[2][w] = -m.v[2][w];
+                    adj.v[3][w] = m.v[0][w];
+                }
+            }
+
+            template<>
+            void adjugate_block<3>(const Block<3>& m, Block<3>& adj, data_t* det) {
+                for (index_t w = 0; w < lanes; ++w) {
+                    data_t a = m.v[0][w], b = m.v[1][w], c = m.v[2][w];
+                    data_t d = m.v[3][w], e = m.v[4][w], f = m.v[5][w];
+                    data_t g = m.v[6][w], h = m.v[7][w], i = m.v[8][w];
+                    adj.v[0][w] = e * i - f * h;
+                    adj.v[1][w] = c * h - b * i;
+                    adj.v[2][w] = b * f - c * e;
+                    adj.v[3][w] = f * g - d * i;
+                    adj.v[4][w] = a * i - c * g;
+                    adj.v[5][w] = c * d - a * f;
+                    adj.v[6][w] = d * h - e * g;
+                    adj.v[7][w] = b * g - a * h;
+                    adj.v[8][w] = a * e - b * d;
+                    det[w] = a * adj.v[0][w] + b * adj.v[3][w] + c * adj.v[6][w];
+                }
+            }
+
+            template<>
+            void adjugate_block<4>(const Block<4>& m, Block<4>& adj, data_t* det) {
+                for (index_t w = 0; w < lanes; ++w) {
+                    data_t a00 = m.v[0][w], a01 = m.v[1][w], a02 = m.v[2][w], a03 = m.v[3][w];
+                    data_t a10 = m.v[4][w], a11 = m.v[5][w], a12 = m.v[6][w], a13 = m.v[7][w];
+                    data_t a20 = m.v[8][w], a21 = m.v[9][w], a22 = m.v[10][w], a23 = m.v[11][w];
+                    data_t a30 = m.v[12][w], a31 = m.v[13][w], a32 = m.v[14][w], a33 = m.v[15][w];
+                    data_t s0 = a00 * a11 - a10 * a01, s1 = a00 * a12 - a10 * a02;
+                    data_t s2 = a00 * a13 - a10 * a03, s3 = a01 * a12 - a11 * a02;
+                    data_t s4 = a01 * a13 - a11 * a03, s5 = a02 * a13 - a12 * a03;
+                    data_t c5 = a22 * a33 - a32 * a23, c4 = a21 * a33 - a31 * a23;
+                    data_t c3 = a21 * a32 - a31 * a22, c2 = a20 * a33 - a30 * a23;
+                    data_t c1 = a20 * a32 - a30 * a22, c0 = a20 * a31 - a30 * a21;
+                    det[w] = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+                    adj.v[0][w] = a11 * c5 - a12 * c4 + a13 * c3;
+                    adj.v[1][w] = -a01 * c5 + a02 * c4 - a03 * c3;
+                    adj.v[2][w] = a31 * s5 - a32 * s4 + a33 * s3;
+                    adj.v[3][w] = -a21 * s5 + a22 * s4 - a23 * s3;
+                    adj.v[4][w] = -a10 * c5 + a12 * c2 - a13 * c1;
+                    adj.v[5][w] = a00 * c5 - a02 * c2 + a03 * c1;
+                    adj.v[6][w] = -a30 * s5 + a32 * s2 - a33 * s1;
+                    adj.v[7][w] = a20 * s5 - a22 * s2 + a23 * s1;
+                    adj.v[8][w] = a10 * c4 - a11 * c2 + a13 * c0;
+                    adj.v[9][w] = -a00 * c4 + a01 * c2 - a03 * c0;
+                    adj.v[10][w] = a30 * s4 - a31 * s2 + a33 * s0;
+                    adj.v[11][w] = -a20 * s4 + a21 * s2 - a23 * s0;
+                    adj.v[12][w] = -a10 * c3 + a11 * c1 - a12 * c0;
+                    adj.v[13][w] = a00 * c3 - a01 * c1 + a02 * c0;
+                    adj.v[14][w] = -a30 * s3 + a31 * s1 - a32 * s0;
+                    adj.v[15][w] = a20 * s3 - a21 * s1 + a22 * s0;
+                }
+            }
+
+            // Gauss-Jordan with partial pivoting on a single matrix. Writes the
+            // inverse when `inv` is not null and returns the determinant.
+            template<index_t N>
+            data_t gauss_jordan(const data_t* a, data_t* inv) {
+                data_t m[N][N], r[N][N];
+                for (index_t i = 0; i < N; ++i)
+                    for (index_t j = 0; j < N; ++j) {
+                        m[i][j] = a[i * N + j];
+                        r[i][j] = i == j ? 1 : 0;
+                    }
+                data_t det = 1;
+                for (index_t col = 0; col < N; ++col) {
+                    index_t pivot = col;
+                    for (index_t i = col + 1; i < N; ++i)
+                        if (std::fabs(m[i][col]) > std::fabs(m[pivot][col])) pivot = i;
+                    if (m[pivot][col] == 0) return 0;
+                    if (pivot != col) {
+                        std::swap(m[pivot], m[col]);
+                        std::swap(r[pivot], r[col]);
+                        det = -det;
+                    }
+                    data_t p = m[col][col];
+                    det *= p;
+                    data_t scale = 1 / p;
+                    for (index_t j = 0; j < N; ++j) {
+                        m[col][j] *= scale;
+                        r[col][j] *= scale;
+                    }
+                    for (index_t i = 0; i < N; ++i) {
+                        if (i == col) continue;
+                        data_t f = m[i][col];
+                        for (index_t j = 0; j < N; ++j) {
+                            m[i][j] -= f * m[col][j];
+                            r[i][j] -= f * r[col][j];
+                        }
+                    }
+                }
+                if (inv != nullptr) {
+                    for (index_t i = 0; i < N; ++i)
+                        for (index_t j = 0; j < N; ++j)
+                            inv[i * N + j] = r[i][j];
+                }
+                return det;
+            }
+
+            template<index_t N>
+            bool det_inverse_range(const data_t* a, data_t* inv, data_t* det, index_t begin, index_t end) {
+                bool ok = true;
+                if constexpr (N <= 4) {
+                    Block<N> mb{}, adj{};
+                    data_t d[lanes] = {};
+                    for (index_t base = begin; base < end; base += lanes) {
+                        index_t count = std::min(lanes, end - base);
+                        mb.load(a + base * N * N, count);
+                        adjugate_block<N>(mb, adj, d);
+                        for (index_t w = 0; w < count; ++w) {
+                            if (det != nullptr) det[base + w] = d[w];
+                            if (d[w] == 0) ok = false;
+                        }
+                        if (inv == nullptr) continue;
+                        for (index_t e = 0; e < N * N; ++e)
+                            for (index_t w = 0; w < lanes; ++w)
+                                adj.v[e][w] /= d[w];
+                        adj.store(inv + base * N * N, count);
+                    }
+                }
+                else {
+                    for (index_t i = begin; i < end; ++i) {
+                        data_t d = gauss_jordan<N>(a + i * N * N, inv != nullptr ? inv + i * N * N : nullptr);
+                        if (det != nullptr) det[i] = d;
+                        if (d == 0) ok = false;
+                    }
+                }
+                return ok;
+            }
+
+            template<index_t N>
+            void bmm_n(const data_t* a, const data_t* b, data_t* c, index_t batch) {
+                ThreadPool::self().parallel_for(0, batch, grain, [=](index_t begin, index_t end) {
+                    bmm_range<N>(a, b, c, begin, end);
+                });
+            }
+
+            template<index_t N>
+            bool det_inverse_n(const data_t* a, data_t* inv, data_t* det, index_t batch) {
+                std::atomic<bool> ok(true);
+                ThreadPool::self().parallel_for(0, batch, grain, [&](index_t begin, index_t end) {
+                    if (!det_inverse_range<N>(a, inv, det, begin, end)) ok = false;
+                });
+                return ok;
+            }
+
+            template<template<index_t> class Kernel, typename... Args>
+            auto dispatch(index_t n, Args... args) {
+                switch (n) {
+                case 2: return Kernel<2>::run(args...);
+                case 3: return Kernel<3>::run(args...);
+                case 4: return Kernel<4>::run(args...);
+                case 5: return Kernel<5>::run(args...);
+                case 6: return Kernel<6>::run(args...);
+                case 7: return Kernel<7>::run(args...);
+                default: return Kernel<8>::run(args...);
+                }
+            }
+
+            template<index_t N>
+            struct BmmKernel {
+                static bool run(const data_t* a, const data_t* b, data_t* c, index_t batch) {
+                    bmm_n<N>(a, b, c, batch);
+                    return true;
+                }
+            };
+
+            template<index_t N>
+            struct DetInverseKernel {
+                static bool run(const data_t* a, data_t* inv, data_t* det, index_t batch) {
+                    return det_inverse_n<N>(a, inv, det, batch);
+                }
+            };
+
+        }
+
+        void bmm(const data_t* a, const data_t* b, data_t* c, index_t batch, index_t n) {
+            dispatch<BmmKernel>(n, a, b, c, batch);
+        }
+
+        void det(const data_t* a, data_t* det, index_t batch, index_t n) {
+            dispatch<DetInverseKernel>(n, a, (data_t*)nullptr, det, batch);
+        }
+
+        bool inverse(const data_t* a, data_t* inv, index_t batch, index_t n) {
+            return dispatch<DetInverseKernel>(n, a, inv, (data_t*)nullptr, batch);
+        }
+
+    }
+
+}
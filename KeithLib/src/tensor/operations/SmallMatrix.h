@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+namespace keith {
+
+    // Kernels for large batches of tiny square matrices stored contiguously as
+    // (batch, n, n). Sizes 2..max_size are dispatched to templates with n known
+    // at compile time; matrices are processed `lanes` at a time in a
+    // structure-of-arrays block so the innermost loop runs across the batch.
+    namespace small {
+
+        constexpr index_t max_size = 8;
+        constexpr index_t lanes = 8;
+
+        [[nodiscard]] inline bool supported(index_t n) { return n >= 2 && n <= max_size; }
+
+        void bmm(const data_t* a, const data_t* b, data_t* c, index_t batch, index_t n);
+        void det(const data_t* a, data_t* det, index_t batch, index_t n);
+        [[nodiscard]] bool inverse(const data_t* a, data_t* inv, index_t batch, index_t n);
+
+    }
+
+}
@@ -0,0 +1,149 @@
+#include "Sorting.h"
+#include "../../utils/ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace keith {
+
+    namespace sorting {
+
+        namespace {
+
+            // Radix sort wins between these lengths; above them its scatter
+            // passes stop fitting in cache.
+            constexpr index_t radix_min = 1 << 10;
+            constexpr index_t radix_max = 1 << 18;
+            constexpr index_t heap_max = 64;
+            constexpr int digit_bits = 11;
+            constexpr int n_digits = (64 + digit_bits - 1) / digit_bits;
+            constexpr index_t n_buckets = index_t(1) << digit_bits;
+            constexpr index_t grain = 1 << 14;
+
+            // Monotonic map from doubles to unsigned integers: negative values
+            // have all bits flipped, others only the sign bit. Every NaN maps
+            // to the largest key.
+            inline uint64_t to_key(data_t v) {
+                if (v != v) return std::numeric_limits<uint64_t>::max();
+                uint64_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                return (bits >> 63) != 0 ? ~bits : bits | (uint64_t(1) << 63);
+            }
+
+            struct Item {
+                uint64_t key;
+                index_t index;
+            };
+
+            // Stable LSD radix sort of `items`, using `tmp` as scratch. Digits
+            // that are equal across the whole line are skipped.
+            void radix_sort(std::vector<Item>& items, std::vector<Item>& tmp) {
+                index_t n = (index_t)items.size();
+                std::vector<index_t> hist(n_digits * n_buckets, 0);
+                for (const Item& it : items)
+                    for (int d = 0; d < n_digits; ++d)
+                        ++hist[d * n_buckets + ((it.key >> (d * digit_bits)) & (n_buckets - 1))];
+                tmp.resize(n);
+                for (int d = 0; d < n_digits; ++d) {
+                    index_t* h = hist.data() + d * n_buckets;
+                    if (h[(items[0].key >> (d * digit_bits)) & (n_buckets - 1)] == n) continue;
+                    index_t sum = 0;
+                    for (index_t b = 0; b < n_buckets; ++b) {
+                        index_t c = h[b];
+                        h[b] = sum;
+                        sum += c;
+                    }
+                    for (const Item& it : items)
+                        tmp[h[(it.key >> (d * digit_bits)) & (n_buckets - 1)]++] = it;
+                    items.swap(tmp);
+                }
+            }
+
+            inline bool before(const Item& a, const Item& b) {
+                return a.key < b.key || (a.key == b.key && a.index < b.index);
+            }
+
+            void load(const data_t* line, index_t n, index_t inner, bool flip, std::vector<Item>& items) {
+                items.resize(n);
+                for (index_t i = 0; i < n; ++i) {
+                    uint64_t key = to_key(line[i * inner]);
+                    items[i] = { flip ? ~key : key, i };
+                }
+            }
+
+            void store(const data_t* line, const std::vector<Item>& items, index_t count,
+                data_t* values, data_t* indices, index_t inner) {
+                for (index_t i = 0; i < count; ++i) {
+                    if (values != nullptr) values[i * inner] = line[items[i].index * inner];
+                    if (indices != nullptr) indices[i * inner] = (data_t)items[i].index;
+                }
+            }
+
+            template<typename Func>
+            void for_each_line(index_t outer, index_t n, index_t inner, Func func) {
+                ThreadPool::self().parallel_for(0, outer * inner, std::max<index_t>(grain / std::max<index_t>(n, 1), 1),
+                    [&](index_t begin, index_t end) {
+                        std::vector<Item> items, tmp;
+                        for (index_t t = begin; t < end; ++t) {
+                            index_t o = t / inner, c = t % inner;
+                            func(o * n * inner + c, items, tmp);
+                        }
+                    });
+            }
+
+        }
+
+        void sort(const data_t* src, data_t* values, data_t* indices,
+            index_t outer, index_t n, index_t inner, bool descending) {
+            if (n == 0) return;
+            for_each_line(outer, n, inner, [&](index_t base, std::vector<Item>& items, std::vector<Item>& tmp) {
+                load(src + base, n, inner, descending, items);
+                if (n >= radix_min && n < radix_max) radix_sort(items, tmp);
+                else std::sort(items.begin(), items.end(), before);
+                store(src + base, items, n, values ? values + base : nullptr, indices ? indices + base : nullptr, inner);
+            });
+        }
+
+        void topk(const data_t* src, data_t* values, data_t* indices,
+            index_t outer, index_t n, index_t inner, index_t k, bool largest, bool sorted) {
+            if (k == 0) return;
+            index_t out_line = k * inner;
+            for_each_line(outer, n, inner, [&](index_t base, std::vector<Item>& items, std::vector<Item>& tmp) {
+                index_t o = base / (n * inner), c = base % (n * inner);
+                index_t out = o * out_line + c;
+                const data_t* line = src + base;
+                if (k <= heap_max && k * 8 <= n) {
+                    // Bounded max-heap of the best k seen so far; its root is the
+                    // worst kept entry.
+                    items.clear();
+                    for (index_t i = 0; i < n; ++i) {
+                        uint64_t key = to_key(line[i * inner]);
+                        Item it = { largest ? ~key : key, i };
+                        if ((index_t)items.size() < k) {
+                            items.push_back(it);
+                            std::push_heap(items.begin(), items.end(), before);
+                        }
+                        else if (before(it, items.front())) {
+                            std::pop_heap(items.begin(), items.end(), before);
+                            items.back() = it;
+                            std::push_heap(items.begin(), items.end(), before);
+                        }
+                    }
+                    if (sorted) std::sort_heap(items.begin(), items.end(), before);
+                }
+                else {
+                    load(line, n, inner, largest, items);
+                    if (k < n) std::nth_element(items.begin(), items.begin() + k, items.end(), before);
+                    items.resize(k);
+                    if (sorted) std::sort(items.begin(), items.end(), before);
+                }
+                store(line, items, k, values ? values + out : nullptr, indices ? indices + out : nullptr, inner);
+            });
+        }
+
+    }
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../../utils/Allocator.h"
+#include "../../utils/Storage.h"
+
+namespace keith {
+
+    // Ordering kernels over a contiguous tensor viewed as (outer, n, inner),
+    // ordering each of the outer * inner lines of length n independently and
+    // in parallel. Values are compared through an order-preserving mapping to
+    // unsigned 64-bit keys, so ties keep their original order, -0 sorts before
+    // +0 and NaN sorts above +inf. Medium-length lines use an LSD radix sort on
+    // those keys, others a comparison sort; top-k keeps a bounded heap when k is
+    // small and partitions otherwise. Indices are written as data_t.
+    namespace sorting {
+
+        // Either output may be nullptr.
+        void sort(const data_t* src, data_t* values, data_t* indices,
+            index_t outer, index_t n, index_t inner, bool descending);
+
+        // Writes k entries per line; with `sorted` false their order is
+        // unspecified.
+        void topk(const data_t* src, data_t* values, data_t* indices,
+            index_t outer, index_t n, index_t inner, index_t k, bool largest, bool sorted);
+
+    }
+
+}
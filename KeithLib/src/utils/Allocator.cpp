@@ -2,6 +2,8 @@
 
 #include <memory>
 #include <cstdlib>
+#include <cstdint>
+#include <algorithm>
 
 namespace keith {
     index_t Alloc::allocate_memory_size = 0;
@@ -12,6 +14,7 @@ namespace keith {
     }
 
     void* Alloc::allocate(index_t size) {
+        std::lock_guard<std::mutex> lock(self().mutex_);
         auto iter = self().cache_.find(size);
         void* res;
         if (iter != self().cache_.end()) {
@@ -29,6 +32,7 @@ namespace keith {
     }
 
     void Alloc::deallocate(void* ptr, index_t size) {
+        std::lock_guard<std::mutex> lock(self().mutex_);
         deallocate_memory_size -= size;
         self().cache_.emplace(size, ptr);
     }
@@ -36,4 +40,41 @@ namespace keith {
     bool Alloc::all_clear() {
         return deallocate_memory_size == allocate_memory_size;
     }
+
+    Alloc::Arena::Arena(index_t block_size) : block_size_(block_size) {}
+
+    Alloc::Arena::~Arena() {
+        for (auto& block : blocks_)
+            deallocate(block.ptr, block.size);
+    }
+
+    void* Alloc::Arena::allocate(index_t n_bytes) {
+        constexpr index_t align = 64;
+        n_bytes = (n_bytes + align - 1) / align * align;
+        while (cur_block_ < (index_t)blocks_.size()) {
+            if (cur_ == nullptr) cur_ = blocks_[cur_block_].begin;
+            if (cur_ + n_bytes <= blocks_[cur_block_].end) break;
+            ++cur_block_;
+            cur_ = nullptr;
+        }
+        if (cur_block_ == (index_t)blocks_.size()) {
+            index_t size = std::max(block_size_, n_bytes) + align;
+            void* ptr = Alloc::allocate(size);
+            auto base = reinterpret_cast<std::uintptr_t>(ptr);
+            char* begin = static_cast<char*>(ptr) + (align - base % align) % align;
+            blocks_.push_back({ ptr, size, begin, static_cast<char*>(ptr) + size });
+            cur_ = begin;
+        }
+        void* res = cur_;
+        cur_ += n_bytes;
+        used_ += n_bytes;
+        peak_ = std::max(peak_, used_);
+        return res;
+    }
+
+    void Alloc::Arena::reset() {
+        cur_block_ = 0;
+        cur_ = nullptr;
+        used_ = 0;
+    }
 }
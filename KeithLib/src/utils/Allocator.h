@@ -4,10 +4,16 @@
 #include <map>
 #include <memory>
 #include <iostream>
+#include <vector>
+#include <mutex>
 
 namespace keith {
 
-	typedef unsigned int index_t;
+	// Sizes, offsets and strides are signed 64-bit so that tensors beyond 4G
+	// elements and flipped views with negative strides are representable.
+	// Kernels that provably stay below 2^31 use index32_t internally.
+	typedef long long index_t;
+	typedef int index32_t;
 
 	class Alloc
 	{
@@ -47,11 +53,26 @@ namespace keith {
             return TrivalUniquePtr<T>(static_cast<T*>(raw_ptr), trivial_delete_handler(n_bytes));
         }
 
+        // Standard allocator over the size cache, so that shared_ptr control
+        // blocks are recycled like every other allocation.
+        template<typename T>
+        class CacheAllocator {
+        public:
+            using value_type = T;
+            CacheAllocator() = default;
+            template<typename U>
+            CacheAllocator(const CacheAllocator<U>&) {}
+            T* allocate(std::size_t n) { return static_cast<T*>(Alloc::allocate((index_t)(n * sizeof(T)))); }
+            void deallocate(T* ptr, std::size_t n) { Alloc::deallocate(ptr, (index_t)(n * sizeof(T))); }
+            template<typename U>
+            bool operator==(const CacheAllocator<U>&) const { return true; }
+            template<typename U>
+            bool operator!=(const CacheAllocator<U>&) const { return false; }
+        };
+
         template<typename T, typename... Args>
         static std::shared_ptr<T> shared_construct(Args&&...args) {
-            void* raw_ptr = allocate(sizeof(T));
-            new(raw_ptr) T(std::forward<Args>(args)...);
-            return std::shared_ptr<T>(static_cast<T*>(raw_ptr), nontrivial_delete_handler<T>());
+            return std::allocate_shared<T>(CacheAllocator<T>(), std::forward<Args>(args)...);
         }
 
         template<typename T, typename... Args>
@@ -62,6 +83,36 @@ namespace keith {
         }
         static bool all_clear();
 
+        class Arena {
+        public:
+            explicit Arena(index_t block_size = 1 << 20);
+            Arena(const Arena& other) = delete;
+            Arena& operator=(const Arena& other) = delete;
+            ~Arena();
+
+            void* allocate(index_t n_bytes);
+            template<typename T>
+            T* allocate_array(index_t n) {
+                return static_cast<T*>(allocate(n * sizeof(T)));
+            }
+            void reset();
+            [[nodiscard]] index_t used() const { return used_; }
+            [[nodiscard]] index_t peak() const { return peak_; }
+        private:
+            struct Block {
+                void* ptr;
+                index_t size;
+                char* begin;
+                char* end;
+            };
+            index_t block_size_;
+            std::vector<Block> blocks_;
+            index_t cur_block_ = 0;
+            char* cur_ = nullptr;
+            index_t used_ = 0;
+            index_t peak_ = 0;
+        };
+
     private:
         Alloc() = default;
         ~Alloc() {
@@ -80,6 +131,7 @@ namespace keith {
             void operator()(void* ptr) { std::free(ptr); }
         };
         std::multimap<index_t, std::unique_ptr<void, free_deleter>> cache_;
+        std::mutex mutex_;
 	};
 
 }
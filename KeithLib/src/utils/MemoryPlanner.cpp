@@ -0,0 +1,163 @@
+#include "MemoryPlanner.h"
+#include "../tensor/Exception.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace keith {
+
+    thread_local MemoryPlanner* MemoryPlanner::active_ = nullptr;
+
+    MemoryPlanner::Replay::Replay(index_t n) : in_use(new std::atomic<bool>[n]) {
+        for (index_t i = 0; i < n; ++i) in_use[i].store(false, std::memory_order_relaxed);
+    }
+
+    MemoryPlanner::~MemoryPlanner() {
+        if (active_ == this) active_ = nullptr;
+        if (trace_) trace_->open = false;
+    }
+
+    std::shared_ptr<void> MemoryPlanner::allocate(index_t n_bytes) {
+        if (active_ != nullptr) {
+            if (active_->recording_) return active_->record_allocate(n_bytes);
+            return active_->replay_allocate(n_bytes);
+        }
+        return Alloc::shared_allocate<void>(n_bytes);
+    }
+
+    void MemoryPlanner::begin_record() {
+        CHECK_TRUE(active_ == nullptr, "another memory plan is already active on this thread");
+        trace_ = std::make_shared<Trace>();
+        blocks_.clear();
+        overlaps_.clear();
+        replay_.reset();
+        arena_.reset();
+        base_ = nullptr;
+        planned_ = false;
+        diverged_ = false;
+        recording_ = true;
+        active_ = this;
+    }
+
+    void MemoryPlanner::end_record() {
+        CHECK_TRUE(recording_ && active_ == this, "end_record() without a matching begin_record()");
+        active_ = nullptr;
+        recording_ = false;
+        trace_->open = false;
+        blocks_ = std::move(trace_->blocks);
+        trace_.reset();
+        plan();
+    }
+
+    void MemoryPlanner::begin_replay() {
+        CHECK_TRUE(planned_, "replay requires a recorded plan");
+        CHECK_TRUE(active_ == nullptr, "another memory plan is already active on this thread");
+        cursor_ = 0;
+        diverged_ = false;
+        replaying_ = true;
+        active_ = this;
+    }
+
+    void MemoryPlanner::end_replay() {
+        CHECK_TRUE(replaying_ && active_ == this, "end_replay() without a matching begin_replay()");
+        if (cursor_ != (index_t)blocks_.size()) diverged_ = true;
+        active_ = nullptr;
+        replaying_ = false;
+    }
+
+    std::shared_ptr<void> MemoryPlanner::record_allocate(index_t n_bytes) {
+        std::shared_ptr<Trace> trace = trace_;
+        index_t id = (index_t)trace->blocks.size();
+        trace->blocks.push_back({ n_bytes, trace->clock++, alive, 0, false });
+        void* ptr = Alloc::unique_allocate<void>(n_bytes).release();
+        Alloc::trivial_delete_handler release(n_bytes);
+        return std::shared_ptr<void>(ptr, [trace, id, release](void* p) {
+            if (trace->open) trace->blocks[id].end = trace->clock++;
+            release(p);
+        });
+    }
+
+    std::shared_ptr<void> MemoryPlanner::replay_allocate(index_t n_bytes) {
+        if (diverged_ || cursor_ >= (index_t)blocks_.size() || blocks_[cursor_].size != n_bytes) {
+            diverged_ = true;
+            return Alloc::shared_allocate<void>(n_bytes);
+        }
+        index_t id = cursor_++;
+        const Block& block = blocks_[id];
+        if (!block.in_arena) return Alloc::shared_allocate<void>(n_bytes);
+        for (index_t other : overlaps_[id]) {
+            if (replay_->in_use[other].load(std::memory_order_acquire)) {
+                diverged_ = true;
+                return Alloc::shared_allocate<void>(n_bytes);
+            }
+        }
+        replay_->in_use[id].store(true, std::memory_order_relaxed);
+        return std::shared_ptr<void>(base_ + block.offset, [arena = arena_, replay = replay_, id](void*) {
+            replay->in_use[id].store(false, std::memory_order_release);
+        }, Alloc::CacheAllocator<char>());
+    }
+
+    // Greedy by size: the largest buffers are placed first, each at the
+    // best-fitting gap among the already placed buffers whose lifetimes
+    // overlap with its own.
+    void MemoryPlanner::plan() {
+        std::vector<index_t> order;
+        unplanned_bytes_ = 0;
+        for (index_t i = 0; i < (index_t)blocks_.size(); ++i) {
+            Block& block = blocks_[i];
+            block.in_arena = block.end != alive;
+            if (!block.in_arena) continue;
+            order.push_back(i);
+            unplanned_bytes_ += (block.size + align - 1) / align * align;
+        }
+        std::sort(order.begin(), order.end(), [&](index_t a, index_t b) {
+            if (blocks_[a].size != blocks_[b].size) return blocks_[a].size > blocks_[b].size;
+            return blocks_[a].begin < blocks_[b].begin;
+        });
+
+        arena_bytes_ = 0;
+        std::vector<const Block*> placed, live;
+        for (index_t i : order) {
+            Block& block = blocks_[i];
+            index_t size = (block.size + align - 1) / align * align;
+            live.clear();
+            for (const Block* other : placed)
+                if (other->begin < block.end && block.begin < other->end) live.push_back(other);
+            std::sort(live.begin(), live.end(), [](const Block* a, const Block* b) { return a->offset < b->offset; });
+
+            index_t best = alive, best_gap = alive, prev_end = 0;
+            for (const Block* other : live) {
+                if (other->offset >= prev_end) {
+                    index_t gap = other->offset - prev_end;
+                    if (gap >= size && gap < best_gap) {
+                        best = prev_end;
+                        best_gap = gap;
+                    }
+                }
+                prev_end = std::max(prev_end, other->offset + (other->size + align - 1) / align * align);
+            }
+            block.offset = best != alive ? best : prev_end;
+            arena_bytes_ = std::max(arena_bytes_, block.offset + size);
+            placed.push_back(&block);
+        }
+
+        overlaps_.assign(blocks_.size(), {});
+        for (index_t i : order) {
+            const Block& block = blocks_[i];
+            for (index_t j : order) {
+                const Block& other = blocks_[j];
+                if (other.offset < block.offset + block.size && block.offset < other.offset + other.size)
+                    overlaps_[i].push_back(j);
+            }
+        }
+        replay_ = std::make_shared<Replay>((index_t)blocks_.size());
+
+        if (arena_bytes_ > 0) {
+            arena_ = Alloc::shared_allocate<void>(arena_bytes_ + align);
+            auto addr = reinterpret_cast<std::uintptr_t>(arena_.get());
+            base_ = static_cast<char*>(arena_.get()) + (align - addr % align) % align;
+        }
+        planned_ = true;
+    }
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Allocator.h"
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace keith {
+
+    // Static memory plan for a fixed sequence of tensor operations. One run is
+    // recorded to learn the size and lifetime of every Storage buffer; buffers
+    // that are released before the recording ends are then packed into a
+    // single arena, with buffers whose lifetimes do not overlap sharing bytes.
+    // Later runs replayed under the plan take their storage from the arena
+    // without touching the allocator.
+    //
+    // Only storage created on the recording thread is planned. Buffers still
+    // alive when recording ends (results, parameters created inside the run)
+    // are allocated normally during replay. A replay should issue the same
+    // sequence of storage allocations with the same lifetimes as the recorded
+    // run. When the sizes differ, or a buffer would take arena bytes that a
+    // buffer kept past its recorded lifetime still holds (including one kept
+    // from an earlier replay), the rest of the replay falls back to the
+    // allocator and diverged() reports it.
+    class MemoryPlanner
+    {
+    public:
+        MemoryPlanner() = default;
+        MemoryPlanner(const MemoryPlanner& other) = delete;
+        MemoryPlanner& operator=(const MemoryPlanner& other) = delete;
+        ~MemoryPlanner();
+
+        void begin_record();
+        void end_record();
+        void begin_replay();
+        void end_replay();
+
+        template<typename Func>
+        void record(Func func) {
+            begin_record();
+            try { func(); }
+            catch (...) { end_record(); throw; }
+            end_record();
+        }
+
+        template<typename Func>
+        void replay(Func func) {
+            begin_replay();
+            try { func(); }
+            catch (...) { end_replay(); throw; }
+            end_replay();
+        }
+
+        [[nodiscard]] bool planned() const { return planned_; }
+        [[nodiscard]] bool diverged() const { return diverged_; }
+        [[nodiscard]] index_t n_buffers() const { return (index_t)blocks_.size(); }
+        [[nodiscard]] index_t arena_bytes() const { return arena_bytes_; }
+        [[nodiscard]] index_t unplanned_bytes() const { return unplanned_bytes_; }
+
+        // Storage allocation entry point: served by the planner active on
+        // this thread, or by Alloc when there is none.
+        static std::shared_ptr<void> allocate(index_t n_bytes);
+
+    private:
+        static constexpr index_t align = 64;
+        static constexpr index_t alive = std::numeric_limits<index_t>::max();
+
+        struct Block {
+            index_t size;
+            index_t begin;
+            index_t end;
+            index_t offset;
+            bool in_arena;
+        };
+
+        struct Trace {
+            std::vector<Block> blocks;
+            index_t clock = 0;
+            bool open = true;
+        };
+
+        // Which arena blocks are handed out; outlives the planner so that
+        // buffers released later can still clear their flag.
+        struct Replay {
+            explicit Replay(index_t n);
+            std::unique_ptr<std::atomic<bool>[]> in_use;
+        };
+
+        std::shared_ptr<void> record_allocate(index_t n_bytes);
+        std::shared_ptr<void> replay_allocate(index_t n_bytes);
+        void plan();
+
+        std::shared_ptr<Trace> trace_;
+        std::vector<Block> blocks_;
+        // For each arena block, the arena blocks sharing bytes with it,
+        // itself included.
+        std::vector<std::vector<index_t>> overlaps_;
+        std::shared_ptr<Replay> replay_;
+        std::shared_ptr<void> arena_;
+        char* base_ = nullptr;
+        index_t cursor_ = 0;
+        index_t arena_bytes_ = 0;
+        index_t unplanned_bytes_ = 0;
+        bool planned_ = false;
+        bool diverged_ = false;
+        bool recording_ = false;
+        bool replaying_ = false;
+
+        static thread_local MemoryPlanner* active_;
+    };
+
+}
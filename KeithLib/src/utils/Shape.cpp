@@ -19,21 +19,21 @@ namespace keith {
     Shape::Shape(Array<index_t>&& dim) : _dim(std::move(dim)) {}
 
     index_t Shape::d_size() const {
-        int size = 1;
+        index_t size = 1;
         for (int i = 0; i < _dim.size(); ++i)
             size *= _dim[i];
         return size;
     }
 
     index_t Shape::sub_size(index_t start_dim, index_t end_dim) const {
-        int size = 1;
+        index_t size = 1;
         for (int i = start_dim; i < end_dim; ++i)
             size *= _dim[i];
         return size;
     }
 
     index_t Shape::sub_size(index_t start_dim) const {
-        int size = 1;
+        index_t size = 1;
         for (int i = start_dim; i < _dim.size(); ++i)
             size *= _dim[i];
         return size;
@@ -0,0 +1,197 @@
+#include "SharedMemory.h"
+#include "../tensor/Exception.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace keith {
+
+    namespace {
+
+        constexpr std::uint64_t tag = 0x4d48534854494b45ull;
+        constexpr std::uint32_t layout_version = 1;
+        constexpr std::uint32_t float64 = 1;
+        constexpr index_t max_dims = 16;
+        // Elements start one cache-line-aligned block past the header.
+        constexpr index_t data_offset = 256;
+
+        static_assert(sizeof(data_t) == 8, "segments store data_t as float64");
+        static_assert(std::atomic<std::uint32_t>::is_always_lock_free,
+            "the publish flag is shared between processes");
+
+#ifndef _WIN32
+        std::string posix_name(const std::string& name) {
+            return name.empty() || name[0] != '/' ? "/" + name : name;
+        }
+#endif
+
+    }
+
+    struct SharedMemory::Header {
+        std::uint64_t magic;
+        std::uint32_t layout;
+        std::uint32_t dtype;
+        std::atomic<std::uint32_t> published;
+        std::uint32_t n_dim;
+        std::int64_t elements;
+        std::int64_t dims[max_dims];
+    };
+
+    SharedMemory::SharedMemory(std::string name, void* address, index_t bytes, bool owner, bool writable, void* mapping) :
+        _name(std::move(name)), _address(address), _mapping(mapping), _bytes(bytes), _owner(owner), _writable(writable) {}
+
+    SharedMemory::~SharedMemory() {
+#ifdef _WIN32
+        UnmapViewOfFile(_address);
+        CloseHandle(_mapping);
+#else
+        munmap(_address, _bytes);
+        if (_owner && !_persistent) shm_unlink(posix_name(_name).c_str());
+#endif
+    }
+
+    std::shared_ptr<SharedMemory> SharedMemory::create(const std::string& name, const Shape& shape) {
+        static_assert(sizeof(Header) <= data_offset, "the header must fit before the elements");
+        CHECK_TRUE(shape.n_dim() <= max_dims,
+            "shared memory holds at most %lld dimensions, but got %lld", max_dims, shape.n_dim());
+        index_t bytes = data_offset + shape.d_size() * (index_t)sizeof(data_t);
+#ifdef _WIN32
+        HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+            (DWORD)(bytes >> 32), (DWORD)bytes, name.c_str());
+        CHECK_NOT_NULL(mapping, "cannot create shared memory '%.100s' (error %lu)", name.c_str(), GetLastError());
+        if (GetLastError() == ERROR_ALREADY_EXISTS) {
+            CloseHandle(mapping);
+            THROW_ERROR("shared memory '%.100s' already exists", name.c_str());
+        }
+        void* address = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)bytes);
+        if (address == nullptr) {
+            CloseHandle(mapping);
+            THROW_ERROR("cannot map shared memory '%.100s' (error %lu)", name.c_str(), GetLastError());
+        }
+#else
+        std::string path = posix_name(name);
+        int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        CHECK_TRUE(fd >= 0, "cannot create shared memory '%.100s': %s", name.c_str(), std::strerror(errno));
+        if (ftruncate(fd, (off_t)bytes) != 0) {
+            int error = errno;
+            close(fd);
+            shm_unlink(path.c_str());
+            THROW_ERROR("cannot size shared memory '%.100s': %s", name.c_str(), std::strerror(error));
+        }
+        void* address = mmap(nullptr, (size_t)bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int error = errno;
+        close(fd);
+        if (address == MAP_FAILED) {
+            shm_unlink(path.c_str());
+            THROW_ERROR("cannot map shared memory '%.100s': %s", name.c_str(), std::strerror(error));
+        }
+        void* mapping = nullptr;
+#endif
+        std::shared_ptr<SharedMemory> segment(new SharedMemory(name, address, bytes, true, true, mapping));
+        Header& header = *new(address) Header();
+        header.magic = tag;
+        header.layout = layout_version;
+        header.dtype = float64;
+        header.published.store(0, std::memory_order_relaxed);
+        header.n_dim = (std::uint32_t)shape.n_dim();
+        header.elements = shape.d_size();
+        for (index_t i = 0; i < shape.n_dim(); ++i) header.dims[i] = shape[i];
+        return segment;
+    }
+
+    std::shared_ptr<SharedMemory> SharedMemory::attach(const std::string& name, Access access) {
+        bool writable = access == Access::ReadWrite;
+#ifdef _WIN32
+        HANDLE mapping = OpenFileMappingA(writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, FALSE, name.c_str());
+        CHECK_NOT_NULL(mapping, "no shared memory named '%.100s' (error %lu)", name.c_str(), GetLastError());
+        void* address = MapViewOfFile(mapping, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+        if (address == nullptr) {
+            CloseHandle(mapping);
+            THROW_ERROR("cannot map shared memory '%.100s' (error %lu)", name.c_str(), GetLastError());
+        }
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(address, &info, sizeof(info));
+        index_t bytes = (index_t)info.RegionSize;
+#else
+        int fd = shm_open(posix_name(name).c_str(), writable ? O_RDWR : O_RDONLY, 0);
+        CHECK_TRUE(fd >= 0, "no shared memory named '%.100s': %s", name.c_str(), std::strerror(errno));
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < data_offset) {
+            close(fd);
+            THROW_ERROR("shared memory '%.100s' does not hold a tensor", name.c_str());
+        }
+        index_t bytes = (index_t)info.st_size;
+        void* address = mmap(nullptr, (size_t)bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        int error = errno;
+        close(fd);
+        CHECK_TRUE(address != MAP_FAILED, "cannot map shared memory '%.100s': %s", name.c_str(), std::strerror(error));
+        void* mapping = nullptr;
+#endif
+        std::shared_ptr<SharedMemory> segment(new SharedMemory(name, address, bytes, false, writable, mapping));
+        const Header& header = segment->header();
+        CHECK_TRUE(header.magic == tag && header.layout == layout_version,
+            "shared memory '%.100s' does not hold a tensor", name.c_str());
+        CHECK_TRUE(header.dtype == float64, "shared memory '%.100s' holds another element type", name.c_str());
+        CHECK_TRUE(header.published.load(std::memory_order_acquire) == 1,
+            "shared memory '%.100s' has not been published yet", name.c_str());
+        CHECK_TRUE(header.n_dim <= max_dims && header.elements >= 0
+            && data_offset + header.elements * (index_t)sizeof(data_t) <= bytes,
+            "shared memory '%.100s' has a corrupt header", name.c_str());
+        return segment;
+    }
+
+    bool SharedMemory::unlink(const std::string& name) {
+#ifdef _WIN32
+        return false;
+#else
+        return shm_unlink(posix_name(name).c_str()) == 0;
+#endif
+    }
+
+    void SharedMemory::publish() {
+        CHECK_TRUE(_owner, "only the process that created shared memory '%.100s' can publish it", _name.c_str());
+        header().published.store(1, std::memory_order_release);
+    }
+
+    SharedMemory::Header& SharedMemory::header() const {
+        return *static_cast<Header*>(_address);
+    }
+
+    Shape SharedMemory::shape() const {
+        const Header& h = header();
+        Shape shape((index_t)h.n_dim);
+        for (index_t i = 0; i < (index_t)h.n_dim; ++i) shape[i] = h.dims[i];
+        return shape;
+    }
+
+    index_t SharedMemory::d_size() const {
+        return header().elements;
+    }
+
+    data_t* SharedMemory::data() {
+        CHECK_TRUE(_writable, "shared memory '%.100s' is mapped read-only", _name.c_str());
+        return reinterpret_cast<data_t*>(static_cast<char*>(_address) + data_offset);
+    }
+
+    const data_t* SharedMemory::data() const {
+        return reinterpret_cast<const data_t*>(static_cast<const char*>(_address) + data_offset);
+    }
+
+    Storage SharedMemory::storage() {
+        data_t* base = const_cast<data_t*>(static_cast<const SharedMemory*>(this)->data());
+        return Storage(shared_from_this(), base, d_size(), _writable);
+    }
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Allocator.h"
+#include "Shape.h"
+#include "Storage.h"
+
+#include <memory>
+#include <string>
+
+namespace keith {
+
+    // A named shared-memory segment holding one tensor, so that processes on
+    // one host map a single copy instead of each loading their own. The
+    // segment starts with a header recording the element type and shape,
+    // followed by the elements.
+    //
+    // The process that creates a segment owns its name. It fills in the
+    // elements, publishes the segment, and the name is unlinked once its
+    // SharedMemory and every Storage over it are gone, unless persist() was
+    // called. Processes that attached keep their mapping after the name is
+    // unlinked, and the memory is returned when the last one unmaps it. On
+    // Windows the name always lives exactly as long as some process has the
+    // segment open.
+    class SharedMemory : public std::enable_shared_from_this<SharedMemory>
+    {
+    public:
+        enum class Access {
+            ReadOnly,
+            ReadWrite
+        };
+
+        SharedMemory(const SharedMemory& other) = delete;
+        SharedMemory& operator=(const SharedMemory& other) = delete;
+        ~SharedMemory();
+
+        // A new, unpublished segment for `shape`. Fails if the name is taken.
+        static std::shared_ptr<SharedMemory> create(const std::string& name, const Shape& shape);
+        // Maps a published segment made by create() in any process.
+        static std::shared_ptr<SharedMemory> attach(const std::string& name, Access access = Access::ReadOnly);
+        // Removes a name left behind, e.g. by a producer that crashed.
+        // Returns false when there is no such segment.
+        static bool unlink(const std::string& name);
+
+        // Marks the elements complete; attach() refuses segments until then.
+        void publish();
+        void persist() { _persistent = true; }
+
+        [[nodiscard]] const std::string& name() const { return _name; }
+        [[nodiscard]] Shape shape() const;
+        [[nodiscard]] index_t d_size() const;
+        [[nodiscard]] bool writable() const { return _writable; }
+        [[nodiscard]] data_t* data();
+        [[nodiscard]] const data_t* data() const;
+        // Storage over the elements that keeps this mapping alive. For a
+        // read-only mapping it is copy-on-write.
+        [[nodiscard]] Storage storage();
+    private:
+        struct Header;
+
+        SharedMemory(std::string name, void* address, index_t bytes, bool owner, bool writable, void* mapping);
+        Header& header() const;
+
+        std::string _name;
+        void* _address;
+        // The section handle on Windows, which keeps the name alive.
+        void* _mapping;
+        index_t _bytes;
+        bool _owner;
+        bool _writable;
+        bool _persistent = false;
+    };
+
+}
@@ -0,0 +1 @@
+#include "StaticShape.h"
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Allocator.h"
+#include "Shape.h"
+
+#include <utility>
+
+namespace keith {
+
+    // Compile-time counterpart of Shape. Sizes and strides follow the same
+    // convention as TensorImpl (row-major, stride 0 on dimensions of size 1)
+    // but are computed by the compiler.
+    template<index_t... Dims>
+    struct StaticShape
+    {
+        static_assert(sizeof...(Dims) > 0, "StaticShape needs at least one dimension");
+
+        [[nodiscard]] static constexpr index_t n_dim() { return sizeof...(Dims); }
+        [[nodiscard]] static constexpr index_t d_size() { return (Dims * ...); }
+        [[nodiscard]] static constexpr index_t size(index_t idx) {
+            constexpr index_t dims[] = { Dims... };
+            return dims[idx];
+        }
+        [[nodiscard]] static constexpr index_t stride(index_t idx) {
+            constexpr index_t dims[] = { Dims... };
+            if (dims[idx] == 1) return 0;
+            index_t res = 1;
+            for (index_t i = idx + 1; i < n_dim(); ++i)
+                res *= dims[i];
+            return res;
+        }
+        template<typename... Idx>
+        [[nodiscard]] static constexpr index_t offset(Idx... idx) {
+            static_assert(sizeof...(Idx) == sizeof...(Dims), "Wrong number of indices");
+            return offset_impl(std::make_integer_sequence<index_t, sizeof...(Dims)>(), idx...);
+        }
+        [[nodiscard]] static Shape shape() { return Shape({ Dims... }); }
+
+    private:
+        template<index_t... I, typename... Idx>
+        static constexpr index_t offset_impl(std::integer_sequence<index_t, I...>, Idx... idx) {
+            return ((stride(I) * (index_t)idx) + ... + 0);
+        }
+    };
+
+    template<index_t N, typename Func, index_t... I>
+    constexpr void static_for_impl(Func&& func, std::integer_sequence<index_t, I...>) {
+        (func(std::integral_constant<index_t, I>()), ...);
+    }
+
+    template<index_t N, typename Func>
+    constexpr void static_for(Func&& func) {
+        static_for_impl<N>(std::forward<Func>(func), std::make_integer_sequence<index_t, N>());
+    }
+
+}
@@ -1,23 +1,125 @@
 #include "Storage.h"
+#include "MemoryPlanner.h"
+#include "ThreadPool.h"
 
 #include <cstring>
 
 namespace keith {
 
+    namespace {
+
+        constexpr index_t copy_grain = 1 << 16;
+        constexpr index_t journal_length = 16;
+
+        // The sharer count lives right behind the elements of every buffer.
+        index_t buffer_bytes(index_t size) {
+            return size * sizeof(data_t) + sizeof(std::atomic<index_t>);
+        }
+
+        // The sharer count of memory with no room for one behind it.
+        struct External {
+            External(std::shared_ptr<void> owner, index_t sharers) : owner(std::move(owner)), sharers(sharers) {}
+            std::shared_ptr<void> owner;
+            std::atomic<index_t> sharers;
+        };
+
+        void parallel_copy(data_t* dst, const data_t* src, index_t size) {
+            ThreadPool::self().parallel_for(0, size, copy_grain, [&](index_t begin, index_t end) {
+                std::memcpy(dst + begin, src + begin, (end - begin) * sizeof(data_t));
+            });
+        }
+
+    }
+
+    Storage::Handle::Handle(std::shared_ptr<void> buffer_, index_t size) :
+        buffer(std::move(buffer_)), base(static_cast<data_t*>(buffer.get())),
+        sharers(new(base + size) std::atomic<index_t>(1)), version(0) {}
+    Storage::Handle::Handle(std::shared_ptr<void> buffer_, data_t* base, std::atomic<index_t>* sharers) :
+        buffer(std::move(buffer_)), base(base), sharers(sharers), version(0) {
+        sharers->fetch_add(1, std::memory_order_relaxed);
+    }
+    Storage::Handle::Handle(const Handle& other) :
+        buffer(other.buffer), base(other.base), sharers(other.sharers), version(0) {
+        sharers->fetch_add(1, std::memory_order_relaxed);
+    }
+    Storage::Handle::~Handle() {
+        sharers->fetch_sub(1, std::memory_order_acq_rel);
+    }
+
     Storage::Storage(index_t size) :
-        size_(size), b_ptr(Alloc::shared_allocate<Data>(size * sizeof(data_t) + sizeof(index_t))), f_ptr(b_ptr->data_) {}
+        size_(size), h_ptr(Alloc::shared_construct<Handle>(MemoryPlanner::allocate(buffer_bytes(size)), size)), offset_(0) {}
     Storage::Storage(const Storage& other, index_t offset) :
-        size_(other.size_), b_ptr(other.b_ptr), f_ptr(other.f_ptr + offset) {}
+        size_(other.size_), h_ptr(other.h_ptr), offset_(other.offset_ + offset) {}
+    Storage::Storage(std::shared_ptr<Handle>&& handle, index_t size, index_t offset) :
+        size_(size), h_ptr(std::move(handle)), offset_(offset) {}
     Storage::Storage(index_t size, data_t value) : Storage(size) {
-        for (int i = 0; i < size; ++i)
-            *(f_ptr + i) = value;
+        std::fill_n(h_ptr->base, size, value);
     }
     Storage::Storage(const data_t* data, index_t size) : Storage(size) {
-        std::memcpy(f_ptr, data, size * sizeof(data_t));
+        std::memcpy(h_ptr->base, data, size * sizeof(data_t));
     }
 
     Storage::Storage(const std::initializer_list<data_t>& list) : Storage(list.size()) {
-        std::memcpy(f_ptr, list.begin(), size_ * sizeof(data_t));
+        std::memcpy(h_ptr->base, list.begin(), size_ * sizeof(data_t));
+    }
+
+    Storage::Storage(std::shared_ptr<void> owner, data_t* base, index_t size, bool writable) :
+        size_(size), offset_(0) {
+        // Read-only memory counts one sharer that never lets go, so any
+        // mutable access detaches first.
+        auto external = Alloc::shared_construct<External>(std::move(owner), writable ? 0 : 1);
+        std::atomic<index_t>* sharers = &external->sharers;
+        h_ptr = Alloc::shared_construct<Handle>(std::shared_ptr<void>(std::move(external), base), base, sharers);
+        h_ptr->external = writable;
+    }
+
+    Storage Storage::lazy_copy() const {
+        // Sharing would move the next writer here to a private copy, where
+        // other processes no longer see its writes.
+        if (h_ptr->external) {
+            Storage copy(size_);
+            parallel_copy(copy.h_ptr->base, h_ptr->base, size_);
+            return Storage(std::move(copy.h_ptr), size_, offset_);
+        }
+        return Storage(Alloc::shared_construct<Handle>(*h_ptr), size_, offset_);
+    }
+
+    data_t* Storage::data(index_t begin, index_t end) {
+        if (shared()) detach();
+        Handle& handle = *h_ptr;
+        std::lock_guard<std::mutex> lock(handle.mutex);
+        index_t version = handle.version.fetch_add(1, std::memory_order_acq_rel) + 1;
+        if ((index_t)handle.journal.size() == journal_length) handle.journal.erase(handle.journal.begin());
+        handle.journal.push_back({ version, offset_ + begin, offset_ + end });
+        return handle.base + offset_;
+    }
+
+    bool Storage::written_since(index_t version, index_t& begin, index_t& end) const {
+        Handle& handle = *h_ptr;
+        std::lock_guard<std::mutex> lock(handle.mutex);
+        index_t now = handle.version.load(std::memory_order_acquire), covered = 0;
+        begin = end = 0;
+        for (const Write& w : handle.journal) {
+            if (w.version <= version) continue;
+            begin = covered == 0 ? w.begin : std::min(begin, w.begin);
+            end = covered == 0 ? w.end : std::max(end, w.end);
+            ++covered;
+        }
+        begin -= offset_;
+        end -= offset_;
+        return covered == now - version;
+    }
+
+    void Storage::detach() {
+        Handle& handle = *h_ptr;
+        std::shared_ptr<void> buffer = MemoryPlanner::allocate(buffer_bytes(size_));
+        data_t* base = static_cast<data_t*>(buffer.get());
+        parallel_copy(base, handle.base, size_);
+        auto sharers = new(base + size_) std::atomic<index_t>(1);
+        handle.sharers->fetch_sub(1, std::memory_order_acq_rel);
+        handle.buffer = std::move(buffer);
+        handle.base = base;
+        handle.sharers = sharers;
     }
 
-}
\ No newline at end of file
+}
@@ -8,6 +8,8 @@
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <iostream>
 #include <assert.h>
 
@@ -53,7 +55,9 @@ namespace keith {
             return d_ptr.get()[idx];
         }
     public:
-        int size() const { return this->size_; }
+        index_t size() const { return this->size_; }
+        DType* data() { return d_ptr.get(); }
+        const DType* data() const { return d_ptr.get(); }
         void memset(int value) const { std::memset(d_ptr.get(), value, size_ * sizeof(DType)); }
         void fill(DType value) const { std::fill_n(d_ptr.get(), size_, value); }
     private:
@@ -61,16 +65,26 @@ namespace keith {
         Alloc::TrivalUniquePtr<DType> d_ptr;
 	};
 
+    typedef Array<index_t> IndexArray;
+
     typedef double data_t;
 
 	class Storage
 	{
     public:
         explicit Storage(index_t size);
+        // A view `offset` elements past the start of `other`, which may
+        // itself be a view.
         Storage(const Storage& other, index_t offset);
         Storage(index_t size, data_t value);
         Storage(const data_t* data, index_t size);
         Storage(const std::initializer_list<data_t>& list);
+        // Elements in memory this storage does not own, such as a mapped
+        // shared-memory segment; `owner` is kept alive while they are in use.
+        // Read-only memory is copy-on-write: the first mutable access moves
+        // the storage to a private copy. Writable memory is never left, so
+        // writes stay visible to everyone else mapping it.
+        Storage(std::shared_ptr<void> owner, data_t* base, index_t size, bool writable);
 
         explicit Storage(const Storage& other) = default;
         explicit Storage(Storage&& other) = default;
@@ -79,16 +93,78 @@ namespace keith {
 
         Storage& operator=(const Storage& other) = delete;
 
-        data_t operator[](index_t idx) const { return f_ptr[idx]; }
-        data_t& operator[](index_t idx) { return f_ptr[idx]; }
-        [[nodiscard]] index_t offset() const { return f_ptr - b_ptr->data_; }
+        // One element reached through a mutable accessor. Reading it goes
+        // through the const path, so only assigning to it counts as a write.
+        class Element {
+        public:
+            Element(const Element& other) = default;
+            operator data_t() const { return static_cast<const Storage&>(storage_).data()[idx_]; }
+            Element& operator=(data_t value) { storage_.data()[idx_] = value; return *this; }
+            Element& operator=(const Element& other) { return *this = static_cast<data_t>(other); }
+            Element& operator+=(data_t value) { return *this = *this + value; }
+            Element& operator-=(data_t value) { return *this = *this - value; }
+            Element& operator*=(data_t value) { return *this = *this * value; }
+            Element& operator/=(data_t value) { return *this = *this / value; }
+        private:
+            friend class Storage;
+            Element(Storage& storage, index_t idx) : storage_(storage), idx_(idx) {}
+            Storage& storage_;
+            index_t idx_;
+        };
+
+        data_t operator[](index_t idx) const { return data()[idx]; }
+        Element operator[](index_t idx) { return Element(*this, idx); }
+        [[nodiscard]] index_t offset() const { return offset_; }
+        // Every mutable access counts as a write of the whole buffer.
+        [[nodiscard]] data_t* data() {
+            if (shared()) detach();
+            h_ptr->version.fetch_add(1, std::memory_order_acq_rel);
+            return h_ptr->base + offset_;
+        }
+        [[nodiscard]] const data_t* data() const { return h_ptr->base + offset_; }
+        // Mutable access that records only elements [begin, end) past the
+        // offset as written. Writes elsewhere through it go unnoticed.
+        [[nodiscard]] data_t* data(index_t begin, index_t end);
+
+        // Counts writes to the buffer; views that share it share the count.
+        [[nodiscard]] index_t version() const { return h_ptr->version.load(std::memory_order_acquire); }
+        // Whether every write since `version` went through data(begin, end),
+        // and if so the span they cover, relative to the offset. Only the
+        // most recent writes are remembered.
+        [[nodiscard]] bool written_since(index_t version, index_t& begin, index_t& end) const;
+
+        // Copy-on-write copy: the result shares the buffer with this storage
+        // until either side is written through a mutable accessor, at which
+        // point the writer moves to a private copy. Views made by copying a
+        // Storage keep sharing one handle, so they follow the writer.
+        // Copies of writable external memory are taken eagerly instead.
+        [[nodiscard]] Storage lazy_copy() const;
+        [[nodiscard]] bool shared() const { return h_ptr->sharers->load(std::memory_order_acquire) > 1; }
+        void detach();
         index_t size_;
     private:
-        struct Data {
-            data_t data_[1];
+        struct Write {
+            index_t version, begin, end;
         };
-        std::shared_ptr<Data> b_ptr;
-        data_t* f_ptr;
+        struct Handle {
+            Handle(std::shared_ptr<void> buffer, index_t size);
+            Handle(std::shared_ptr<void> buffer, data_t* base, std::atomic<index_t>* sharers);
+            Handle(const Handle& other);
+            ~Handle();
+            std::shared_ptr<void> buffer;
+            data_t* base;
+            std::atomic<index_t>* sharers;
+            std::atomic<index_t> version;
+            // Writable external memory, which must never be detached from.
+            bool external = false;
+            // Ranged writes, oldest first, from buffer offset 0.
+            std::mutex mutex;
+            std::vector<Write> journal;
+        };
+        Storage(std::shared_ptr<Handle>&& handle, index_t size, index_t offset);
+
+        std::shared_ptr<Handle> h_ptr;
+        index_t offset_;
 	};
 
 }
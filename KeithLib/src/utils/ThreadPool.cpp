@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+
+#include <cstdlib>
+
+namespace keith {
+
+    ThreadPool& ThreadPool::self() {
+        static ThreadPool pool([]() {
+            const char* env = std::getenv("KEITH_NUM_THREADS");
+            if (env != nullptr && std::atoi(env) > 0) return (index_t)std::atoi(env);
+            return std::max<index_t>(std::thread::hardware_concurrency(), 1);
+        }());
+        return pool;
+    }
+
+    ThreadPool::ThreadPool(index_t n_threads) : next_(0), pending_(0), stop_(false) {
+        for (index_t i = 0; i < n_threads; ++i)
+            workers_.push_back(std::make_unique<Worker>());
+        for (index_t i = 0; i < n_threads; ++i)
+            threads_.emplace_back([this, i]() { loop(i); });
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        sleep_cv_.notify_all();
+        for (auto& thread : threads_)
+            thread.join();
+    }
+
+    int& ThreadPool::worker_id() {
+        thread_local int id = -1;
+        return id;
+    }
+
+    void ThreadPool::submit(Task task) {
+        int id = worker_id();
+        index_t target = id >= 0 ? (index_t)id : next_++ % n_threads();
+        {
+            std::lock_guard<std::mutex> lock(workers_[target]->mutex);
+            workers_[target]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            ++pending_;
+        }
+        sleep_cv_.notify_one();
+    }
+
+    bool ThreadPool::pop(index_t id, Task& task) {
+        std::lock_guard<std::mutex> lock(workers_[id]->mutex);
+        if (workers_[id]->tasks.empty()) return false;
+        task = std::move(workers_[id]->tasks.back());
+        workers_[id]->tasks.pop_back();
+        return true;
+    }
+
+    bool ThreadPool::steal(index_t id, Task& task) {
+        for (index_t i = 1; i <= n_threads(); ++i) {
+            auto& victim = *workers_[(id + i) % n_threads()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.empty()) continue;
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    bool ThreadPool::run_one() {
+        int id = worker_id();
+        Task task;
+        if ((id >= 0 && pop(id, task)) || steal(id >= 0 ? id : 0, task)) {
+            --pending_;
+            task();
+            return true;
+        }
+        return false;
+    }
+
+    void ThreadPool::loop(index_t id) {
+        worker_id() = (int)id;
+        while (true) {
+            if (run_one()) continue;
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleep_cv_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+            if (stop_ && pending_ == 0) return;
+        }
+    }
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Allocator.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace keith {
+
+    class ThreadPool
+    {
+    public:
+        using Task = std::function<void()>;
+
+        static ThreadPool& self();
+
+        void submit(Task task);
+        bool run_one();
+        [[nodiscard]] index_t n_threads() const { return (index_t)workers_.size(); }
+
+        template<typename Func>
+        void parallel_for(index_t begin, index_t end, index_t grain, Func func) {
+            if (begin >= end) return;
+            index_t total = end - begin;
+            index_t n_chunks = std::min<index_t>((total + grain - 1) / std::max<index_t>(grain, 1), n_threads() * 4);
+            if (n_chunks <= 1) {
+                func(begin, end);
+                return;
+            }
+            index_t chunk = (total + n_chunks - 1) / n_chunks;
+            std::atomic<index_t> remaining(n_chunks - 1);
+            // Chunks refer to this frame, so a throwing one must not unwind
+            // it before the rest are done; the first error is rethrown here.
+            std::exception_ptr error;
+            std::mutex error_mutex;
+            auto run = [&func, &error, &error_mutex](index_t lo, index_t hi) {
+                try {
+                    if (lo < hi) func(lo, hi);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+            };
+            for (index_t c = 1; c < n_chunks; ++c) {
+                index_t lo = begin + c * chunk, hi = std::min(end, lo + chunk);
+                submit([&run, &remaining, lo, hi]() {
+                    run(lo, hi);
+                    --remaining;
+                });
+            }
+            run(begin, std::min(end, begin + chunk));
+            while (remaining > 0) {
+                if (!run_one()) std::this_thread::yield();
+            }
+            if (error) std::rethrow_exception(error);
+        }
+
+    private:
+        explicit ThreadPool(index_t n_threads);
+        ~ThreadPool();
+        ThreadPool(const ThreadPool& other) = delete;
+        ThreadPool& operator=(const ThreadPool& other) = delete;
+
+        struct Worker {
+            std::deque<Task> tasks;
+            std::mutex mutex;
+        };
+
+        static int& worker_id();
+        bool pop(index_t id, Task& task);
+        bool steal(index_t id, Task& task);
+        void loop(index_t id);
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+        std::vector<std::thread> threads_;
+        std::atomic<index_t> next_;
+        std::atomic<index_t> pending_;
+        std::atomic<bool> stop_;
+        std::mutex sleep_mutex_;
+        std::condition_variable sleep_cv_;
+    };
+
+}
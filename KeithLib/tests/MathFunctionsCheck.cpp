@@ -0,0 +1,149 @@
+// Checks the vmath functions against libm, in both modes, to the bounds
+// documented in src/tensor/operations/MathFunctions.h. Build it together
+// with the library sources, e.g.
+//
+//   g++ -std=c++17 -O2 -pthread -Isrc tests/MathFunctionsCheck.cpp $(find src -name '*.cpp') -o math_check
+//
+// It prints the worst error seen per function and exits non-zero if any
+// bound is exceeded.
+#include "tensor/operations/MathFunctions.h"
+
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace keith;
+
+namespace {
+
+    enum class Metric {
+        Ulp,
+        Absolute,
+        Relative
+    };
+
+    constexpr index_t samples = 200000;
+    int failures = 0;
+
+    double ulps(double a, double b) {
+        if (a == b || (std::isnan(a) && std::isnan(b))) return 0;
+        if (std::isnan(a) || std::isnan(b) || std::isinf(a) || std::isinf(b)) return INFINITY;
+        auto key = [](double x) {
+            std::int64_t bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            return bits < 0 ? INT64_MIN - bits : bits;
+        };
+        std::int64_t ka = key(a), kb = key(b);
+        return (double)(ka > kb ? (std::uint64_t)ka - (std::uint64_t)kb : (std::uint64_t)kb - (std::uint64_t)ka);
+    }
+
+    double error(double got, double want, Metric metric) {
+        if (metric == Metric::Ulp) return ulps(got, want);
+        if (got == want) return 0;
+        if (std::isnan(got) || std::isnan(want) || std::isinf(got) || std::isinf(want)) return INFINITY;
+        double diff = std::fabs(got - want);
+        return metric == Metric::Absolute ? diff : diff / std::fabs(want);
+    }
+
+    // Inputs drawn uniformly from [lo, hi], or log-uniformly in magnitude when
+    // `log_scale` is set, plus the end points.
+    std::vector<double> inputs(double lo, double hi, bool log_scale = false) {
+        std::mt19937_64 rng(42);
+        std::vector<double> res{ lo, hi };
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for (index_t i = 0; i < samples; ++i) {
+            double u = uniform(rng);
+            if (!log_scale) res.push_back(lo + (hi - lo) * u);
+            else res.push_back(std::exp(std::log(lo) + (std::log(hi) - std::log(lo)) * u) * (i % 2 || lo > 0 ? 1 : -1));
+        }
+        return res;
+    }
+
+    void check(const char* name, vmath::Mode mode, const std::vector<double>& xs,
+        double (*scalar)(double), void (*array)(const data_t*, data_t*, index_t),
+        double (*reference)(double), Metric metric, double bound) {
+        vmath::set_mode(mode);
+        std::vector<double> ys(xs.size());
+        array(xs.data(), ys.data(), (index_t)xs.size());
+        double worst = 0, at = 0;
+        bool consistent = true;
+        for (size_t i = 0; i < xs.size(); ++i) {
+            double want = reference(xs[i]);
+            if (want != 0 && std::fabs(want) < DBL_MIN) continue;
+            double e = error(ys[i], want, metric);
+            if (!(e <= worst)) {
+                worst = e;
+                at = xs[i];
+            }
+            double s = scalar(xs[i]);
+            consistent = consistent && (s == ys[i] || (std::isnan(s) && std::isnan(ys[i])));
+        }
+        bool ok = worst <= bound && consistent;
+        if (!ok) ++failures;
+        const char* unit = metric == Metric::Ulp ? "ulp" : metric == Metric::Absolute ? "abs" : "rel";
+        std::printf("%-5s %-8s %-6s worst %-10.3g at %-12.6g bound %-8.3g%s%s\n", ok ? "ok" : "FAIL", name,
+            mode == vmath::Mode::Strict ? "strict" : "fast", worst, at, bound, unit,
+            consistent ? "" : " (array and scalar paths disagree)");
+    }
+
+    double sigmoid_reference(double x) { return 1.0 / (1.0 + std::exp(-x)); }
+    double rsqrt_reference(double x) { return 1.0 / std::sqrt(x); }
+
+}
+
+int main() {
+    using vmath::Mode;
+    auto exp_in = inputs(-700, 709);
+    auto log_in = inputs(1e-300, 1e300, true);
+    auto trig_in = inputs(-524288.0, 524288.0);
+    auto huge_in = inputs(524288.0, 1e300, true);
+    auto tanh_in = inputs(-30, 30);
+    auto sigmoid_in = inputs(-40, 40);
+    auto erf_in = inputs(-6, 6);
+    auto rsqrt_in = inputs(1e-300, 1e300, true);
+
+    using Scalar = double (*)(double);
+    using Array = void (*)(const data_t*, data_t*, index_t);
+    Scalar exp_s = vmath::exp, log_s = vmath::log, sin_s = vmath::sin, cos_s = vmath::cos, tan_s = vmath::tan;
+    Scalar tanh_s = vmath::tanh, sigmoid_s = vmath::sigmoid, erf_s = vmath::erf, sqrt_s = vmath::sqrt, rsqrt_s = vmath::rsqrt;
+    Array exp_a = vmath::exp, log_a = vmath::log, sin_a = vmath::sin, cos_a = vmath::cos, tan_a = vmath::tan;
+    Array tanh_a = vmath::tanh, sigmoid_a = vmath::sigmoid, erf_a = vmath::erf, sqrt_a = vmath::sqrt, rsqrt_a = vmath::rsqrt;
+    Scalar exp_r = std::exp, log_r = std::log, sin_r = std::sin, cos_r = std::cos, tan_r = std::tan;
+    Scalar tanh_r = std::tanh, erf_r = std::erf, sqrt_r = std::sqrt;
+
+    check("exp", Mode::Strict, exp_in, exp_s, exp_a, exp_r, Metric::Ulp, 1);
+    check("exp", Mode::Fast, exp_in, exp_s, exp_a, exp_r, Metric::Relative, 7.5e-9);
+    check("log", Mode::Strict, log_in, log_s, log_a, log_r, Metric::Ulp, 1);
+    check("log", Mode::Fast, log_in, log_s, log_a, log_r, Metric::Absolute, 7.5e-10);
+    check("sin", Mode::Strict, trig_in, sin_s, sin_a, sin_r, Metric::Ulp, 2);
+    check("sin", Mode::Fast, trig_in, sin_s, sin_a, sin_r, Metric::Absolute, 3e-8);
+    check("cos", Mode::Strict, trig_in, cos_s, cos_a, cos_r, Metric::Ulp, 2);
+    check("cos", Mode::Fast, trig_in, cos_s, cos_a, cos_r, Metric::Absolute, 3e-8);
+    check("tan", Mode::Strict, trig_in, tan_s, tan_a, tan_r, Metric::Ulp, 3);
+    check("tan", Mode::Fast, trig_in, tan_s, tan_a, tan_r, Metric::Relative, 3.5e-8);
+    // Beyond 2^19 both modes defer to libm.
+    for (Mode mode : { Mode::Strict, Mode::Fast }) {
+        check("sin", mode, huge_in, sin_s, sin_a, sin_r, Metric::Ulp, 0);
+        check("cos", mode, huge_in, cos_s, cos_a, cos_r, Metric::Ulp, 0);
+        check("tan", mode, huge_in, tan_s, tan_a, tan_r, Metric::Ulp, 0);
+    }
+    check("tanh", Mode::Strict, tanh_in, tanh_s, tanh_a, tanh_r, Metric::Ulp, 4);
+    check("tanh", Mode::Fast, tanh_in, tanh_s, tanh_a, tanh_r, Metric::Relative, 2e-8);
+    check("sigmoid", Mode::Strict, sigmoid_in, sigmoid_s, sigmoid_a, sigmoid_reference, Metric::Ulp, 4);
+    check("sigmoid", Mode::Fast, sigmoid_in, sigmoid_s, sigmoid_a, sigmoid_reference, Metric::Relative, 7.5e-9);
+    check("erf", Mode::Strict, erf_in, erf_s, erf_a, erf_r, Metric::Ulp, 0);
+    check("erf", Mode::Fast, erf_in, erf_s, erf_a, erf_r, Metric::Absolute, 1.5e-7);
+    check("sqrt", Mode::Strict, rsqrt_in, sqrt_s, sqrt_a, sqrt_r, Metric::Ulp, 0);
+    check("sqrt", Mode::Fast, rsqrt_in, sqrt_s, sqrt_a, sqrt_r, Metric::Ulp, 0);
+    check("rsqrt", Mode::Strict, rsqrt_in, rsqrt_s, rsqrt_a, rsqrt_reference, Metric::Ulp, 0);
+    check("rsqrt", Mode::Fast, rsqrt_in, rsqrt_s, rsqrt_a, rsqrt_reference, Metric::Relative, 4e-11);
+
+    vmath::set_mode(Mode::Strict);
+    std::printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
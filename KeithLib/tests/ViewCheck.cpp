@@ -0,0 +1,73 @@
+// Checks that views of views address the right elements. Build it together
+// with the library sources, e.g.
+//
+//   g++ -std=c++17 -O2 -pthread -Isrc tests/ViewCheck.cpp $(find src -name '*.cpp') -o view_check
+//
+// It prints every mismatch and exits non-zero if there was any.
+#include "tensor/impl/TensorImpl.h"
+
+#include <cstdio>
+
+using namespace keith;
+
+namespace {
+
+    int failures = 0;
+
+    void expect(const char* name, data_t got, data_t want) {
+        if (got == want) return;
+        std::printf("%s: got %g, expected %g\n", name, got, want);
+        ++failures;
+    }
+
+    // A 4x6 tensor whose element [i, j] is i * 6 + j.
+    TensorImpl iota() {
+        TensorImpl x(Shape({ 4, 6 }));
+        data_t* data = x.data();
+        for (index_t i = 0; i < x.d_size(); ++i) data[i] = (data_t)i;
+        return x;
+    }
+
+}
+
+int main() {
+    const TensorImpl x = iota();
+
+    auto rows = x.slice(1, 3, 0);
+    auto cols = rows->slice(2, 5, 1);
+    for (index_t i = 0; i < 2; ++i)
+        for (index_t j = 0; j < 3; ++j)
+            expect("slice of slice", (*cols)[{ i, j }], (data_t)((i + 1) * 6 + j + 2));
+    auto row = rows->slice(1, 0);
+    for (index_t j = 0; j < 6; ++j)
+        expect("index of slice", (*row)[{ 0, j }], (data_t)(2 * 6 + j));
+
+    auto flipped = x.flip(0)->flip(1);
+    for (index_t i = 0; i < 4; ++i)
+        for (index_t j = 0; j < 6; ++j)
+            expect("flip of flip", (*flipped)[{ i, j }], (data_t)((3 - i) * 6 + 5 - j));
+    auto flipped_slice = rows->flip(1);
+    for (index_t i = 0; i < 2; ++i)
+        for (index_t j = 0; j < 6; ++j)
+            expect("flip of slice", (*flipped_slice)[{ i, j }], (data_t)((i + 1) * 6 + 5 - j));
+    auto sliced_flip = x.flip(0)->slice(1, 3, 0);
+    for (index_t i = 0; i < 2; ++i)
+        for (index_t j = 0; j < 6; ++j)
+            expect("slice of flip", (*sliced_flip)[{ i, j }], (data_t)((2 - i) * 6 + j));
+
+    auto band = x.slice(1, 4, 0);
+    auto parts = band->split(2, 0);
+    expect("split of slice count", (data_t)parts.size(), 2);
+    for (index_t j = 0; j < 6; ++j) {
+        expect("split of slice", (*parts[0])[{ 1, j }], (data_t)(2 * 6 + j));
+        expect("split of slice", (*parts[1])[{ 0, j }], (data_t)(3 * 6 + j));
+    }
+    auto chunks = band->chunk(3, 1);
+    expect("chunk of slice count", (data_t)chunks.size(), 3);
+    for (index_t c = 0; c < 3; ++c)
+        for (index_t i = 0; i < 3; ++i)
+            expect("chunk of slice", (*chunks[c])[{ i, 1 }], (data_t)((i + 1) * 6 + c * 2 + 1));
+
+    std::printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}